@@ -0,0 +1,199 @@
+#include <cassert>
+#include "asyncconnection.h"
+
+namespace SCS {
+
+AsyncConnection::AsyncConnection( int socket, const NetMessaging::PeerAddress &peerAddress )
+  : Connection(socket, peerAddress), m_pPending(NULL), m_nTurnMessages(0),
+    m_bReadResult(false), m_bClosed(false), m_bFailed(false), m_bYielded(false)
+{
+}
+
+AsyncConnection::~AsyncConnection( )
+{
+}
+
+/*
+ *	Take over the client's coroutine and run it until it first waits.
+ */
+void AsyncConnection::setTask( Task<void> &task )
+{
+	m_Task = static_cast<Task<void> &&>( task );
+	m_Task.start( );
+}
+
+/*
+ *	Returns READ_MESSAGE with msg filled in, READ_CLOSED, or READ_WAIT
+ *	once the socket has been drained (so epoll will report more).
+ */
+AsyncConnection::ReadState AsyncConnection::tryRead( NetMessaging::Protocol::Message &msg )
+{
+	while( true )
+	{
+		if( nextMessage( msg ) ) return READ_MESSAGE;
+		if( isMalformed( ) || m_bClosed ) return READ_CLOSED;
+
+		NetMessaging::Protocol::Result result = receive( );
+
+		if( result == NetMessaging::Protocol::FAILED )
+		{
+			m_bClosed = true;
+		}
+		else if( result == NetMessaging::Protocol::TRYAGAIN )
+		{
+			if( nextMessage( msg ) ) return READ_MESSAGE;
+			return isMalformed( ) ? READ_CLOSED : READ_WAIT;
+		}
+	}
+}
+
+/*
+ *	Replies to the messages handled since the coroutine last waited are
+ *	flushed together, right before it waits again.
+ */
+bool AsyncConnection::ReadAwaiter::await_ready( )
+{
+	AsyncConnection &connection = *pConnection;
+	connection.m_bReadResult = false;
+
+	if( connection.m_bFailed ) return true;
+
+	ReadState state = READ_WAIT;
+
+	if( connection.m_nTurnMessages < MESSAGES_PER_TURN )
+	{
+		state = connection.tryRead( *pMessage );
+	}
+	else
+	{
+		connection.m_bYielded = true; // let the other clients have a turn
+	}
+
+	if( state == READ_MESSAGE )
+	{
+		connection.m_nTurnMessages++;
+		connection.m_bReadResult = true;
+		connection.beginBatch( );
+		return true;
+	}
+
+	if( connection.flush( ) == NetMessaging::Protocol::FAILED )
+	{
+		connection.m_bFailed = true;
+		return true;
+	}
+
+	return state == READ_CLOSED;
+}
+
+void AsyncConnection::ReadAwaiter::await_suspend( std::coroutine_handle<> handle )
+{
+	pConnection->m_pPending = pMessage;
+	pConnection->m_Reader   = handle;
+}
+
+bool AsyncConnection::ReadAwaiter::await_resume( )
+{
+	return pConnection->m_bReadResult;
+}
+
+/*
+ *	The frame is posted like any other and the queue flushed; the writer
+ *	only waits if that left the queue congested.
+ */
+AsyncConnection::WriteAwaiter AsyncConnection::write( NetMessaging::Frame *pFrame )
+{
+	if( !send( pFrame ) ) m_bFailed = true;
+	return WriteAwaiter{ this };
+}
+
+AsyncConnection::WriteAwaiter AsyncConnection::write( const NetMessaging::Protocol::Message &msg )
+{
+	NetMessaging::Frame *pFrame = NetMessaging::Frame::create( msg );
+	WriteAwaiter awaiter = write( pFrame );
+	pFrame->release( );
+
+	return awaiter;
+}
+
+bool AsyncConnection::WriteAwaiter::await_ready( )
+{
+	return !pConnection->awaitDrain( std::coroutine_handle<>( ) );
+}
+
+void AsyncConnection::WriteAwaiter::await_suspend( std::coroutine_handle<> handle )
+{
+	pConnection->m_Writer = handle;
+}
+
+bool AsyncConnection::WriteAwaiter::await_resume( )
+{
+	return !pConnection->m_bFailed;
+}
+
+/*
+ *	Flush and report whether the caller has to wait for the queue to
+ *	drain; if so, and a handle is given, it is resumed once it has.
+ */
+bool AsyncConnection::awaitDrain( std::coroutine_handle<> handle )
+{
+	if( !m_bFailed && flush( ) == NetMessaging::Protocol::FAILED ) m_bFailed = true;
+	if( m_bFailed || !isCongested( ) ) return false;
+
+	if( handle ) m_Writer = handle;
+	return true;
+}
+
+bool AsyncConnection::isCongested( ) const
+{
+	return queuedBytes( ) > queueLimit( ) / 2;
+}
+
+void AsyncConnection::onReadable( )
+{
+	m_nTurnMessages = 0;
+	m_bYielded      = false;
+
+	if( !m_Reader ) return; // busy writing; it reads again when done
+
+	ReadState state = tryRead( *m_pPending );
+	if( state == READ_WAIT ) return;
+
+	if( state == READ_MESSAGE )
+	{
+		m_nTurnMessages++;
+		beginBatch( );
+	}
+
+	m_bReadResult = (state == READ_MESSAGE);
+	resume( m_Reader );
+}
+
+/*
+ *	The socket drained or another thread posted to the mailbox.
+ */
+void AsyncConnection::onWritable( )
+{
+	if( !m_bFailed && flush( ) == NetMessaging::Protocol::FAILED ) m_bFailed = true;
+
+	if( m_bFailed )
+	{
+		// wake the coroutine wherever it waits so it can give up...
+		m_bReadResult = false;
+		if( m_Reader ) resume( m_Reader );
+		else if( m_Writer ) resume( m_Writer );
+	}
+	else if( m_Writer && !isCongested( ) )
+	{
+		resume( m_Writer );
+	}
+}
+
+void AsyncConnection::resume( std::coroutine_handle<> &handle )
+{
+	std::coroutine_handle<> waiting = handle;
+	handle = std::coroutine_handle<>( );
+	waiting.resume( );
+}
+
+} // end of namespace
@@ -0,0 +1,94 @@
+#ifndef _ASYNCCONNECTION_H_
+#define _ASYNCCONNECTION_H_
+/*
+ *	asyncconnection.h
+ *
+ *	A Connection served by a coroutine instead of a thread. The client's
+ *	coroutine reads with co_await readFrame( msg ) and writes with
+ *	co_await write( pFrame ); either suspends it, costing only its frame,
+ *	until the CoroutineLoop that owns the socket reports it ready.
+ *	Writes suspend only while the outbound queue is over half the queue
+ *	limit, which pushes back on the client instead of dropping messages.
+ */
+
+#include <coroutine>
+#include "connection.h"
+#include "task.h"
+
+namespace SCS {
+
+class AsyncConnection : public Connection
+{
+  public:
+	explicit AsyncConnection( int socket, const NetMessaging::PeerAddress &peerAddress = NetMessaging::PeerAddress( ) );
+	virtual ~AsyncConnection( );
+
+	struct ReadAwaiter
+	{
+		AsyncConnection *pConnection;
+		NetMessaging::Protocol::Message *pMessage;
+
+		bool await_ready( );
+		void await_suspend( std::coroutine_handle<> handle );
+		bool await_resume( );
+	};
+
+	struct WriteAwaiter
+	{
+		AsyncConnection *pConnection;
+
+		bool await_ready( );
+		void await_suspend( std::coroutine_handle<> handle );
+		bool await_resume( );
+	};
+
+	ReadAwaiter readFrame( NetMessaging::Protocol::Message &msg );
+	WriteAwaiter write( NetMessaging::Frame *pFrame );
+	WriteAwaiter write( const NetMessaging::Protocol::Message &msg );
+
+	virtual bool awaitDrain( std::coroutine_handle<> handle );
+
+	/*
+	 *	Called by the loop that owns the socket.
+	 */
+	void setTask( Task<void> &task );
+	bool isFinished( ) const;
+	bool hasYielded( ) const; // wants onReadable( ) again without an event
+	void onReadable( );
+	void onWritable( );
+
+  protected:
+	static const int MESSAGES_PER_TURN = 32; // then the other clients get a turn
+
+	enum ReadState {
+		READ_MESSAGE = 0, // a message was extracted
+		READ_WAIT,        // nothing complete yet; wait for the socket
+		READ_CLOSED       // the peer went away or sent garbage
+	};
+
+	ReadState tryRead( NetMessaging::Protocol::Message &msg );
+	bool isCongested( ) const;
+	void resume( std::coroutine_handle<> &handle );
+
+	Task<void> m_Task;
+	std::coroutine_handle<> m_Reader;          // waiting in readFrame( )
+	std::coroutine_handle<> m_Writer;          // waiting for the queue to drain
+	NetMessaging::Protocol::Message *m_pPending; // where m_Reader wants its message
+	int m_nTurnMessages;
+	bool m_bReadResult;
+	bool m_bClosed;  // receive( ) hit the end of the stream
+	bool m_bFailed;  // a write failed; the coroutine must give up
+	bool m_bYielded;
+};
+
+inline AsyncConnection::ReadAwaiter AsyncConnection::readFrame( NetMessaging::Protocol::Message &msg )
+{ return ReadAwaiter{ this, &msg }; }
+
+inline bool AsyncConnection::isFinished( ) const
+{ return m_Task.isDone( ); }
+
+inline bool AsyncConnection::hasYielded( ) const
+{ return m_bYielded; }
+
+} // end of namespace
+#endif
@@ -0,0 +1,1049 @@
+/*
+ *	bench.cc
+ *
+ *	scsbench times the server's hot paths against what they replaced.
+ *	Name the cases to run on the command line; with none, every case is
+ *	run. Not installed; run it from the build directory, preferably from
+ *	an optimized build.
+ *
+ *	The cases that need a server start their own, ./simplechatserver or
+ *	the one named with -s SERVER, on a fresh port for every run counting
+ *	up from 7676 or from -p PORT.
+ *
+ *	send	syscalls and time per message over a socketpair: the old
+ *		send path, one send( ) for the header and one for the
+ *		payload, against one sendmsg( ) per message and against
+ *		gathering queued frames into sendmsg( ) calls the way
+ *		Connection::writeQueued( ) does
+ *	logins	users logging in one after another, each name checked
+ *		against UserTable's name index (50,000 and 10,000 users), and
+ *		against a walk over every user the way handleUserEnter( ) used
+ *		to check it (10,000 users)
+ *	rooms	chat deliveries per second with 16 rooms of 8 clients each
+ *		talking at once, against a server with 1, 2 and 4 epoll
+ *		reactors
+ *	models	the same load against every IO model (-i), with the syscalls
+ *		per message the server counted and the p50/p99 time from a
+ *		message being sent until a member has it
+ *	fields	splitting a typical MT_SEND_CHATROOM_MESSAGE payload and a
+ *		64 KB one with every FieldTokenizer implementation the CPU
+ *		can run
+ *	text	the UTF-8 and control character checks of every TextFilter
+ *		implementation on the text of a typical chat message, on 64 KB
+ *		of ASCII and on 64 KB of text in several scripts
+ *	parser	typical chat messages through FrameParser, screened, screened
+ *		with control characters stripped, and sent as a type that is
+ *		not screened
+ *	compress	a room's chat going out to 8 compressing members: the
+ *		bytes saved and the time per recipient, with every member
+ *		compressing each message and with one shared copy
+ */
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "compressor.h"
+#include "engine.h"
+#include "fieldtokenizer.h"
+#include "frameparser.h"
+#include "main.h"
+#include "protocol.h"
+#include "textfilter.h"
+#include "usertable.h"
+
+using NetMessaging::Compressor;
+using NetMessaging::FieldTokenizer;
+using NetMessaging::Frame;
+using NetMessaging::FrameParser;
+using NetMessaging::PeerAddress;
+using NetMessaging::Protocol;
+using NetMessaging::TextFilter;
+using SCS::User;
+using SCS::UserTable;
+
+namespace {
+
+const size_t LEGACY_HEADER_SIZE = 12; // marker, type and a 64-bit size, as every client sends it
+const int WRITE_BATCH_SIZE      = 64; // frames per sendmsg( ), as in Connection
+
+const char TYPICAL_MESSAGE[] = "general\0Hello everyone, is anybody around tonight?"; // MT_SEND_CHATROOM_MESSAGE
+
+const unsigned int LOAD_ROOMS    = 16;
+const unsigned int LOAD_MEMBERS  = 8;    // clients per room; the first one talks
+const unsigned int LOAD_MESSAGES = 1000; // per room
+const unsigned int LOAD_WINDOW   = 64;   // messages a talker may have on their way
+const long LOAD_PATIENCE         = 5000000000L; // nanoseconds without a delivery before giving up
+
+const char *pServerPath = "./simplechatserver";
+unsigned short nextPort = 7676;
+
+long monotonicNanos( )
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+/*
+ * 	Write a header the way the server does: the marker, the type and
+ * 	the length in network order, the rest of the size field zero.
+ */
+void encodeHeader( Protocol::MessageType type, uint32_t dataSize, char *pWire )
+{
+	uint16_t marker = htons( (uint16_t) Protocol::PROTOCOL_MARKER );
+	uint16_t wireType = htons( (uint16_t) type );
+	uint32_t length = htonl( dataSize );
+
+	memset( pWire, 0, LEGACY_HEADER_SIZE );
+	memcpy( pWire, &marker, sizeof(marker) );
+	memcpy( pWire + 2, &wireType, sizeof(wireType) );
+	memcpy( pWire + 4, &length, sizeof(length) );
+}
+
+/*
+ * 	Read and throw away everything until the other end shuts down.
+ */
+void *drain( void *pArgs )
+{
+	int socket = *static_cast<int *>( pArgs );
+	char buffer[ 65536 ];
+
+	while( recv( socket, buffer, sizeof(buffer), 0 ) > 0 );
+	return NULL;
+}
+
+/*
+ * 	Write all of the vectors to a blocking socket, picking up after
+ * 	partial writes, and count the calls it took.
+ */
+bool sendVectors( int socket, struct iovec *pVectors, int vectorCount, long &calls )
+{
+	while( vectorCount > 0 )
+	{
+		struct msghdr mh;
+		memset( &mh, 0, sizeof(mh) );
+		mh.msg_iov    = pVectors;
+		mh.msg_iovlen = vectorCount;
+
+		ssize_t sentBytes = sendmsg( socket, &mh, MSG_NOSIGNAL );
+		calls++;
+
+		if( sentBytes < 0 ) return false;
+
+		size_t bytes = sentBytes;
+		while( vectorCount > 0 && bytes >= pVectors->iov_len )
+		{
+			bytes -= pVectors->iov_len;
+			pVectors++;
+			vectorCount--;
+		}
+
+		if( vectorCount > 0 )
+		{
+			pVectors->iov_base = static_cast<char *>( pVectors->iov_base ) + bytes;
+			pVectors->iov_len -= bytes;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * 	Write all of the bytes to a blocking socket with send( ), the way
+ * 	the old send path did, and count the calls it took.
+ */
+bool sendBytes( int socket, const char *pData, size_t size, long &calls )
+{
+	while( size > 0 )
+	{
+		ssize_t sentBytes = send( socket, pData, size, MSG_NOSIGNAL );
+		calls++;
+
+		if( sentBytes < 0 ) return false;
+
+		pData += sentBytes;
+		size  -= sentBytes;
+	}
+
+	return true;
+}
+
+enum SendPath {
+	TWO_SENDS = 0,   // header, then payload
+	ONE_SENDMSG,     // header and payload gathered
+	BATCHED_SENDMSG  // up to WRITE_BATCH_SIZE queued frames gathered
+};
+
+/*
+ * 	Average nanoseconds to send one message of payloadSize bytes, with
+ * 	the syscalls each one took in callsPerMessage.
+ */
+double timeSending( SendPath path, size_t payloadSize, unsigned int messages, double &callsPerMessage )
+{
+	int sockets[ 2 ];
+	callsPerMessage = 0.0;
+
+	if( socketpair( AF_UNIX, SOCK_STREAM, 0, sockets ) != 0 )
+	{
+		perror( "socketpair" );
+		return 0.0;
+	}
+
+	pthread_t reader;
+	pthread_create( &reader, NULL, drain, &sockets[ 1 ] );
+
+	// an encoded frame: header and payload in one buffer...
+	std::vector<char> frame( LEGACY_HEADER_SIZE + payloadSize, 'x' );
+	encodeHeader( Protocol::MT_SEND_CHATROOM_MESSAGE, payloadSize, &frame[ 0 ] );
+
+	struct iovec vectors[ WRITE_BATCH_SIZE ];
+	unsigned int sent = 0;
+	long calls = 0;
+	long start = monotonicNanos( );
+
+	while( sent < messages )
+	{
+		bool bSent;
+
+		if( path == TWO_SENDS )
+		{
+			bSent = sendBytes( sockets[ 0 ], &frame[ 0 ], LEGACY_HEADER_SIZE, calls ) &&
+			        sendBytes( sockets[ 0 ], &frame[ LEGACY_HEADER_SIZE ], payloadSize, calls );
+			sent++;
+		}
+		else if( path == ONE_SENDMSG )
+		{
+			vectors[ 0 ].iov_base = &frame[ 0 ];
+			vectors[ 0 ].iov_len  = LEGACY_HEADER_SIZE;
+			vectors[ 1 ].iov_base = &frame[ LEGACY_HEADER_SIZE ];
+			vectors[ 1 ].iov_len  = payloadSize;
+
+			bSent = sendVectors( sockets[ 0 ], vectors, 2, calls );
+			sent++;
+		}
+		else
+		{
+			int vectorCount = 0;
+
+			for( ; vectorCount < WRITE_BATCH_SIZE && sent + vectorCount < messages; vectorCount++ )
+			{
+				vectors[ vectorCount ].iov_base = &frame[ 0 ];
+				vectors[ vectorCount ].iov_len  = frame.size( );
+			}
+
+			bSent = sendVectors( sockets[ 0 ], vectors, vectorCount, calls );
+			sent += vectorCount;
+		}
+
+		if( !bSent )
+		{
+			perror( "send" );
+			break;
+		}
+	}
+
+	double nanos = (double) (monotonicNanos( ) - start);
+
+	shutdown( sockets[ 0 ], SHUT_WR );
+	pthread_join( reader, NULL );
+	close( sockets[ 0 ] );
+	close( sockets[ 1 ] );
+
+	callsPerMessage = sent > 0 ? (double) calls / sent : 0.0;
+	return sent > 0 ? nanos / sent : 0.0;
+}
+
+void benchSending( )
+{
+	static const char *pathNames[ ] = { "send( ) header, send( ) payload", "sendmsg( ) per message", "sendmsg( ) per 64 queued frames" };
+	static const size_t payloadSizes[ ] = { 64, 8192 };
+
+	for( unsigned int i = 0; i < sizeof(payloadSizes) / sizeof(payloadSizes[ 0 ]); i++ )
+	{
+		for( int path = TWO_SENDS; path <= BATCHED_SENDMSG; path++ )
+		{
+			double callsPerMessage;
+			double nanos = timeSending( (SendPath) path, payloadSizes[ i ], payloadSizes[ i ] > 1024 ? 20000 : 200000, callsPerMessage );
+
+			printf( "Send path, %u-byte messages, %s: %.2f syscalls and %.0f ns per message\n",
+			        (unsigned int) payloadSizes[ i ], pathNames[ path ], callsPerMessage, nanos );
+		}
+	}
+}
+
+/*
+ * 	UserTable::forEach( ) visitor that looks for a name, as the login
+ * 	check did before the table had a name index.
+ */
+struct UsernameFinder
+{
+	const std::string &username;
+	bool bFound;
+
+	explicit UsernameFinder( const std::string &name ) : username(name), bFound(false) { }
+	void operator()( const User &user ) { bFound = bFound || user.username( ) == username; }
+};
+
+/*
+ * 	Average nanoseconds for a login to check that its name is free and
+ * 	add the user, for users logging in one after another.
+ */
+double timeLogins( bool bScan, unsigned int users )
+{
+	UserTable table;
+	char username[ 32 ];
+
+	struct sockaddr_in loopback;
+	memset( &loopback, 0, sizeof(loopback) );
+	loopback.sin_family      = AF_INET;
+	loopback.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+	PeerAddress address( loopback );
+
+	long start = monotonicNanos( );
+
+	for( unsigned int i = 0; i < users; i++ )
+	{
+		snprintf( username, sizeof(username), "user%u", i );
+		std::string name( username );
+		bool bTaken;
+
+		if( bScan )
+		{
+			UsernameFinder finder( name );
+			table.forEach( finder );
+			bTaken = finder.bFound;
+		}
+		else
+		{
+			bTaken = table.findByName( name ) != NULL;
+		}
+
+		if( !bTaken ) table.insert( User( i, name, address ) );
+	}
+
+	return users > 0 ? (double) (monotonicNanos( ) - start) / users : 0.0;
+}
+
+void benchLogins( )
+{
+	static const unsigned int USERS         = 50000;
+	static const unsigned int SCANNED_USERS = 10000; // the walk grows with every user; 50,000 take most of a minute
+
+	printf( "Logins, %u users, name index: %.2f us per login\n", USERS, timeLogins( false, USERS ) / 1000.0 );
+	printf( "Logins, %u users, name index: %.2f us per login\n", SCANNED_USERS, timeLogins( false, SCANNED_USERS ) / 1000.0 );
+	printf( "Logins, %u users, walking every user: %.2f us per login\n", SCANNED_USERS, timeLogins( true, SCANNED_USERS ) / 1000.0 );
+}
+
+/*
+ * 	A blocking TCP connection to the server on the loopback interface,
+ * 	or -1.
+ */
+int connectTo( unsigned short port )
+{
+	int clientSocket = socket( AF_INET, SOCK_STREAM, 0 );
+	if( clientSocket < 0 ) return -1;
+
+	struct sockaddr_in address;
+	memset( &address, 0, sizeof(address) );
+	address.sin_family      = AF_INET;
+	address.sin_port        = htons( port );
+	address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+
+	if( connect( clientSocket, (struct sockaddr *) &address, sizeof(address) ) != 0 )
+	{
+		close( clientSocket );
+		return -1;
+	}
+
+	int one = 1;
+	setsockopt( clientSocket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) );
+	return clientSocket;
+}
+
+/*
+ * 	Ask the server to shut down, and make it if it takes too long.
+ */
+void stopServer( pid_t pid )
+{
+	kill( pid, SIGTERM );
+
+	for( int attempt = 0; attempt < 30; attempt++ )
+	{
+		if( waitpid( pid, NULL, WNOHANG ) != 0 ) return;
+		usleep( 100000 );
+	}
+
+	kill( pid, SIGKILL );
+	waitpid( pid, NULL, 0 );
+}
+
+/*
+ * 	Start the server with the given options on the next port and wait
+ * 	until it takes connections. What it prints goes to pOutput, or
+ * 	nowhere. Returns its pid, or -1.
+ */
+pid_t startServer( const std::vector<const char *> &options, unsigned short &port, const char *pOutput = NULL )
+{
+	char portText[ 16 ];
+	port = nextPort++;
+	snprintf( portText, sizeof(portText), "%u", port );
+
+	std::vector<const char *> args;
+	args.push_back( pServerPath );
+	args.push_back( "-p" );
+	args.push_back( portText );
+	args.push_back( "-m" );
+	args.push_back( "1024" );
+	args.insert( args.end( ), options.begin( ), options.end( ) );
+	args.push_back( NULL );
+
+	pid_t pid = fork( );
+
+	if( pid < 0 )
+	{
+		perror( "fork" );
+		return -1;
+	}
+
+	if( pid == 0 )
+	{
+		int output = open( pOutput != NULL ? pOutput : "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+		if( output >= 0 )
+		{
+			dup2( output, STDOUT_FILENO );
+			dup2( output, STDERR_FILENO );
+			close( output );
+		}
+
+		execv( pServerPath, const_cast<char * const *>( &args[ 0 ] ) );
+		_exit( 127 );
+	}
+
+	for( int attempt = 0; attempt < 50; attempt++ )
+	{
+		int probe = connectTo( port );
+		if( probe >= 0 )
+		{
+			close( probe );
+			return pid;
+		}
+
+		if( waitpid( pid, NULL, WNOHANG ) == pid ) break; // it gave up
+		usleep( 100000 );
+	}
+
+	fprintf( stderr, "%s did not start listening on port %u\n", pServerPath, port );
+	stopServer( pid );
+	return -1;
+}
+
+/*
+ * 	One of the load's clients, with whatever part of a frame it has
+ * 	read so far.
+ */
+typedef struct tagClient {
+	int socket;
+	std::string pending;
+	unsigned long delivered; // chat messages received
+} Client;
+
+bool sendFrame( int socket, Protocol::MessageType type, const std::string &payload )
+{
+	std::string frame( LEGACY_HEADER_SIZE, '\0' );
+	encodeHeader( type, payload.length( ), &frame[ 0 ] );
+	frame += payload;
+
+	long calls = 0;
+	return sendBytes( socket, frame.data( ), frame.length( ), calls );
+}
+
+void closeLoad( std::vector<Client> &clients )
+{
+	for( size_t i = 0; i < clients.size( ); i++ ) close( clients[ i ].socket );
+	clients.clear( );
+}
+
+/*
+ * 	Log LOAD_ROOMS x LOAD_MEMBERS clients in, every room's members into
+ * 	their own room. Returns false if the server would not have them.
+ */
+bool joinLoad( unsigned short port, std::vector<Client> &clients )
+{
+	char text[ 32 ];
+
+	for( unsigned int room = 0; room < LOAD_ROOMS; room++ )
+	{
+		for( unsigned int member = 0; member < LOAD_MEMBERS; member++ )
+		{
+			Client client;
+			client.socket    = connectTo( port );
+			client.delivered = 0;
+
+			if( client.socket < 0 ) return false;
+			clients.push_back( client );
+
+			snprintf( text, sizeof(text), "user%u_%u", room, member );
+			if( !sendFrame( client.socket, Protocol::MT_USER_ENTER, std::string( text ) + '\0' ) ) return false;
+
+			snprintf( text, sizeof(text), "room%u", room );
+			if( !sendFrame( client.socket, Protocol::MT_ENTER_CHATROOM, std::string( text ) + '\0' ) ) return false;
+		}
+	}
+
+	usleep( 500000 ); // let every join land before anyone talks
+	return true;
+}
+
+/*
+ * 	Read whatever the client has been sent and count the chat messages
+ * 	in it. Each chat text is the time it was sent at, so if pLatencies
+ * 	is given the age of every message is added to it. Returns false
+ * 	once the server has hung up on it.
+ */
+bool readDeliveries( Client &client, std::vector<long> *pLatencies )
+{
+	char buffer[ 65536 ];
+	ssize_t received = recv( client.socket, buffer, sizeof(buffer), MSG_DONTWAIT );
+
+	if( received < 0 ) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	if( received == 0 ) return false;
+
+	client.pending.append( buffer, received );
+
+	size_t offset = 0;
+	while( client.pending.length( ) - offset >= LEGACY_HEADER_SIZE )
+	{
+		uint16_t type;
+		uint32_t length;
+		memcpy( &type, client.pending.data( ) + offset + 2, sizeof(type) );
+		memcpy( &length, client.pending.data( ) + offset + 4, sizeof(length) );
+		length = ntohl( length );
+
+		if( client.pending.length( ) - offset < LEGACY_HEADER_SIZE + length ) break; // the rest is on its way
+
+		if( ntohs( type ) == Protocol::MT_SEND_CHATROOM_MESSAGE )
+		{
+			client.delivered++;
+
+			if( pLatencies != NULL )
+			{
+				// username\0chatroom\0text\0
+				std::string payload( client.pending, offset + LEGACY_HEADER_SIZE, length );
+				size_t text = payload.find( '\0', payload.find( '\0' ) + 1 );
+				if( text != std::string::npos ) pLatencies->push_back( monotonicNanos( ) - atol( payload.c_str( ) + text + 1 ) );
+			}
+		}
+
+		offset += LEGACY_HEADER_SIZE + length;
+	}
+
+	client.pending.erase( 0, offset );
+	return true;
+}
+
+/*
+ * 	Have every room's first member send LOAD_MESSAGES chat messages, at
+ * 	most LOAD_WINDOW of them ahead of their own copy coming back, until
+ * 	every member has had them all. Returns deliveries per second; the
+ * 	time every delivery took goes into pLatencies, if given.
+ */
+double runLoad( std::vector<Client> &clients, std::vector<long> *pLatencies = NULL )
+{
+	unsigned long expected  = (unsigned long) LOAD_ROOMS * LOAD_MEMBERS * LOAD_MESSAGES;
+	unsigned long delivered = 0;
+	std::vector<unsigned long> sent( LOAD_ROOMS, 0 );
+	std::vector<struct pollfd> polled( clients.size( ) );
+	char room[ 32 ];
+	char text[ 32 ];
+
+	for( size_t i = 0; i < clients.size( ); i++ )
+	{
+		polled[ i ].fd     = clients[ i ].socket;
+		polled[ i ].events = POLLIN;
+	}
+
+	long start = monotonicNanos( );
+	long lastDelivery = start;
+
+	while( delivered < expected && monotonicNanos( ) - lastDelivery < LOAD_PATIENCE )
+	{
+		for( unsigned int r = 0; r < LOAD_ROOMS; r++ )
+		{
+			Client &talker = clients[ r * LOAD_MEMBERS ];
+			snprintf( room, sizeof(room), "room%u", r );
+
+			while( sent[ r ] < LOAD_MESSAGES && sent[ r ] - talker.delivered < LOAD_WINDOW )
+			{
+				snprintf( text, sizeof(text), "%ld", monotonicNanos( ) );
+				if( !sendFrame( talker.socket, Protocol::MT_SEND_CHATROOM_MESSAGE, std::string( room ) + '\0' + text + '\0' ) ) break;
+				sent[ r ]++;
+			}
+		}
+
+		if( poll( &polled[ 0 ], polled.size( ), 100 ) < 0 && errno != EINTR ) break;
+
+		for( size_t i = 0; i < clients.size( ); i++ )
+		{
+			if( polled[ i ].revents == 0 ) continue;
+
+			unsigned long before = clients[ i ].delivered;
+			if( !readDeliveries( clients[ i ], pLatencies ) )
+			{
+				fprintf( stderr, "The server hung up on a client\n" );
+				return 0.0;
+			}
+
+			if( clients[ i ].delivered > before )
+			{
+				delivered += clients[ i ].delivered - before;
+				lastDelivery = monotonicNanos( );
+			}
+		}
+	}
+
+	double seconds = (monotonicNanos( ) - start) / 1e9;
+
+	if( delivered < expected ) fprintf( stderr, "%lu of %lu deliveries never arrived\n", expected - delivered, expected );
+	return seconds > 0 ? delivered / seconds : 0.0;
+}
+
+void benchRooms( )
+{
+	static const char *reactors[ ] = { "1", "2", "4" };
+
+	for( unsigned int i = 0; i < sizeof(reactors) / sizeof(reactors[ 0 ]); i++ )
+	{
+		std::vector<const char *> options;
+		options.push_back( "-t" );
+		options.push_back( reactors[ i ] );
+
+		unsigned short port;
+		pid_t pid = startServer( options, port );
+		if( pid < 0 ) return;
+
+		std::vector<Client> clients;
+		double rate = joinLoad( port, clients ) ? runLoad( clients ) : 0.0;
+
+		closeLoad( clients );
+		stopServer( pid );
+
+		printf( "Rooms, %u rooms of %u clients, %s epoll reactor(s): %.0f deliveries/s\n",
+		        LOAD_ROOMS, LOAD_MEMBERS, reactors[ i ], rate );
+	}
+}
+
+/*
+ * 	The number that follows pKey on the last line of the server's log
+ * 	that contains pLine, or -1.
+ */
+double findStat( const std::string &log, const char *pLine, const char *pKey )
+{
+	size_t line = log.rfind( pLine );
+	if( line == std::string::npos ) return -1.0;
+
+	size_t end = log.find( '\n', line );
+	size_t key = log.substr( line, end - line ).find( pKey );
+	if( key == std::string::npos ) return -1.0;
+
+	return atof( log.c_str( ) + line + key + strlen( pKey ) );
+}
+
+std::string readFile( const char *pPath )
+{
+	std::string contents;
+	char buffer[ 4096 ];
+	FILE *pFile = fopen( pPath, "r" );
+
+	if( pFile == NULL ) return contents;
+
+	size_t read;
+	while( (read = fread( buffer, 1, sizeof(buffer), pFile )) > 0 ) contents.append( buffer, read );
+
+	fclose( pFile );
+	return contents;
+}
+
+double percentileMillis( std::vector<long> &samples, double fraction )
+{
+	if( samples.empty( ) ) return 0.0;
+
+	size_t rank = (size_t) (fraction * (samples.size( ) - 1));
+	std::nth_element( samples.begin( ), samples.begin( ) + rank, samples.end( ) );
+	return samples[ rank ] / 1e6;
+}
+
+void benchModels( )
+{
+	static const char *models[ ] = { "threads", "epoll", "pool", "coro", "uring" };
+	char logPath[ ] = "/tmp/scsbench-XXXXXX";
+
+	int log = mkstemp( logPath );
+	if( log < 0 )
+	{
+		perror( "mkstemp" );
+		return;
+	}
+	close( log );
+
+	for( unsigned int i = 0; i < sizeof(models) / sizeof(models[ 0 ]); i++ )
+	{
+		std::vector<const char *> options;
+		options.push_back( "-v" );
+		options.push_back( "-i" );
+		options.push_back( models[ i ] );
+
+		unsigned short port;
+		pid_t pid = startServer( options, port, logPath );
+		if( pid < 0 ) break;
+
+		std::vector<Client> clients;
+		std::vector<long> latencies;
+		double rate = joinLoad( port, clients ) ? runLoad( clients, &latencies ) : 0.0;
+
+		// the server logs its statistics on SIGUSR1, and its output
+		// only reaches the file for certain once it has exited...
+		kill( pid, SIGUSR1 );
+		usleep( 300000 );
+
+		closeLoad( clients );
+		stopServer( pid );
+
+		std::string output = readFile( logPath );
+
+		printf( "Models, %s%s: %.2f syscalls per message received, p50 %.1f ms and p99 %.1f ms to deliver, %.0f deliveries/s\n",
+		        models[ i ], output.find( "Falling back" ) != std::string::npos ? " (fell back to epoll)" : "",
+		        findStat( output, "Syscalls:", "; " ), percentileMillis( latencies, 0.50 ),
+		        percentileMillis( latencies, 0.99 ), rate );
+	}
+
+	unlink( logPath );
+}
+
+/*
+ * 	Average nanoseconds to split the whole payload on '\0', over rounds
+ * 	runs (after a tenth as many to warm up).
+ */
+double timeSplitting( FieldTokenizer::Implementation implementation, const char *pData, size_t size, unsigned int rounds )
+{
+	const char *pEnd = pData + size;
+	volatile size_t fields = 0; // keeps the loop from being optimized away
+	long start = 0;
+
+	for( unsigned int i = 0; i < rounds + rounds / 10; i++ )
+	{
+		if( i == rounds / 10 ) start = monotonicNanos( );
+
+		for( const char *p = pData; p < pEnd; p = FieldTokenizer::find( implementation, p, pEnd, '\0' ) + 1 )
+		{
+			fields = fields + 1;
+		}
+	}
+
+	return rounds > 0 ? (double) (monotonicNanos( ) - start) / rounds : 0.0;
+}
+
+void benchFields( )
+{
+	std::string large( "general" );
+	large.append( 1, '\0' ).append( 65536 - large.length( ) - 2, 'x' ).append( 1, '\0' );
+
+	for( int i = FieldTokenizer::IMPLEMENTATIONS - 1; i >= 0; i-- )
+	{
+		FieldTokenizer::Implementation implementation = (FieldTokenizer::Implementation) i;
+		if( !FieldTokenizer::isSupported( implementation ) ) continue;
+
+		double typicalNanos = timeSplitting( implementation, TYPICAL_MESSAGE, sizeof(TYPICAL_MESSAGE), 100000 );
+		double largeNanos   = timeSplitting( implementation, large.data( ), large.length( ), 200 );
+
+		printf( "Fields, %s%s: %.1f ns per %u-byte payload, %.2f us per 64 KB payload (%.2f GB/s)\n",
+		        FieldTokenizer::name( implementation ),
+		        implementation == FieldTokenizer::implementation( ) ? " (in use)" : "",
+		        typicalNanos, (unsigned int) sizeof(TYPICAL_MESSAGE), largeNanos / 1000.0,
+		        largeNanos > 0 ? large.length( ) / largeNanos : 0.0 );
+	}
+}
+
+/*
+ * 	Average nanoseconds to validate the text and look for control
+ * 	characters in it, the way the text of a chat message is screened.
+ */
+double timeScreening( TextFilter::Implementation implementation, const char *pData, size_t size, unsigned int rounds )
+{
+	volatile size_t passed = 0;
+	long start = 0;
+
+	for( unsigned int i = 0; i < rounds + rounds / 10; i++ )
+	{
+		if( i == rounds / 10 ) start = monotonicNanos( );
+
+		if( TextFilter::isValidUtf8( implementation, pData, size ) &&
+		    TextFilter::findControl( implementation, pData, pData + size ) == pData + size )
+		{
+			passed = passed + 1;
+		}
+	}
+
+	return rounds > 0 ? (double) (monotonicNanos( ) - start) / rounds : 0.0;
+}
+
+void benchText( )
+{
+	static const char mixed[] = "Gr\xC3\xBC\xC3\x9F" "e, \xE4\xB8\x96\xE7\x95\x8C! \xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82 \xF0\x9F\x98\x80 ok. ";
+
+	// only the text field; the room name's terminator would count as a control character...
+	const char *pText = TYPICAL_MESSAGE + strlen( TYPICAL_MESSAGE ) + 1;
+	size_t textSize = strlen( pText );
+
+	std::string ascii( 65536, 'x' );
+	std::string multibyte;
+	while( multibyte.length( ) + sizeof(mixed) - 1 <= 65536 ) multibyte.append( mixed );
+
+	for( int i = TextFilter::IMPLEMENTATIONS - 1; i >= 0; i-- )
+	{
+		TextFilter::Implementation implementation = (TextFilter::Implementation) i;
+		if( !TextFilter::isSupported( implementation ) ) continue;
+
+		double typicalNanos   = timeScreening( implementation, pText, textSize, 100000 );
+		double asciiNanos     = timeScreening( implementation, ascii.data( ), ascii.length( ), 200 );
+		double multibyteNanos = timeScreening( implementation, multibyte.data( ), multibyte.length( ), 200 );
+
+		printf( "Text, %s%s: %.1f ns per %u-byte message text, %.2f GB/s on 64 KB of ASCII, %.2f GB/s on 64 KB of mixed scripts\n",
+		        TextFilter::name( implementation ),
+		        implementation == TextFilter::implementation( ) ? " (in use)" : "",
+		        typicalNanos, (unsigned int) textSize,
+		        asciiNanos > 0 ? ascii.length( ) / asciiNanos : 0.0,
+		        multibyteNanos > 0 ? multibyte.length( ) / multibyteNanos : 0.0 );
+	}
+}
+
+/*
+ * 	Average nanoseconds for FrameParser to carve one message out of a
+ * 	stream of legacy frames of the given type, each carrying the typical
+ * 	chat payload. Only MT_SEND_CHATROOM_MESSAGE is screened.
+ */
+double timeParsing( Protocol::MessageType type, unsigned int messages )
+{
+	std::string stream;
+	char header[ LEGACY_HEADER_SIZE ];
+
+	encodeHeader( type, sizeof(TYPICAL_MESSAGE), header );
+	for( unsigned int i = 0; i < messages; i++ )
+	{
+		stream.append( header, LEGACY_HEADER_SIZE ).append( TYPICAL_MESSAGE, sizeof(TYPICAL_MESSAGE) );
+	}
+
+	FrameParser parser;
+	Protocol::Message msg;
+	unsigned int parsed = 0;
+	size_t offset = 0;
+	long start = monotonicNanos( );
+
+	while( offset < stream.length( ) )
+	{
+		offset += parser.append( stream.data( ) + offset, stream.length( ) - offset );
+
+		while( parser.next( msg ) )
+		{
+			parsed++;
+			Protocol::freeMessageData( msg );
+		}
+	}
+
+	long elapsed = monotonicNanos( ) - start;
+
+	if( parsed != messages ) fprintf( stderr, "The parser handed out %u of %u messages\n", parsed, messages );
+	return messages > 0 ? (double) elapsed / messages : 0.0;
+}
+
+void benchParser( )
+{
+	static const unsigned int MESSAGES = 200000;
+
+	double unscreened = timeParsing( Protocol::MT_SEND_USER_MESSAGE, MESSAGES );
+	double screened   = timeParsing( Protocol::MT_SEND_CHATROOM_MESSAGE, MESSAGES );
+
+	FrameParser::setStripControls( true );
+	double stripped = timeParsing( Protocol::MT_SEND_CHATROOM_MESSAGE, MESSAGES );
+	FrameParser::setStripControls( false );
+
+	printf( "Parser, %u-byte messages, not screened: %.1f ns per message\n", (unsigned int) sizeof(TYPICAL_MESSAGE), unscreened );
+	printf( "Parser, %u-byte messages, screened: %.1f ns per message\n", (unsigned int) sizeof(TYPICAL_MESSAGE), screened );
+	printf( "Parser, %u-byte messages, screened, controls stripped: %.1f ns per message\n", (unsigned int) sizeof(TYPICAL_MESSAGE), stripped );
+}
+
+/*
+ * 	Push chat messages, each a line of some made-up conversation,
+ * 	through a compressor per recipient the way one room's broadcasts
+ * 	would go. Returns nanoseconds per message per recipient;
+ * 	bytes in and out are added up in bytesIn and bytesOut.
+ */
+double timeCompressing( bool bShared, unsigned int recipients, unsigned int messages, long &bytesIn, long &bytesOut )
+{
+	static const char *lines[ ] = {
+		"has anybody tried the new build on the staging servers yet? the login page still looks broken to me",
+		"yes, I deployed it this morning; the login page is fixed but the user list takes a while to load",
+		"the user list is slow because every client asks for it again whenever somebody joins the room",
+		"we could cache the user list on the server and only send the changes when somebody joins or leaves",
+	};
+
+	std::vector<Compressor *> compressors;
+	for( unsigned int i = 0; i < recipients; i++ )
+	{
+		Compressor *pCompressor = Compressor::create( );
+		if( pCompressor == NULL ) return 0.0; // no zlib
+		compressors.push_back( pCompressor );
+	}
+
+	long start = monotonicNanos( );
+
+	for( unsigned int m = 0; m < messages; m++ )
+	{
+		std::string payload( "alice" );
+		payload.append( 1, '\0' ).append( "general" ).append( 1, '\0' );
+		payload.append( lines[ m % (sizeof(lines) / sizeof(lines[ 0 ])) ] ).append( 1, '\0' );
+
+		Frame *pFrame = Frame::create( Protocol::MT_SEND_CHATROOM_MESSAGE, payload.data( ), payload.length( ) );
+		if( bShared ) pFrame->setBroadcast( );
+
+		for( unsigned int r = 0; r < recipients; r++ )
+		{
+			Frame *pCompressed = compressors[ r ]->compress( pFrame );
+			bytesIn  += pFrame->dataSize( );
+			bytesOut += pCompressed != NULL ? pCompressed->dataSize( ) : pFrame->dataSize( );
+			if( pCompressed != NULL ) pCompressed->release( );
+		}
+
+		pFrame->release( );
+	}
+
+	long elapsed = monotonicNanos( ) - start;
+
+	for( unsigned int i = 0; i < recipients; i++ ) delete compressors[ i ];
+	return (double) elapsed / ((double) messages * recipients);
+}
+
+void benchCompress( )
+{
+	static const unsigned int RECIPIENTS = 8;
+	static const unsigned int MESSAGES   = 20000;
+
+	Compressor::setThreshold( 64 );
+
+	for( int shared = 0; shared <= 1; shared++ )
+	{
+		long bytesIn = 0, bytesOut = 0;
+		double nanos = timeCompressing( shared != 0, RECIPIENTS, MESSAGES, bytesIn, bytesOut );
+
+		if( bytesIn == 0 )
+		{
+			printf( "Compress: not built with zlib\n" );
+			return;
+		}
+
+		printf( "Compress, %u recipients, %s: %.0f%% of the bytes, %.0f ns per message per recipient\n",
+		        RECIPIENTS, shared ? "one shared copy" : "each compresses", 100.0 * bytesOut / bytesIn, nanos );
+	}
+}
+
+typedef struct tagCase {
+	const char *pName;
+	void (*run)( );
+} Case;
+
+const Case cases[ ] = {
+	{ "send",   benchSending },
+	{ "logins", benchLogins },
+	{ "rooms",  benchRooms },
+	{ "models", benchModels },
+	{ "fields", benchFields },
+	{ "text",   benchText },
+	{ "parser", benchParser },
+	{ "compress", benchCompress }
+};
+
+const unsigned int CASE_COUNT = sizeof(cases) / sizeof(cases[ 0 ]);
+
+} // end of anonymous namespace
+
+/*
+ * 	The server modules linked in here report through the Engine, which
+ * 	is not; errors go to stderr and everything else is dropped.
+ */
+namespace SCS {
+
+void Engine::onError( const char *pErrorMessageFormat, ... )
+{
+	va_list args;
+
+	va_start( args, pErrorMessageFormat );
+	fprintf( stderr, SCS_ERROR_HEADER );
+	vfprintf( stderr, pErrorMessageFormat, args );
+	fprintf( stderr, "\n" );
+	va_end( args );
+}
+
+void Engine::onInfo( const char *, ... )
+{
+}
+
+} // end of namespace
+
+int main( int argc, char *argv[] )
+{
+	std::vector<bool> selected( CASE_COUNT, false );
+	bool bSelected = false;
+
+	for( int i = 1; i < argc; i++ )
+	{
+		if( !strcmp( argv[ i ], "-s" ) && i + 1 < argc )
+		{
+			pServerPath = argv[ ++i ];
+			continue;
+		}
+		else if( !strcmp( argv[ i ], "-p" ) && i + 1 < argc )
+		{
+			nextPort = atoi( argv[ ++i ] );
+			continue;
+		}
+
+		unsigned int c = 0;
+		while( c < CASE_COUNT && strcmp( argv[ i ], cases[ c ].pName ) != 0 ) c++;
+
+		if( c == CASE_COUNT )
+		{
+			fprintf( stderr, "Unknown case: %s\n", argv[ i ] );
+			fprintf( stderr, "Usage: %s [ -s SERVER ] [ -p PORT ] [ CASE ... ]; CASE is one of:", argv[ 0 ] );
+			for( c = 0; c < CASE_COUNT; c++ ) fprintf( stderr, " %s", cases[ c ].pName );
+			fprintf( stderr, "\n" );
+			return 1;
+		}
+
+		selected[ c ] = bSelected = true;
+	}
+
+	signal( SIGPIPE, SIG_IGN );
+
+	for( unsigned int c = 0; c < CASE_COUNT; c++ )
+	{
+		if( !bSelected || selected[ c ] ) cases[ c ].run( );
+	}
+
+	return 0;
+}
@@ -0,0 +1,140 @@
+///////////////////////////////////////////////////////////////////////////////////
+//// BufferPool.cc ////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#include <cassert>
+#include <new>
+#include "bufferpool.h"
+
+namespace NetMessaging {
+
+namespace {
+
+const unsigned int LARGE_CLASS = 0xFF;
+const unsigned int BLOCK_TAG   = 0x42504F4C; // "BPOL"
+
+/*
+ *	Sits in front of every buffer handed out; 16 bytes so the payload
+ *	keeps the allocator's alignment.
+ */
+struct BlockHeader
+{
+	unsigned int sizeClass;
+	unsigned int tag;
+	BlockHeader *pNext; // free list link, only while cached
+};
+
+struct ThreadCache
+{
+	BlockHeader *freeList[ BufferPool::SIZE_CLASSES ];
+	unsigned int count[ BufferPool::SIZE_CLASSES ];
+};
+
+__thread ThreadCache *t_pCache = NULL;
+pthread_key_t cacheKey;
+pthread_once_t cacheKeyOnce = PTHREAD_ONCE_INIT;
+
+/*
+ *	Runs when a thread exits (client threads come and go) so that its
+ *	cached blocks are not leaked.
+ */
+void destroyCache( void *pData )
+{
+	ThreadCache *pCache = static_cast<ThreadCache *>( pData );
+
+	for( unsigned int i = 0; i < BufferPool::SIZE_CLASSES; i++ )
+	{
+		while( pCache->freeList[ i ] != NULL )
+		{
+			BlockHeader *pBlock = pCache->freeList[ i ];
+			pCache->freeList[ i ] = pBlock->pNext;
+			::operator delete( pBlock );
+		}
+	}
+
+	delete pCache;
+}
+
+void createCacheKey( )
+{
+	pthread_key_create( &cacheKey, destroyCache );
+}
+
+ThreadCache *threadCache( )
+{
+	if( t_pCache == NULL )
+	{
+		pthread_once( &cacheKeyOnce, createCacheKey );
+		t_pCache = new ThreadCache( );
+		pthread_setspecific( cacheKey, t_pCache );
+	}
+
+	return t_pCache;
+}
+
+unsigned int sizeClass( size_t size )
+{
+	unsigned int c = 0;
+	for( size_t blockSize = BufferPool::MIN_BLOCK_SIZE; blockSize < size; blockSize <<= 1 )
+		c++;
+
+	return c < BufferPool::SIZE_CLASSES ? c : LARGE_CLASS;
+}
+
+} // end of anonymous namespace
+
+StripedCounter BufferPool::m_Hits;
+StripedCounter BufferPool::m_Misses;
+
+char *BufferPool::allocate( size_t size )
+{
+	unsigned int c = sizeClass( size );
+	BlockHeader *pBlock = NULL;
+
+	if( c != LARGE_CLASS )
+	{
+		ThreadCache *pCache = threadCache( );
+		pBlock = pCache->freeList[ c ];
+
+		if( pBlock != NULL )
+		{
+			pCache->freeList[ c ] = pBlock->pNext;
+			pCache->count[ c ]--;
+			m_Hits.add( );
+			return reinterpret_cast<char *>( pBlock + 1 );
+		}
+
+		size = MIN_BLOCK_SIZE << c;
+	}
+
+	m_Misses.add( );
+	pBlock = static_cast<BlockHeader *>( ::operator new( sizeof(BlockHeader) + size ) );
+	pBlock->sizeClass = c;
+	pBlock->tag       = BLOCK_TAG;
+	return reinterpret_cast<char *>( pBlock + 1 );
+}
+
+void BufferPool::release( char *pBuffer )
+{
+	if( pBuffer == NULL ) return;
+
+	BlockHeader *pBlock = reinterpret_cast<BlockHeader *>( pBuffer ) - 1;
+	assert( pBlock->tag == BLOCK_TAG ); // not from allocate( )
+
+	unsigned int c = pBlock->sizeClass;
+	if( c != LARGE_CLASS )
+	{
+		ThreadCache *pCache = threadCache( );
+		if( pCache->count[ c ] < MAX_CACHED && (pCache->count[ c ] + 1) * (MIN_BLOCK_SIZE << c) <= MAX_CACHED_BYTES )
+		{
+			pBlock->pNext = pCache->freeList[ c ];
+			pCache->freeList[ c ] = pBlock;
+			pCache->count[ c ]++;
+			return;
+		}
+	}
+
+	pBlock->tag = 0;
+	::operator delete( pBlock );
+}
+
+}// end of namespace
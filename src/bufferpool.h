@@ -0,0 +1,48 @@
+#ifndef _BUFFERPOOL_H_
+#define _BUFFERPOOL_H_
+///////////////////////////////////////////////////////////////////////////////////
+//// BufferPool.h /////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include "synchronize.h"
+
+namespace NetMessaging {
+
+/*
+ *	Payload buffers for received messages. Buffers are rounded up to a
+ *	power-of-two size class and recycled through a small per-thread free
+ *	list, so the steady state of receive/handle/free does not touch the
+ *	allocator at all and threads never contend with each other. Every
+ *	buffer carries a tag in front of it recording its size class, which
+ *	lets any thread give it back (it simply joins that thread's list).
+ *	Buffers bigger than the largest class go straight to the heap.
+ */
+class BufferPool
+{
+  public:
+	static const size_t MIN_BLOCK_SIZE    = 64;
+	static const unsigned int SIZE_CLASSES = 11;  // 64 bytes .. 64 KB
+	static const unsigned int MAX_CACHED   = 64;  // free blocks kept per class and thread...
+	static const size_t MAX_CACHED_BYTES   = 262144; // ...but no more than this many bytes
+
+	static char *allocate( size_t size );
+	static void release( char *pBuffer );
+
+	static long hits( );
+	static long misses( );
+
+  private:
+	static StripedCounter m_Hits;
+	static StripedCounter m_Misses;
+
+	BufferPool( );
+};
+
+inline long BufferPool::hits( )
+{ return m_Hits.value( ); }
+
+inline long BufferPool::misses( )
+{ return m_Misses.value( ); }
+
+}// end of namespace
+#endif
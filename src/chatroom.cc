@@ -1,8 +1,13 @@
 #include <cassert>
 #include <iostream>
+#include <algorithm>
+#include <new>
+#include <ctime>
+#include <sched.h>
 
 #include "chatroom.h"
 #include "simplechatserver.h"
+#include "chatroomregistry.h"
 #include "protocol.h"
 
 using namespace std;
@@ -11,90 +16,213 @@ namespace SCS {
 
 const char *NOTIFICATION_PREFIX = "=====> ";
 
-Chatroom::Chatroom( const std::string &name )
-	: m_Name(name), m_nNumberOfUsers(0)
+AtomicCounter Chatroom::m_MembershipUpdates;
+AtomicCounter Chatroom::m_MembershipUpdateNanos;
+AtomicCounter Chatroom::m_LongestMembershipUpdate;
+
+Chatroom::Members *Chatroom::Members::create( unsigned int count )
+{
+	void *pMemory = ::operator new( sizeof(Members) + (count > 0 ? count - 1 : 0) * sizeof(int) );
+	Members *pMembers = new (pMemory) Members( );
+	pMembers->m_nCount = count;
+	return pMembers;
+}
+
+void Chatroom::Members::destroy( )
 {
+	this->~Members( );
+	::operator delete( this );
+}
+
+bool Chatroom::Members::contains( int userSocket ) const
+{ return binary_search( begin( ), end( ), userSocket ); }
+
+/*
+ *	id must be interned in names, with a reference the caller holds; the
+ *	room takes one of its own, so its name stays interned until the room
+ *	is gone.
+ */
+Chatroom::Chatroom( ChatroomId id, ChatroomNames &names )
+	: m_Id(id), m_Names(names), m_pName(&names.name( id )), m_pMembers(Members::create( 0 )), m_nNumberOfUsers(0), m_nEpoch(0),
+	  m_References(1), m_bClosed(false)
+{
+	m_Names.retain( m_Id );
 }
 
 Chatroom::~Chatroom( )
 {
+	m_pMembers->destroy( );
+	m_Names.release( m_Id );
+}
+
+/*
+ *	Members are a flat sorted array of sockets: broadcasts walk contiguous
+ *	memory. Call with the room locked; userLabel ("username@ip") is what
+ *	the other members are told.
+ */
+void Chatroom::addUser( int userSocket, const std::string &userLabel )
+{
+	const Members *pCurrent = m_pMembers;
+	if( pCurrent->contains( userSocket ) ) return; // already a member
+
+	Members *pNext = Members::create( pCurrent->size( ) + 1 );
+	size_t before = lower_bound( pCurrent->begin( ), pCurrent->end( ), userSocket ) - pCurrent->begin( );
+
+	copy( pCurrent->begin( ), pCurrent->begin( ) + before, pNext->m_Sockets );
+	pNext->m_Sockets[ before ] = userSocket;
+	copy( pCurrent->begin( ) + before, pCurrent->end( ), pNext->m_Sockets + before + 1 );
+
+	publish( pNext );
+	notifyEveryoneThatUserJoined( userSocket, userLabel );		
+	m_nNumberOfUsers++;
+}
+
+void Chatroom::removeUser( int userSocket, const std::string &userLabel )
+{
+	const Members *pCurrent = m_pMembers;
+	if( !pCurrent->contains( userSocket ) ) return; // not a member
+
+	Members *pNext = Members::create( pCurrent->size( ) - 1 );
+	remove_copy( pCurrent->begin( ), pCurrent->end( ), pNext->m_Sockets, userSocket );
+
+	publish( pNext );
+	notifyEveryoneThatUserLeft( userSocket, userLabel );
+
+	m_nNumberOfUsers--;
 }
 
-void Chatroom::addUser( int userSocket )
+/*
+ *	Swap in a new membership and wait out the broadcasts that may still
+ *	be reading the old one. Broadcasts register under the parity of the
+ *	epoch they started in; flipping the epoch lets new broadcasts count
+ *	themselves elsewhere, so the wait is bounded by the broadcasts that
+ *	were already running. Call with the room locked (one writer at a
+ *	time) and outside any read section.
+ */
+void Chatroom::publish( Members *pMembers )
 {
-	pair<SocketCollection::iterator, bool> pr = m_UserSockets.insert( userSocket );
+	struct timespec start, end;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+
+	Members *pOld = m_pMembers;
+	__sync_synchronize( );
+	m_pMembers = pMembers;
 
-	if( pr.second ) // user was added successfully
+	unsigned long epoch = m_nEpoch;
+	__sync_synchronize( );
+	m_nEpoch = epoch + 1;
+	__sync_synchronize( );
+
+	while( m_Readers[ epoch & 1 ].value( ) != 0 )
 	{
-		notifyEveryoneThatUserJoined( userSocket );		
-		m_nNumberOfUsers++;
+		sched_yield( );
 	}
+
+	pOld->destroy( );
+
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	long nanos = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+	m_MembershipUpdates.add( );
+	m_MembershipUpdateNanos.add( nanos );
+	m_LongestMembershipUpdate.raiseTo( nanos );
 }
 
-void Chatroom::removeUser( int userSocket )
+/*
+ *	Enter a read section and return the current membership, which stays
+ *	valid until endRead( epoch ). Never blocks.
+ */
+const Chatroom::Members *Chatroom::beginRead( unsigned long &epoch ) const
 {
-	SocketCollection::iterator itr = m_UserSockets.find( userSocket );
-
-	if( itr != m_UserSockets.end( ) ) // found user, so remove him
+	while( true )
 	{
-		m_UserSockets.erase( itr );
-		notifyEveryoneThatUserLeft( userSocket );
+		epoch = m_nEpoch;
+		m_Readers[ epoch & 1 ].add( ); // a full barrier
+
+		if( m_nEpoch == epoch ) break;
 
-		m_nNumberOfUsers--;
+		// a writer flipped the epoch under us; count ourselves in the new one
+		m_Readers[ epoch & 1 ].subtract( );
 	}
+
+	return m_pMembers;
+}
+
+void Chatroom::endRead( unsigned long epoch ) const
+{
+	m_Readers[ epoch & 1 ].subtract( );
+}
+
+void Chatroom::lock( ) const
+{
+	ChatroomRegistry::lock( m_Lock ); // counts contention
 }
 
 void Chatroom::notifyEveryone( const std::string &message, int type, int excludeUserSocket ) const
 {
-	SocketCollection::const_iterator itr;
+	SimpleChatServer *pServer = SimpleChatServer::getInstance( );
+	NetMessaging::Frame *pFrame = NetMessaging::Frame::create( type, message.c_str( ), message.length( ) + 1 /* plus 1 for '\0'*/ );
+	pFrame->setBroadcast( );
 
-	for( itr = m_UserSockets.begin( ); itr != m_UserSockets.end( ); ++itr )
+	unsigned long epoch;
+	const Members *pMembers = beginRead( epoch );
+
+	for( const int *itr = pMembers->begin( ); itr != pMembers->end( ); ++itr )
 	{
 		if( *itr != excludeUserSocket )
 		{
-			NetMessaging::Protocol::sendServerMessage( *itr, type, message );
+			pServer->sendMessage( *itr, pFrame );
 		}
 	}
+
+	endRead( epoch );
+	pFrame->release( );
 }
 
-void Chatroom::sendMessage( int fromUserSocket, const std::string &message ) const
+/*
+ *	Broadcasts read the published membership and do not need the room
+ *	lock; nor do they ever wait for a join or leave.
+ */
+void Chatroom::sendMessage( std::string_view fromUsername, std::string_view message ) const
 {
 	SimpleChatServer *pServer = SimpleChatServer::getInstance( );
-	User user( 0 );
-	pServer->getUserFromSocket( fromUserSocket, user );
-
-	std::string payload = user.username( ) + '\0' + m_Name + '\0' + message + '\0';
+	std::string payload;
+	payload.reserve( fromUsername.length( ) + m_pName->length( ) + message.length( ) + 3 );
+	payload.append( fromUsername ).append( 1, '\0' ).append( *m_pName ).append( 1, '\0' ).append( message ).append( 1, '\0' );
 
 	#ifdef _DEBUG
 	cout << "DEBUG Chatroom::sendMessage( ): payload = [" << payload << "] (Null bytes not shown)" << endl;
 	#endif
 
-	SocketCollection::const_iterator itr;
-	for( itr = m_UserSockets.begin( ); itr != m_UserSockets.end( ); ++itr )
+	// encode once; every member's queue shares the same frame, and
+	// those compressing share one compressed copy of it too...
+	NetMessaging::Frame *pFrame = NetMessaging::Frame::create( NetMessaging::Protocol::MT_SEND_CHATROOM_MESSAGE, payload.data( ), payload.length( ) );
+	pFrame->setBroadcast( );
+
+	unsigned long epoch;
+	const Members *pMembers = beginRead( epoch );
+
+	for( const int *itr = pMembers->begin( ); itr != pMembers->end( ); ++itr )
 	{
-		NetMessaging::Protocol::Message m;
-		NetMessaging::Protocol::initializeMessage( m, NetMessaging::Protocol::MT_SEND_CHATROOM_MESSAGE, payload.length( ), &payload[ 0 ] );		
-		NetMessaging::Protocol::sendMessage( *itr, m );
+		pServer->sendMessage( *itr, pFrame );
 	}
+
+	endRead( epoch );
+	pFrame->release( );
 }
 
-void Chatroom::notifyEveryoneThatUserJoined( int userSocket ) const
+void Chatroom::notifyEveryoneThatUserJoined( int userSocket, const std::string &userLabel ) const
 {
-	SimpleChatServer *pServer = SimpleChatServer::getInstance( );
-	User user( 0 ); // gets filled in next line
-	pServer->getUserFromSocket( userSocket, user );
-
-	std::string message = m_Name + "\n" + user.username( ) + "@" + user.ipAddress( );
+	std::string message;
+	message.reserve( m_pName->length( ) + 1 + userLabel.length( ) );
+	message.append( *m_pName ).append( 1, '\n' ).append( userLabel );
 	notifyEveryone( message, NetMessaging::Protocol::MT_NOTIFY_USER_JOINED, userSocket );
 }
 
-void Chatroom::notifyEveryoneThatUserLeft( int userSocket ) const
+void Chatroom::notifyEveryoneThatUserLeft( int userSocket, const std::string &userLabel ) const
 {
-	SimpleChatServer *pServer = SimpleChatServer::getInstance( );
-	User user( 0 ); // gets filled in next line
-	pServer->getUserFromSocket( userSocket, user );
-
-	std::string message = m_Name + "\n" + user.username( ) + "@" + user.ipAddress( );
+	std::string message;
+	message.reserve( m_pName->length( ) + 1 + userLabel.length( ) );
+	message.append( *m_pName ).append( 1, '\n' ).append( userLabel );
 	notifyEveryone( message, NetMessaging::Protocol::MT_NOTIFY_USER_LEFT, userSocket );
 }
 
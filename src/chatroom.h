@@ -4,65 +4,148 @@
 #include <iostream>
 #include <string>
 #include <functional>
-#include <list>
-#include <set>
+#include "synchronize.h"
 #include "protocol.h"
+#include "chatroomnames.h"
 
 namespace SCS {
 
+/*
+ *	A chatroom is shared by every thread serving one of its members, so
+ *	it carries its own lock (see lock( )/unlock( )) and a reference count.
+ *	The ChatroomRegistry holds one reference while the room is listed;
+ *	anyone else working with the room holds another so the room outlives
+ *	its removal from the registry. A room that has been removed is marked
+ *	closed and must not be joined.
+ *
+ *	Broadcasts far outnumber joins and leaves, so membership is published
+ *	read-copy-update style: an immutable, sorted array of sockets that
+ *	readers walk without taking the room lock. A join or leave (under the
+ *	room lock) builds a new array, swaps it in and then waits for a grace
+ *	period: every broadcast that could still be walking the old array has
+ *	finished. Only then is the old array freed and the change considered
+ *	done, which also guarantees that a user who has left receives no more
+ *	broadcasts from the room (and so that its connection may go away).
+ */
 class Chatroom 
 {
   public:
-	typedef std::list<int> UserSocketCollection;
-
-    explicit Chatroom( const std::string &name = "" );
+	/*
+	 *	One published version of the membership.
+	 */
+	class Members
+	{
+	  public:
+		static Members *create( unsigned int count );
+		void destroy( );
+
+		const int *begin( ) const { return m_Sockets; }
+		const int *end( ) const { return m_Sockets + m_nCount; }
+		unsigned int size( ) const { return m_nCount; }
+		bool contains( int userSocket ) const;
+
+	  private:
+		friend class Chatroom;
+		Members( ) { }
+
+		unsigned int m_nCount;
+		int m_Sockets[ 1 ]; // really m_nCount entries
+	};
+
+    Chatroom( ChatroomId id, ChatroomNames &names );
     virtual ~Chatroom( );
 
-	std::string &getName( );
-    const std::string getName( ) const;
+    ChatroomId getId( ) const;
+    const std::string &getName( ) const;
 	
-    void addUser( int userSocket );
-    void removeUser( int userSocket );
+    void addUser( int userSocket, const std::string &userLabel );
+    void removeUser( int userSocket, const std::string &userLabel );
   
-    UserSocketCollection getUsers( ) const;  
+    const Members &getUsers( ) const; // with the room locked
   
     void notifyEveryone( const std::string &message, int type = NetMessaging::Protocol::MT_SERVER_CHATROOM_MESSAGE, int excludeUserSocket = -1 ) const;
-    void sendMessage( int fromUserSocket, const std::string &message ) const;
+    void sendMessage( std::string_view fromUsername, std::string_view message ) const;
   
     unsigned int getNumberOfUsers( ) const;
+
+	static long membershipUpdates( );
+	static long membershipUpdateNanos( );
+	static long longestMembershipUpdateNanos( );
+
+	void lock( ) const;
+	void unlock( ) const;
+	void retain( );
+	void release( );
+	bool isClosed( ) const;
+	void close( );
   
   protected:
-	typedef std::set<int> SocketCollection;
-
-	std::string m_Name;
-    SocketCollection m_UserSockets;
+	ChatroomId m_Id;
+	ChatroomNames &m_Names;
+	const std::string *m_pName; // interned; see ChatroomNames
+    Members * volatile m_pMembers;
     unsigned int m_nNumberOfUsers;
+	volatile unsigned long m_nEpoch;
+	mutable AtomicCounter m_Readers[ 2 ]; // broadcasts in flight, by epoch parity
+	mutable Lock m_Lock;
+	AtomicCounter m_References;
+	bool m_bClosed;
   
-    void notifyEveryoneThatUserJoined( int userSocket ) const;
-    void notifyEveryoneThatUserLeft( int userSocket ) const;
-};
+	static AtomicCounter m_MembershipUpdates;
+	static AtomicCounter m_MembershipUpdateNanos;
+	static AtomicCounter m_LongestMembershipUpdate;
+
+	const Members *beginRead( unsigned long &epoch ) const;
+	void endRead( unsigned long epoch ) const;
+	void publish( Members *pMembers );
 
+    void notifyEveryoneThatUserJoined( int userSocket, const std::string &userLabel ) const;
+    void notifyEveryoneThatUserLeft( int userSocket, const std::string &userLabel ) const;
 
-inline std::string &Chatroom::getName( )
-{ return m_Name; }
+  private:
+	Chatroom( const Chatroom &chatroom );
+	Chatroom &operator=( const Chatroom &chatroom );
+};
 
-inline const std::string Chatroom::getName( ) const
-{ return m_Name; }
 
-inline Chatroom::UserSocketCollection Chatroom::getUsers( ) const
-{
-    UserSocketCollection userList;
-	SocketCollection::const_iterator itr;
+inline ChatroomId Chatroom::getId( ) const
+{ return m_Id; }
 
-    for( itr = m_UserSockets.begin( ); itr != m_UserSockets.end( ); ++itr )
-		userList.push_front( *itr );
+inline const std::string &Chatroom::getName( ) const
+{ return *m_pName; }
 
-    return userList;
-}
+inline const Chatroom::Members &Chatroom::getUsers( ) const
+{ return *m_pMembers; }
 
 inline unsigned int Chatroom::getNumberOfUsers( ) const
 { return m_nNumberOfUsers; }
 
+inline long Chatroom::membershipUpdates( )
+{ return m_MembershipUpdates.value( ); }
+
+inline long Chatroom::membershipUpdateNanos( )
+{ return m_MembershipUpdateNanos.value( ); }
+
+inline long Chatroom::longestMembershipUpdateNanos( )
+{ return m_LongestMembershipUpdate.value( ); }
+
+inline void Chatroom::unlock( ) const
+{ m_Lock.unlock( ); }
+
+inline void Chatroom::retain( )
+{ m_References.add( ); }
+
+inline void Chatroom::release( )
+{
+	if( m_References.subtract( ) == 0 ) delete this;
+}
+
+inline bool Chatroom::isClosed( ) const
+{ return m_bClosed; }
+
+inline void Chatroom::close( )
+{ m_bClosed = true; }
+
 /*
  *	How to compare two Chatroom objects...
  */
@@ -70,36 +153,7 @@ inline bool operator<( const Chatroom &c1, const Chatroom &c2 )
 { return c1.getName( ) < c2.getName( ); }
 
 inline bool operator==( const Chatroom &c1, const Chatroom &c2 )
-{ return c1.getName( ) == c2.getName( ); }
-
-/*
- * Hash function for chatrooms
- */
-struct ChatroomHasher {
-    size_t operator()( const Chatroom &cr ) const
-    { 
-		unsigned long __h = 0;
-		const char *__s = cr.getName( ).c_str( );
-
-		for ( ; *__s; ++__s)
-			__h = 5 * __h + *__s;
-
-		//cout << "ChatroomHasher(): hash code = " << size_t(__h) << endl;
-		return size_t(__h);
-    }
-};
-
-struct ChatroomEqual
-{
-    bool operator()( const Chatroom &c1, const Chatroom &c2 ) const
-    { return c1.getName( ) == c2.getName( ); }
-};
-
-struct ChatroomLessThan
-{
-    bool operator()( const Chatroom &c1, const Chatroom &c2 ) const
-    { return c1.getName( ) < c2.getName( ); }
-};
+{ return c1.getId( ) == c2.getId( ); }
 
 } // end of namespace
 #endif
@@ -0,0 +1,181 @@
+#include <cassert>
+#include <cstring>
+#include "chatroomnames.h"
+
+namespace SCS {
+
+ChatroomNames::ChatroomNames( )
+{
+	for( unsigned int i = 0; i < SHARD_COUNT; i++ )
+	{
+		memset( m_Shards[ i ].pChunks, 0, sizeof(m_Shards[ i ].pChunks) );
+		m_Shards[ i ].nIndexes = 0;
+		m_Shards[ i ].nBytes   = 0;
+	}
+}
+
+ChatroomNames::~ChatroomNames( )
+{
+	for( unsigned int i = 0; i < SHARD_COUNT; i++ )
+	{
+		for( unsigned int j = 0; j < MAX_CHUNKS; j++ )
+		{
+			delete [] m_Shards[ i ].pChunks[ j ];
+		}
+	}
+}
+
+/*
+ *	The name's ID, with a reference for the caller, handing out an ID
+ *	(a free one first) if the name is not interned. Returns INVALID_ID
+ *	if the name's shard has MAX_NAMES names interned already.
+ */
+ChatroomId ChatroomNames::intern( std::string_view chatroomName )
+{
+	ChatroomId id = INVALID_ID;
+
+	Shard &shard = shardFor( chatroomName );
+
+	shard.lock.lock( ); // crtical section...
+		IdIndex::const_iterator itr = shard.ids.find( chatroomName );
+
+		if( itr != shard.ids.end( ) )
+		{
+			id = reference( itr );
+		}
+		else if( !shard.freeIndexes.empty( ) || shard.nIndexes < MAX_NAMES )
+		{
+			unsigned int index;
+
+			if( !shard.freeIndexes.empty( ) )
+			{
+				index = shard.freeIndexes.back( );
+				shard.freeIndexes.pop_back( );
+			}
+			else
+			{
+				index = shard.nIndexes++;
+			}
+
+			id  = (index << SHARD_BITS) | (ChatroomId) (&shard - m_Shards);
+			itr = shard.ids.insert( IdIndex::value_type( std::string( chatroomName ), id ) ).first;
+
+			Slot *pChunk = shard.pChunks[ index / CHUNK_SIZE ];
+			if( pChunk == NULL )
+			{
+				pChunk = new Slot[ CHUNK_SIZE ]( );
+				__atomic_store_n( &shard.pChunks[ index / CHUNK_SIZE ], pChunk, __ATOMIC_RELEASE );
+			}
+
+			// the key's address is stable for as long as the node lives...
+			pChunk[ index % CHUNK_SIZE ].references = 1;
+			__atomic_store_n( &pChunk[ index % CHUNK_SIZE ].pName, &itr->first, __ATOMIC_RELEASE );
+			shard.nBytes += itr->first.capacity( ) > 15 ? itr->first.capacity( ) + 1 : 0; // beyond the small string buffer
+			m_nNames.add( );
+		}
+	shard.lock.unlock( );
+
+	return id;
+}
+
+/*
+ *	The name's ID, with a reference for the caller, or INVALID_ID if the
+ *	name is not interned.
+ */
+ChatroomId ChatroomNames::find( std::string_view chatroomName )
+{
+	ChatroomId id = INVALID_ID;
+
+	Shard &shard = shardFor( chatroomName );
+
+	shard.lock.lock( ); // crtical section...
+		IdIndex::const_iterator itr = shard.ids.find( chatroomName );
+		if( itr != shard.ids.end( ) ) id = reference( itr );
+	shard.lock.unlock( );
+
+	return id;
+}
+
+/*
+ *	Another reference to an ID the caller already holds one to, so the
+ *	name cannot go away meanwhile and no lock is needed.
+ */
+void ChatroomNames::retain( ChatroomId id )
+{
+	__atomic_add_fetch( &slotFor( id ).references, 1, __ATOMIC_RELAXED );
+}
+
+/*
+ *	Give back a reference; the last one forgets the name and frees the
+ *	ID for the next new name in its shard. Only that last one takes the
+ *	shard's lock, under which find( ) may have handed out another.
+ */
+void ChatroomNames::release( ChatroomId id )
+{
+	Slot &slot = slotFor( id );
+	unsigned int references = __atomic_load_n( &slot.references, __ATOMIC_RELAXED );
+
+	while( references > 1 )
+	{
+		if( __atomic_compare_exchange_n( &slot.references, &references, references - 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) ) return;
+	}
+
+	Shard &shard = m_Shards[ id & (SHARD_COUNT - 1) ];
+
+	shard.lock.lock( ); // crtical section...
+		assert( slot.references > 0 );
+
+		if( __atomic_sub_fetch( &slot.references, 1, __ATOMIC_ACQ_REL ) == 0 )
+		{
+			shard.nBytes -= slot.pName->capacity( ) > 15 ? slot.pName->capacity( ) + 1 : 0;
+
+			IdIndex::iterator itr = shard.ids.find( *slot.pName );
+			__atomic_store_n( &slot.pName, (const std::string *) NULL, __ATOMIC_RELEASE );
+			shard.ids.erase( itr ); // frees the name
+
+			shard.freeIndexes.push_back( id >> SHARD_BITS );
+			m_nNames.subtract( );
+		}
+	shard.lock.unlock( );
+}
+
+/*
+ *	Count a reference to an interned name; with the shard locked.
+ */
+ChatroomId ChatroomNames::reference( IdIndex::const_iterator itr )
+{
+	ChatroomId id = itr->second;
+	__atomic_add_fetch( &slotFor( id ).references, 1, __ATOMIC_RELAXED );
+	return id;
+}
+
+/*
+ *	Roughly what the table costs: the indexes (nodes and buckets), the
+ *	names that did not fit in their small string buffer, the free lists
+ *	and the ID -> name chunks. Locks one shard at a time.
+ */
+size_t ChatroomNames::bytes( ) const
+{
+	size_t total = 0;
+
+	for( unsigned int i = 0; i < SHARD_COUNT; i++ )
+	{
+		Shard &shard = m_Shards[ i ];
+
+		shard.lock.lock( ); // crtical section...
+			total += shard.ids.size( ) * (sizeof(IdIndex::value_type) + 2 * sizeof(void *)); // node, next and cached hash
+			total += shard.ids.bucket_count( ) * sizeof(void *);
+			total += shard.nBytes;
+			total += shard.freeIndexes.capacity( ) * sizeof(unsigned int);
+
+			for( unsigned int j = 0; j < MAX_CHUNKS && shard.pChunks[ j ] != NULL; j++ )
+			{
+				total += CHUNK_SIZE * sizeof(Slot);
+			}
+		shard.lock.unlock( );
+	}
+
+	return total;
+}
+
+} // end of namespace
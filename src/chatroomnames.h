@@ -0,0 +1,144 @@
+#ifndef _CHATROOMNAMES_H_
+#define _CHATROOMNAMES_H_
+/*
+ *	chatroomnames.h
+ *
+ *	The name of every open chatroom, interned: each distinct name gets a
+ *	32-bit ID so that a record can hold the ID instead of a copy of the
+ *	name. IDs are reference counted. intern( ) and find( ) hand out a
+ *	reference, a Chatroom holds one for as long as it exists, and
+ *	release( ) gives one back. Once a name has no references left it is
+ *	forgotten and its ID goes back on a free list, so the table only
+ *	ever holds the names of rooms that are open (or about to be).
+ *
+ *	The table is split into SHARD_COUNT shards by the low bits of the
+ *	name's hash, each with its own lock, name index and IDs, so lookups
+ *	of unrelated names never contend. An ID carries its shard in its low
+ *	bits (which also spreads rooms over ChatroomRegistry's shards).
+ *	Interning and looking a name up take the shard's lock, as does
+ *	releasing the last reference; turning an ID back into its name takes
+ *	none, as long as the caller holds a reference. A name is stored
+ *	once, as the key of the name index, and does not move while it is
+ *	interned; a shard's ID -> name array is allocated in CHUNK_SIZE
+ *	pieces that are never reallocated.
+ *
+ *	Names are hashed with FNV-1a, which mixes every byte in, so room
+ *	names that differ only near the end (room1, room2, ...) spread well.
+ */
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+#include "synchronize.h"
+
+namespace SCS {
+
+typedef uint32_t ChatroomId;
+
+/*
+ *	64-bit FNV-1a.
+ */
+inline size_t hashChatroomName( const char *pName, size_t length )
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for( size_t i = 0; i < length; i++ )
+	{
+		hash ^= (unsigned char) pName[ i ];
+		hash *= 1099511628211ULL;
+	}
+
+	return (size_t) hash;
+}
+
+struct ChatroomNameHasher
+{
+	typedef void is_transparent; // look names up by string_view, without a copy
+
+	size_t operator()( std::string_view name ) const
+	{ return hashChatroomName( name.data( ), name.length( ) ); }
+};
+
+class ChatroomNames
+{
+  public:
+	static const ChatroomId INVALID_ID = 0xFFFFFFFF;
+	static const unsigned int SHARD_BITS = 6;
+	static const unsigned int SHARD_COUNT = 1 << SHARD_BITS;
+	static const unsigned int CHUNK_SIZE = 256;
+	static const unsigned int MAX_CHUNKS = 256; // per shard
+	static const unsigned int MAX_NAMES  = CHUNK_SIZE * MAX_CHUNKS; // interned at once, per shard
+
+	ChatroomNames( );
+	~ChatroomNames( );
+
+	ChatroomId intern( std::string_view chatroomName );
+	ChatroomId find( std::string_view chatroomName );
+	void retain( ChatroomId id );
+	void release( ChatroomId id );
+	const std::string &name( ChatroomId id ) const;
+
+	size_t size( ) const;
+	size_t bytes( ) const;
+
+  protected:
+	typedef std::unordered_map<std::string, ChatroomId, ChatroomNameHasher, std::equal_to<> > IdIndex;
+
+	typedef struct tagSlot {
+		const std::string *pName; // NULL while the ID is free
+		unsigned int references; // changed atomically; reaches 0 only under the shard's lock
+	} Slot;
+
+	typedef struct tagShard {
+		Lock lock;
+		IdIndex ids;
+		Slot *pChunks[ MAX_CHUNKS ]; // shard-local index -> name, CHUNK_SIZE at a time
+		std::vector<unsigned int> freeIndexes;
+		unsigned int nIndexes; // handed out so far, free or not
+		size_t nBytes; // of the names themselves, beyond the index nodes
+	} Shard;
+
+	mutable Shard m_Shards[ SHARD_COUNT ]; // bytes( ) locks them
+	AtomicCounter m_nNames;
+
+	Shard &shardFor( std::string_view chatroomName );
+	ChatroomId reference( IdIndex::const_iterator itr );
+	Slot &slotFor( ChatroomId id ) const;
+
+  private:
+	ChatroomNames( const ChatroomNames &names );
+	ChatroomNames &operator=( const ChatroomNames &names );
+};
+
+/*
+ *	The low bits of the hash pick the shard. FNV-1a's top bits hardly
+ *	change with the last few bytes, which is where room names tend to
+ *	differ; the index within the shard buckets by the whole hash modulo
+ *	a prime, so it does not mind.
+ */
+inline ChatroomNames::Shard &ChatroomNames::shardFor( std::string_view chatroomName )
+{ return m_Shards[ hashChatroomName( chatroomName.data( ), chatroomName.length( ) ) & (SHARD_COUNT - 1) ]; }
+
+inline ChatroomNames::Slot &ChatroomNames::slotFor( ChatroomId id ) const
+{
+	const Shard &shard = m_Shards[ id & (SHARD_COUNT - 1) ];
+	unsigned int index = id >> SHARD_BITS;
+
+	Slot *pChunk = __atomic_load_n( &shard.pChunks[ index / CHUNK_SIZE ], __ATOMIC_ACQUIRE );
+	return pChunk[ index % CHUNK_SIZE ];
+}
+
+/*
+ *	The caller must hold a reference to id.
+ */
+inline const std::string &ChatroomNames::name( ChatroomId id ) const
+{ return *__atomic_load_n( &slotFor( id ).pName, __ATOMIC_ACQUIRE ); }
+
+inline size_t ChatroomNames::size( ) const
+{ return m_nNames.value( ); }
+
+} // end of namespace
+#endif
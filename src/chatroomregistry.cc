@@ -0,0 +1,137 @@
+#include <cassert>
+#include "chatroomregistry.h"
+
+namespace SCS {
+
+StripedCounter ChatroomRegistry::m_LockAcquisitions;
+StripedCounter ChatroomRegistry::m_LockContentions;
+
+ChatroomRegistry::ChatroomRegistry( )
+{
+}
+
+ChatroomRegistry::~ChatroomRegistry( )
+{
+	for( unsigned int i = 0; i < SHARD_COUNT; i++ )
+	{
+		for( ChatroomMap::iterator itr = m_Shards[ i ].chatrooms.begin( ); itr != m_Shards[ i ].chatrooms.end( ); ++itr )
+		{
+			itr->second->release( );
+		}
+	}
+}
+
+/*
+ *	The room, retained, or NULL if there is no such room (or id is
+ *	ChatroomNames::INVALID_ID).
+ */
+Chatroom *ChatroomRegistry::acquire( ChatroomId id )
+{
+	if( id == ChatroomNames::INVALID_ID ) return NULL;
+
+	Shard &shard = shardFor( id );
+	Chatroom *pChatroom = NULL;
+
+	lock( shard.lock );
+		ChatroomMap::iterator itr = shard.chatrooms.find( id );
+		if( itr != shard.chatrooms.end( ) )
+		{
+			pChatroom = itr->second;
+			pChatroom->retain( );
+		}
+	shard.lock.unlock( );
+
+	return pChatroom;
+}
+
+/*
+ *	The room by name, retained, or NULL if there is no such room. The
+ *	room keeps its name interned, so the lookup's reference is only held
+ *	until then.
+ */
+Chatroom *ChatroomRegistry::acquire( std::string_view chatroomName )
+{
+	ChatroomId id = m_Names.find( chatroomName );
+	if( id == ChatroomNames::INVALID_ID ) return NULL;
+
+	Chatroom *pChatroom = acquire( id );
+	m_Names.release( id );
+
+	return pChatroom;
+}
+
+/*
+ *	The room, retained, creating it first if needed; id must come from
+ *	intern( ), and the caller must still hold that reference. The room
+ *	may be closed by the time the caller locks it (its last member left
+ *	in between); callers that want to join should then try again.
+ */
+Chatroom *ChatroomRegistry::acquireOrCreate( ChatroomId id, bool *pCreated )
+{
+	assert( id != ChatroomNames::INVALID_ID );
+	Shard &shard = shardFor( id );
+	Chatroom *pChatroom = NULL;
+	bool bCreated = false;
+
+	lock( shard.lock );
+		ChatroomMap::iterator itr = shard.chatrooms.find( id );
+		if( itr != shard.chatrooms.end( ) )
+		{
+			pChatroom = itr->second;
+		}
+		else
+		{
+			pChatroom = new Chatroom( id, m_Names ); // the registry's reference
+			shard.chatrooms.insert( std::make_pair( id, pChatroom ) );
+			m_nChatrooms.add( );
+			bCreated = true;
+		}
+		pChatroom->retain( ); // the caller's reference
+	shard.lock.unlock( );
+
+	if( pCreated != NULL ) *pCreated = bCreated;
+	return pChatroom;
+}
+
+/*
+ *	Unlist a room that has no members left and close it so that nobody
+ *	joins it afterwards. Call without holding the room's lock. Returns
+ *	true if the room was removed.
+ */
+bool ChatroomRegistry::removeIfEmpty( Chatroom *pChatroom )
+{
+	Shard &shard = shardFor( pChatroom->getId( ) );
+	bool bRemoved = false;
+
+	lock( shard.lock );
+		pChatroom->lock( );
+			if( pChatroom->getNumberOfUsers( ) == 0 && !pChatroom->isClosed( ) )
+			{
+				pChatroom->close( );
+				shard.chatrooms.erase( pChatroom->getId( ) );
+				m_nChatrooms.subtract( );
+				bRemoved = true;
+			}
+		pChatroom->unlock( );
+	shard.lock.unlock( );
+
+	if( bRemoved ) pChatroom->release( ); // the registry's reference
+	return bRemoved;
+}
+
+/*
+ *	Take a shard or room lock, counting how often somebody else already
+ *	held it; see SimpleChatServer::logStats( ).
+ */
+void ChatroomRegistry::lock( Lock &lock )
+{
+	m_LockAcquisitions.add( );
+
+	if( !lock.tryLock( ) )
+	{
+		m_LockContentions.add( );
+		lock.lock( );
+	}
+}
+
+} // end of namespace
@@ -0,0 +1,130 @@
+#ifndef _CHATROOMREGISTRY_H_
+#define _CHATROOMREGISTRY_H_
+/*
+ *	chatroomregistry.h
+ *
+ *	Every open chatroom, by interned ID. A room name is turned into its
+ *	ID once per message, through intern( ) or find( ) (see
+ *	chatroomnames.h), which hand out a reference to the name that the
+ *	caller gives back with releaseName( ); everything after that
+ *	compares IDs. Rooms are spread over SHARD_COUNT shards by the low
+ *	bits of the ID, which are the name's shard in ChatroomNames, and
+ *	each shard has its own lock, so looking up, creating and removing
+ *	rooms in unrelated shards never contend. The registry only guards
+ *	the ID -> room mapping; a room's members are guarded by the room's
+ *	own lock (Chatroom::lock( )).
+ *
+ *	Lock ordering, outermost first:
+ *
+ *		shard lock -> Chatroom lock -> usersLock -> Connection queue lock
+ *
+ *	Never hold two shard locks, or two Chatroom locks, at the same time.
+ *	Rooms handed out by acquire( ) are retained; release( ) them when
+ *	done, after unlocking.
+ */
+
+#include <string>
+#include <unordered_map>
+#include "synchronize.h"
+#include "chatroom.h"
+#include "chatroomnames.h"
+
+namespace SCS {
+
+class ChatroomRegistry
+{
+  public:
+	static const unsigned int SHARD_COUNT = 64; // power of two
+
+	ChatroomRegistry( );
+	~ChatroomRegistry( );
+
+	ChatroomId intern( std::string_view chatroomName );
+	ChatroomId find( std::string_view chatroomName );
+	void releaseName( ChatroomId id );
+	const std::string &name( ChatroomId id ) const;
+	const ChatroomNames &names( ) const;
+
+	Chatroom *acquire( ChatroomId id );
+	Chatroom *acquire( std::string_view chatroomName );
+	Chatroom *acquireOrCreate( ChatroomId id, bool *pCreated = NULL );
+	bool removeIfEmpty( Chatroom *pChatroom );
+
+	size_t size( ) const;
+
+	template <typename Visitor>
+	void forEach( Visitor &visit );
+
+	static void lock( Lock &lock );
+	static long lockAcquisitions( );
+	static long lockContentions( );
+
+  protected:
+	typedef std::unordered_map<ChatroomId, Chatroom *> ChatroomMap;
+
+	typedef struct tagShard {
+		Lock lock;
+		ChatroomMap chatrooms;
+	} Shard;
+
+	Shard m_Shards[ SHARD_COUNT ];
+	AtomicCounter m_nChatrooms;
+	ChatroomNames m_Names;
+
+	static StripedCounter m_LockAcquisitions;
+	static StripedCounter m_LockContentions;
+
+	Shard &shardFor( ChatroomId id );
+
+  private:
+	ChatroomRegistry( const ChatroomRegistry &registry );
+	ChatroomRegistry &operator=( const ChatroomRegistry &registry );
+};
+
+inline size_t ChatroomRegistry::size( ) const
+{ return m_nChatrooms.value( ); }
+
+inline long ChatroomRegistry::lockAcquisitions( )
+{ return m_LockAcquisitions.value( ); }
+
+inline long ChatroomRegistry::lockContentions( )
+{ return m_LockContentions.value( ); }
+
+inline ChatroomId ChatroomRegistry::intern( std::string_view chatroomName )
+{ return m_Names.intern( chatroomName ); }
+
+inline ChatroomId ChatroomRegistry::find( std::string_view chatroomName )
+{ return m_Names.find( chatroomName ); }
+
+inline void ChatroomRegistry::releaseName( ChatroomId id )
+{ m_Names.release( id ); }
+
+inline const std::string &ChatroomRegistry::name( ChatroomId id ) const
+{ return m_Names.name( id ); }
+
+inline const ChatroomNames &ChatroomRegistry::names( ) const
+{ return m_Names; }
+
+inline ChatroomRegistry::Shard &ChatroomRegistry::shardFor( ChatroomId id )
+{ return m_Shards[ id & (SHARD_COUNT - 1) ]; }
+
+/*
+ *	Call visit( Chatroom & ) for every room, one shard at a time with
+ *	that shard locked (but not the room; lock it if members are read).
+ */
+template <typename Visitor>
+void ChatroomRegistry::forEach( Visitor &visit )
+{
+	for( unsigned int i = 0; i < SHARD_COUNT; i++ )
+	{
+		lock( m_Shards[ i ].lock );
+			for( ChatroomMap::iterator itr = m_Shards[ i ].chatrooms.begin( ); itr != m_Shards[ i ].chatrooms.end( ); ++itr )
+			{
+				visit( *itr->second );
+			}
+		m_Shards[ i ].lock.unlock( );
+	}
+}
+
+} // end of namespace
+#endif
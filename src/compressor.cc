@@ -0,0 +1,209 @@
+///////////////////////////////////////////////////////////////////////////////////
+//// Compressor.cc ////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#include <cstring>
+#include "compressor.h"
+
+namespace NetMessaging {
+
+size_t Compressor::m_nThreshold = 512;
+AtomicCounter Compressor::m_Streams;
+StripedCounter Compressor::m_CompressedFrames;
+StripedCounter Compressor::m_BytesIn;
+StripedCounter Compressor::m_BytesOut;
+AtomicCounter Compressor::m_SharedFrames;
+StripedCounter Compressor::m_SharedUses;
+
+#ifdef HAVE_ZLIB_H
+namespace {
+
+// 8 KB of history and a smaller hash: about 96 KB a client, not 256 KB
+const int WINDOW_BITS  = 13;
+const int MEMORY_LEVEL = 7;
+
+bool initializeStream( z_stream *pStream )
+{
+	memset( pStream, 0, sizeof(*pStream) );
+	return deflateInit2( pStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -WINDOW_BITS, MEMORY_LEVEL, Z_DEFAULT_STRATEGY ) == Z_OK;
+}
+
+/*
+ *	Deflate a frame's payload and flush, so the client can inflate all of
+ *	it as soon as it arrives. Returns how many bytes of output there are,
+ *	0 if the stream is unusable.
+ */
+size_t deflatePayload( z_stream *pStream, const Frame *pFrame, std::string &output )
+{
+	size_t produced = 0;
+
+	output.resize( deflateBound( pStream, pFrame->dataSize( ) ) + 16 ); // room for the flush, usually
+	pStream->next_in  = reinterpret_cast<Bytef *>( const_cast<char *>( pFrame->payload( ) ) );
+	pStream->avail_in = (uInt) pFrame->dataSize( );
+
+	do {
+		if( produced == output.size( ) ) output.resize( output.size( ) * 2 );
+
+		pStream->next_out  = reinterpret_cast<Bytef *>( &output[ produced ] );
+		pStream->avail_out = (uInt) (output.size( ) - produced);
+
+		if( deflate( pStream, Z_SYNC_FLUSH ) == Z_STREAM_ERROR ) return 0;
+		produced = output.size( ) - pStream->avail_out;
+	} while( pStream->avail_out == 0 );
+
+	return produced;
+}
+
+#if ZLIB_VERNUM >= 0x1290
+/*
+ *	A stream with no history, reset for every broadcast; one per thread
+ *	since any owner may be the first to need a broadcast compressed.
+ */
+class FreshStream
+{
+  public:
+	FreshStream( ) : m_bInitialized(false) { }
+	~FreshStream( ) { if( m_bInitialized ) deflateEnd( &m_Stream ); }
+
+	z_stream *reset( )
+	{
+		if( !m_bInitialized ) m_bInitialized = initializeStream( &m_Stream );
+		else if( deflateReset( &m_Stream ) != Z_OK ) return NULL;
+
+		return m_bInitialized ? &m_Stream : NULL;
+	}
+
+	std::string output;
+
+  private:
+	z_stream m_Stream;
+	bool m_bInitialized;
+};
+
+thread_local FreshStream freshStream;
+#endif
+
+} // end of anonymous namespace
+
+Compressor::Compressor( )
+{
+	memset( &m_Stream, 0, sizeof(m_Stream) );
+	m_Streams.add( );
+}
+
+Compressor::~Compressor( )
+{
+	deflateEnd( &m_Stream ); // harmless on a stream that never started
+	m_Streams.subtract( );
+}
+
+Compressor *Compressor::create( )
+{
+	if( m_nThreshold == 0 ) return NULL;
+
+	Compressor *pCompressor = new Compressor( );
+
+	if( !initializeStream( &pCompressor->m_Stream ) )
+	{
+		delete pCompressor;
+		return NULL;
+	}
+
+	return pCompressor;
+}
+
+/*
+ *	The compressed stand-in for a frame about to go out to this client,
+ *	with the same type and flags plus FLAG_COMPRESSED. Once a frame has
+ *	been run through the stream its stand-in must be sent, and before
+ *	any frame that comes after it.
+ */
+Frame *Compressor::compress( Frame *pFrame )
+{
+	if( pFrame->dataSize( ) < m_nThreshold || (pFrame->flags( ) & Protocol::FLAG_COMPRESSED) ) return NULL;
+
+	#if ZLIB_VERNUM >= 0x1290
+	if( pFrame->isBroadcast( ) )
+	{
+		Frame *pShared = shared( pFrame );
+
+		if( pShared != NULL &&
+		    deflateSetDictionary( &m_Stream, reinterpret_cast<const Bytef *>( pFrame->payload( ) ), (uInt) pFrame->dataSize( ) ) == Z_OK )
+		{
+			m_SharedUses.add( );
+			count( pFrame, pShared );
+
+			pShared->retain( );
+			return pShared;
+		}
+	}
+	#endif
+
+	size_t produced = deflatePayload( &m_Stream, pFrame, m_Output );
+	if( produced == 0 ) return NULL;
+
+	Frame *pCompressed = Frame::create( pFrame->type( ), m_Output.data( ), produced, pFrame->flags( ) | Protocol::FLAG_COMPRESSED );
+	count( pFrame, pCompressed );
+
+	return pCompressed;
+}
+
+/*
+ *	The broadcast's compressed twin, made now if nobody has yet. Owned
+ *	by the broadcast; NULL if it could not be made.
+ */
+Frame *Compressor::shared( Frame *pFrame )
+{
+	#if ZLIB_VERNUM >= 0x1290
+	Frame *pShared = pFrame->compressed( );
+	if( pShared != NULL ) return pShared;
+
+	z_stream *pStream = freshStream.reset( );
+	if( pStream == NULL ) return NULL;
+
+	size_t produced = deflatePayload( pStream, pFrame, freshStream.output );
+	if( produced == 0 ) return NULL;
+
+	pShared = Frame::create( pFrame->type( ), freshStream.output.data( ), produced, pFrame->flags( ) | Protocol::FLAG_COMPRESSED );
+	Frame *pAttached = pFrame->attachCompressed( pShared ); // another recipient may have beaten us to it
+
+	if( pAttached == pShared ) m_SharedFrames.add( );
+	return pAttached;
+	#else
+	return NULL;
+	#endif
+}
+
+#else // no zlib
+
+Compressor::Compressor( )
+{
+}
+
+Compressor::~Compressor( )
+{
+}
+
+Compressor *Compressor::create( )
+{
+	return NULL;
+}
+
+Frame *Compressor::compress( Frame *pFrame )
+{
+	return NULL;
+}
+
+Frame *Compressor::shared( Frame *pFrame )
+{
+	return NULL;
+}
+#endif
+
+void Compressor::count( const Frame *pFrame, const Frame *pCompressed )
+{
+	m_CompressedFrames.add( );
+	m_BytesIn.add( pFrame->dataSize( ) );
+	m_BytesOut.add( pCompressed->dataSize( ) );
+}
+
+}// end of namespace
@@ -0,0 +1,112 @@
+#ifndef _COMPRESSOR_H_
+#define _COMPRESSOR_H_
+///////////////////////////////////////////////////////////////////////////////////
+//// Compressor.h /////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <cstddef>
+#include <string>
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+#include "synchronize.h"
+#include "frame.h"
+
+namespace NetMessaging {
+
+/*
+ *	The downstream half of a client's compression: one raw deflate stream
+ *	for the life of the connection, so every frame is compressed against
+ *	the history of the ones before it (whose text, chat and user lists
+ *	alike, repeats a lot). Each frame is finished with a sync flush and
+ *	goes out as a frame of its own type with FLAG_COMPRESSED set; the
+ *	client feeds the payloads, in order, to a single raw inflate stream.
+ *	Frames smaller than the threshold are not worth it and go out as
+ *	they are, without touching the stream.
+ *
+ *	A broadcast is compressed once, by whichever recipient gets to it
+ *	first, with no history at all, and that frame is shared by every
+ *	recipient; each one then puts the text into its own window with
+ *	deflateSetDictionary( ), which raw streams allow between flushed
+ *	blocks since zlib 1.2.9, just as the client's inflater does when it
+ *	inflates the shared frame. Older zlibs compress it per recipient.
+ *
+ *	A compressor belongs to the connection's owner. Without zlib there is
+ *	none; create( ) says so.
+ */
+class Compressor
+{
+  public:
+	static Compressor *create( ); // NULL if compression is off or unavailable
+	~Compressor( );
+
+	Frame *compress( Frame *pFrame ); // a new reference, or NULL to send pFrame as it is
+
+	static const char *name( ); // as negotiated at login
+	static void setThreshold( size_t bytes );
+	static size_t threshold( );
+
+	/*
+	 *	Counters summed over every client.
+	 */
+	static long streams( );
+	static long compressedFrames( );
+	static long bytesIn( );
+	static long bytesOut( );
+	static long sharedFrames( );
+	static long sharedUses( );
+
+  private:
+	Compressor( );
+	Compressor( const Compressor &compressor );
+	Compressor &operator=( const Compressor &compressor );
+
+	#ifdef HAVE_ZLIB_H
+	z_stream m_Stream;
+	std::string m_Output; // scratch space for what deflate( ) produces
+	#endif
+
+	static size_t m_nThreshold;
+	static AtomicCounter m_Streams;
+	static StripedCounter m_CompressedFrames;
+	static StripedCounter m_BytesIn;
+	static StripedCounter m_BytesOut;
+	static AtomicCounter m_SharedFrames;
+	static StripedCounter m_SharedUses;
+
+	Frame *shared( Frame *pFrame );
+	void count( const Frame *pFrame, const Frame *pCompressed );
+};
+
+inline const char *Compressor::name( )
+{ return "deflate"; }
+
+inline void Compressor::setThreshold( size_t bytes )
+{ m_nThreshold = bytes; }
+
+inline size_t Compressor::threshold( )
+{ return m_nThreshold; }
+
+inline long Compressor::streams( )
+{ return m_Streams.value( ); }
+
+inline long Compressor::compressedFrames( )
+{ return m_CompressedFrames.value( ); }
+
+inline long Compressor::bytesIn( )
+{ return m_BytesIn.value( ); }
+
+inline long Compressor::bytesOut( )
+{ return m_BytesOut.value( ); }
+
+inline long Compressor::sharedFrames( )
+{ return m_SharedFrames.value( ); }
+
+inline long Compressor::sharedUses( )
+{ return m_SharedUses.value( ); }
+
+}// end of namespace
+#endif
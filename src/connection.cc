@@ -0,0 +1,529 @@
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "connection.h"
+#include "engine.h"
+
+namespace SCS {
+
+size_t Connection::m_nQueueLimit                        = 1024 * 1024;
+Connection::OverflowPolicy Connection::m_OverflowPolicy = Connection::DROP_OLDEST;
+StripedCounter Connection::m_TotalQueuedBytes;
+AtomicCounter Connection::m_PeakQueuedBytes;
+AtomicCounter Connection::m_TotalDropped;
+AtomicCounter Connection::m_TotalOverflowDisconnects;
+StripedCounter Connection::m_TotalReceiveCalls;
+StripedCounter Connection::m_TotalMessagesReceived;
+StripedCounter Connection::m_TotalWakeupCalls;
+LatencyHistogram Connection::m_Turnaround;
+
+namespace {
+
+long monotonicNanos( )
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+} // end of anonymous namespace
+
+Connection::Connection( int socket, const NetMessaging::PeerAddress &peerAddress )
+  : m_Socket(socket), m_PeerAddress(peerAddress), m_WakeupSocket(-1), m_bBatching(false),
+    m_nFrontSent(0), m_nQueuedBytes(0), m_nPinned(0), m_pCompressor(NULL), m_nCompressed(0), m_nDropped(0), m_bOverflowed(false),
+    m_nDispatch(IDLE), m_nArrivalStamp(0), m_nArrivals(0), m_pReplies(NULL), m_nRequestId(0)
+{
+	if( (m_WakeupSocket = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC )) < 0 )
+	{
+		Engine::onError( "Client socket = %d, could not create wakeup eventfd; errno = %d", m_Socket, errno );
+	}
+}
+
+Connection::~Connection( )
+{
+	m_TotalQueuedBytes.subtract( m_nQueuedBytes );
+
+	for( FrameQueue::iterator itr = m_Outbound.begin( ); itr != m_Outbound.end( ); ++itr )
+	{
+		(*itr)->release( );
+	}
+
+	delete m_pCompressor;
+	if( m_WakeupSocket >= 0 ) close( m_WakeupSocket );
+}
+
+/*
+ *	Read whatever the socket has pending into the parser's buffer with a
+ *	single recvmsg( ). Returns SUCCESS when the buffer filled up, so more
+ *	may be waiting, TRYAGAIN once the socket has been drained (a short
+ *	read or EAGAIN) and FAILED once the peer has closed the connection or
+ *	an error occurred. Either way, pull what arrived with nextMessage( )
+ *	before calling again.
+ */
+NetMessaging::Protocol::Result Connection::receive( )
+{
+	while( true )
+	{
+		size_t room = m_Parser.capacity( ) - m_Parser.buffered( );
+		ssize_t rv = m_Parser.fill( m_Socket, MSG_DONTWAIT );
+		m_TotalReceiveCalls.add( );
+
+		if( rv > 0 )
+		{
+			return (size_t) rv < room ? NetMessaging::Protocol::TRYAGAIN : NetMessaging::Protocol::SUCCESS;
+		}
+		else if( rv == 0 ) // connection closed by peer
+		{
+			return NetMessaging::Protocol::FAILED;
+		}
+
+		switch( errno )
+		{
+			case EINTR:
+				continue;
+			case EAGAIN: // EWOULDBLOCK
+				return NetMessaging::Protocol::TRYAGAIN;
+			default:
+				#ifdef _DEBUG
+				Engine::onError( "Client socket = %d, receive failed; errno = %d", m_Socket, errno );
+				#endif
+				return NetMessaging::Protocol::FAILED;
+		}
+	}
+}
+
+/*
+ *	Take bytes that were read from the socket by someone else. Returns
+ *	how many fit into the inbound buffer; take messages out with
+ *	nextMessage( ) until it returns false before delivering the rest.
+ */
+size_t Connection::deliver( const char *pData, size_t bytes )
+{
+	return m_Parser.append( pData, bytes );
+}
+
+/*
+ *	EPOLLOUT fires whenever the socket drains so that the rest of the
+ *	outbound queue gets written; the eventfd fires when another thread
+ *	posts to an empty mailbox.
+ */
+bool Connection::watch( int epollSocket )
+{
+	if( m_WakeupSocket < 0 ) return false;
+
+	struct epoll_event event;
+	memset( &event, 0, sizeof(event) );
+	event.events   = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = this;
+
+	if( epoll_ctl( epollSocket, EPOLL_CTL_ADD, m_Socket, &event ) < 0 ) return false;
+
+	event.events   = EPOLLIN | EPOLLET;
+	event.data.ptr = reinterpret_cast<void *>( (uintptr_t) this | WAKEUP_TAG );
+
+	if( epoll_ctl( epollSocket, EPOLL_CTL_ADD, m_WakeupSocket, &event ) < 0 )
+	{
+		epoll_ctl( epollSocket, EPOLL_CTL_DEL, m_Socket, NULL );
+		return false;
+	}
+
+	return true;
+}
+
+void Connection::unwatch( int epollSocket )
+{
+	epoll_ctl( epollSocket, EPOLL_CTL_DEL, m_Socket, NULL );
+	epoll_ctl( epollSocket, EPOLL_CTL_DEL, m_WakeupSocket, NULL );
+}
+
+/*
+ *	Extract the next complete message from the inbound buffer. The
+ *	payload is allocated by the parser, so it must be released with
+ *	freeMessageData( ).
+ */
+bool Connection::nextMessage( NetMessaging::Protocol::Message &msg )
+{
+	if( !m_Parser.next( msg ) )
+	{
+		if( m_Parser.isMalformed( ) )
+		{
+			Engine::onError( "Client socket = %d, malformed header on received message; connection will be dropped.", m_Socket );
+		}
+		return false;
+	}
+
+	m_TotalMessagesReceived.add( );
+	if( m_nArrivals++ == 0 ) m_nArrivalStamp = monotonicNanos( );
+	return true;
+}
+
+/*
+ *	Queue a message for this client from any thread. Never blocks and
+ *	never touches the socket: the frame is posted to the mailbox and the
+ *	owner is woken to write it. Returns false if the client is being
+ *	dropped because its queue overflowed.
+ */
+bool Connection::send( const NetMessaging::Protocol::Message &msg )
+{
+	NetMessaging::Frame *pFrame = NetMessaging::Frame::create( msg );
+	bool bSent = send( pFrame );
+	pFrame->release( );
+
+	return bSent;
+}
+
+/*
+ *	Same as above for a frame that is already encoded; the mailbox takes
+ *	its own reference, so the caller keeps (and must release) theirs.
+ */
+bool Connection::send( NetMessaging::Frame *pFrame )
+{
+	if( m_bOverflowed ) return false;
+
+	// Only the first frame since the owner last collected needs a
+	// wakeup, and none while the owner is about to flush( ) anyway. The
+	// post is a full barrier, so either we see m_bBatching cleared or
+	// the owner's flush( ) sees our frame.
+	if( m_Mailbox.post( pFrame ) && !m_bBatching )
+	{
+		uint64_t one = 1;
+		m_TotalWakeupCalls.add( );
+		if( write( m_WakeupSocket, &one, sizeof(one) ) < 0 && errno != EAGAIN )
+		{
+			Engine::onError( "Client socket = %d, could not wake the owner; errno = %d", m_Socket, errno );
+		}
+	}
+
+	return true;
+}
+
+/*
+ *	Owner only. Acknowledge a wakeup so the eventfd stops polling
+ *	readable.
+ */
+void Connection::clearWakeup( )
+{
+	uint64_t count;
+	m_TotalWakeupCalls.add( );
+	while( read( m_WakeupSocket, &count, sizeof(count) ) < 0 && errno == EINTR );
+}
+
+/*
+ *	Owner only. Pack a reply into the open reply batch.
+ */
+bool Connection::packReply( const NetMessaging::Protocol::Message &msg )
+{
+	if( m_pReplies == NULL ) return false;
+
+	NetMessaging::Protocol::appendBatchEntry( *m_pReplies, m_nRequestId, msg.header.type, msg.data, msg.header.dataSize );
+	return true;
+}
+
+/*
+ *	Owner only. Frames from here on are compressed as they are about to
+ *	be written, if they are large enough; the legacy framing has no
+ *	flags to say so, and compression can be turned off (threshold 0) or
+ *	missing altogether, so this returns whether it is on.
+ */
+bool Connection::enableCompression( )
+{
+	if( m_pCompressor != NULL ) return true;
+	if( wireVersion( ) != NetMessaging::Protocol::PROTOCOL_VERSION_2 ) return false;
+
+	m_pCompressor = NetMessaging::Compressor::create( );
+	return m_pCompressor != NULL;
+}
+
+/*
+ *	Owner only. Frames posted from now until the next flush( ) do not
+ *	wake the owner; call this before handling received messages, whose
+ *	replies are flushed right after.
+ */
+void Connection::beginBatch( )
+{
+	m_bBatching = true;
+}
+
+/*
+ *	Owner only. Move everything posted to the mailbox into the outbound
+ *	queue and write until the socket would block.
+ */
+NetMessaging::Protocol::Result Connection::flush( )
+{
+	if( !collectPosted( ) ) return NetMessaging::Protocol::FAILED;
+
+	NetMessaging::Protocol::Result result = writeQueued( );
+	if( result == NetMessaging::Protocol::SUCCESS ) recordTurnaround( );
+
+	return result;
+}
+
+/*
+ *	Owner only. End the batch and move the mailbox into the outbound
+ *	queue; returns false if the client overflowed and must be dropped.
+ */
+bool Connection::collectPosted( )
+{
+	m_bBatching = false;
+	__sync_synchronize( ); // pairs with the barrier in Mailbox::post( )
+
+	collect( );
+	return !m_bOverflowed;
+}
+
+bool Connection::hasPendingOutput( ) const
+{
+	return !m_Outbound.empty( ) || !m_Mailbox.isEmpty( );
+}
+
+size_t Connection::queuedBytes( ) const
+{
+	return m_nQueuedBytes;
+}
+
+unsigned long Connection::droppedMessages( ) const
+{
+	return m_nDropped;
+}
+
+/*
+ *	Apply the queue limit and overflow policy to each frame taken from
+ *	the mailbox as it joins the outbound queue.
+ */
+void Connection::collect( )
+{
+	FrameQueue posted;
+	m_Mailbox.collect( posted );
+
+	for( FrameQueue::iterator itr = posted.begin( ); itr != posted.end( ); ++itr )
+	{
+		NetMessaging::Frame *pFrame = *itr;
+
+		if( m_bOverflowed )
+		{
+			// nothing more goes out; the owner tears the connection down...
+		}
+		else if( !makeRoom( pFrame->size( wireVersion( ) ) ) )
+		{
+			m_bOverflowed = true;
+			m_TotalOverflowDisconnects.add( );
+			Engine::onInfo( "Client socket = %d, outbound queue overflowed; client will be disconnected.", m_Socket );
+		}
+		else if( m_nQueuedBytes + pFrame->size( wireVersion( ) ) <= m_nQueueLimit )
+		{
+			enqueue( pFrame );
+		}
+		else // a single message larger than the whole queue
+		{
+			m_nDropped++;
+			m_TotalDropped.add( );
+		}
+
+		pFrame->release( ); // the mailbox's reference
+	}
+}
+
+/*
+ *	Apply the overflow policy so that a frame of the given size fits.
+ *	A frame that is partially written is never touched. Returns false if
+ *	the client has to be disconnected. Owner only.
+ */
+bool Connection::makeRoom( size_t bytes )
+{
+	if( m_nQueuedBytes + bytes <= m_nQueueLimit ) return true;
+
+	size_t firstUnsent = this->firstUnsent( );
+
+	switch( m_OverflowPolicy )
+	{
+		case DISCONNECT:
+			return false;
+		case COALESCE:
+		{
+			unsigned long skipped = m_Outbound.size( ) - firstUnsent;
+			if( skipped == 0 ) return true;
+
+			while( m_Outbound.size( ) > firstUnsent ) erase( m_Outbound.size( ) - 1 );
+
+			m_nDropped += skipped;
+			m_TotalDropped.add( skipped );
+
+			char notice[ 96 ];
+			int length = snprintf( notice, sizeof(notice), "%lu messages were skipped because they could not be delivered fast enough.", skipped );
+			size_t dataSize = length + 1; // plus 1 for '\0'
+
+			NetMessaging::Frame *pNotice = NetMessaging::Frame::create( NetMessaging::Protocol::MT_SERVER_CHATROOM_MESSAGE, notice, dataSize );
+			enqueue( pNotice );
+			pNotice->release( );
+			return true;
+		}
+		case DROP_OLDEST:
+		default:
+			while( m_nQueuedBytes + bytes > m_nQueueLimit && m_Outbound.size( ) > firstUnsent )
+			{
+				erase( firstUnsent );
+
+				m_nDropped++;
+				m_TotalDropped.add( );
+			}
+			return true;
+	}
+}
+
+/*
+ *	Index of the first frame the overflow policy may still touch: not
+ *	one that is partially written, that the kernel is sending from or
+ *	that the client's inflater expects to see next.
+ */
+size_t Connection::firstUnsent( ) const
+{
+	size_t partial = m_nFrontSent > 0 ? 1 : 0;
+	size_t first   = m_nPinned > partial ? m_nPinned : partial;
+	return m_nCompressed > first ? m_nCompressed : first;
+}
+
+void Connection::enqueue( NetMessaging::Frame *pFrame )
+{
+	pFrame->retain( );
+	m_Outbound.push_back( pFrame );
+	m_nQueuedBytes += pFrame->size( wireVersion( ) );
+	m_TotalQueuedBytes.add( pFrame->size( wireVersion( ) ) );
+	m_PeakQueuedBytes.raiseTo( m_nQueuedBytes );
+}
+
+/*
+ *	Remove a frame that has not started sending.
+ */
+void Connection::erase( size_t index )
+{
+	assert( index >= firstUnsent( ) );
+	NetMessaging::Frame *pFrame = m_Outbound[ index ];
+
+	m_nQueuedBytes -= pFrame->size( wireVersion( ) );
+	m_TotalQueuedBytes.subtract( pFrame->size( wireVersion( ) ) );
+	m_Outbound.erase( m_Outbound.begin( ) + index );
+	pFrame->release( );
+}
+
+/*
+ *	Gather up to WRITE_BATCH_SIZE queued frames into one sendmsg( ) and
+ *	repeat until the queue is empty or the socket would block. Frames
+ *	that were only partially written stay at the front of the queue.
+ *	Owner only.
+ */
+NetMessaging::Protocol::Result Connection::writeQueued( )
+{
+	struct iovec vectors[ WRITE_BATCH_SIZE * NetMessaging::Frame::MAX_VECTORS ];
+
+	while( !m_Outbound.empty( ) )
+	{
+		compressQueued( WRITE_BATCH_SIZE );
+		int vectorCount = gatherQueued( 0, WRITE_BATCH_SIZE, vectors );
+		ssize_t rv = NetMessaging::Protocol::sendVectors( m_Socket, vectors, vectorCount, MSG_DONTWAIT );
+
+		if( rv < 0 )
+		{
+			if( errno == EINTR ) continue;
+			if( errno == EAGAIN || errno == EWOULDBLOCK ) return NetMessaging::Protocol::TRYAGAIN;
+			return NetMessaging::Protocol::FAILED;
+		}
+
+		completeWrite( rv );
+	}
+
+	return NetMessaging::Protocol::SUCCESS;
+}
+
+/*
+ *	Owner only. Swap the frames among the first frames of the queue that
+ *	have not been past the compressor yet for their compressed
+ *	stand-ins, just before they are written. Only those: once through
+ *	the stream a frame can no longer be dropped by the overflow policy,
+ *	while the ones further back still can.
+ */
+void Connection::compressQueued( size_t frames )
+{
+	if( m_pCompressor == NULL ) return;
+
+	NetMessaging::Protocol::Byte version = wireVersion( );
+	size_t end = m_Outbound.size( ) < frames ? m_Outbound.size( ) : frames;
+
+	for( size_t i = firstUnsent( ); i < end; i++ )
+	{
+		NetMessaging::Frame *pFrame      = m_Outbound[ i ];
+		NetMessaging::Frame *pCompressed = m_pCompressor->compress( pFrame );
+		if( pCompressed == NULL ) continue; // too small to bother
+
+		m_nQueuedBytes = m_nQueuedBytes - pFrame->size( version ) + pCompressed->size( version );
+		m_TotalQueuedBytes.add( (long) pCompressed->size( version ) - (long) pFrame->size( version ) );
+		m_Outbound[ i ] = pCompressed;
+		pFrame->release( );
+	}
+
+	if( end > m_nCompressed ) m_nCompressed = end;
+}
+
+/*
+ *	Point vectors at the unsent bytes of up to frames queued frames,
+ *	starting with frame first; pVectors must have room for frames *
+ *	Frame::MAX_VECTORS. Returns how many were filled in.
+ */
+int Connection::gatherQueued( size_t first, size_t frames, struct iovec *pVectors ) const
+{
+	int vectorCount = 0;
+	NetMessaging::Protocol::Byte version = wireVersion( );
+
+	for( size_t i = first; i < m_Outbound.size( ) && i < first + frames; i++ )
+	{
+		size_t offset = i == 0 ? m_nFrontSent : 0;
+		vectorCount += m_Outbound[ i ]->gather( version, offset, pVectors + vectorCount );
+	}
+
+	return vectorCount;
+}
+
+/*
+ *	Account for bytes written from the front of the queue and retire
+ *	every frame they completed.
+ */
+void Connection::completeWrite( size_t bytes )
+{
+	m_nQueuedBytes -= bytes;
+	m_TotalQueuedBytes.subtract( bytes );
+
+	size_t written = m_nFrontSent + bytes;
+	long completed = 0;
+
+	while( !m_Outbound.empty( ) && written >= m_Outbound.front( )->size( wireVersion( ) ) )
+	{
+		NetMessaging::Frame *pFrame = m_Outbound.front( );
+		written -= pFrame->size( wireVersion( ) );
+		m_Outbound.pop_front( );
+		pFrame->release( ); // last write of this frame for this client
+		completed++;
+	}
+
+	m_nFrontSent  = written;
+	m_nPinned     = (size_t) completed < m_nPinned ? m_nPinned - completed : 0;
+	m_nCompressed = (size_t) completed < m_nCompressed ? m_nCompressed - completed : 0;
+	NetMessaging::Protocol::countFramesSent( completed );
+}
+
+/*
+ *	The outbound queue just drained; every message taken since it last
+ *	did has been answered.
+ */
+void Connection::recordTurnaround( )
+{
+	if( m_nArrivals == 0 ) return;
+
+	m_Turnaround.record( monotonicNanos( ) - m_nArrivalStamp, m_nArrivals );
+	m_nArrivals = 0;
+}
+
+} // end of namespace
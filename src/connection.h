@@ -0,0 +1,301 @@
+#ifndef _CONNECTION_H_
+#define _CONNECTION_H_
+/*
+ *	connection.h
+ *
+ *	Per-socket state for connected clients. Bytes are read as they
+ *	arrive into a ring buffer and complete protocol messages are carved
+ *	out of it one at a time by a FrameParser. Outbound messages go
+ *	through a bounded byte queue so that a client that stops reading
+ *	cannot stall the sender.
+ *
+ *	Only the thread that owns a connection (its client thread, reactor
+ *	or worker) ever touches the socket. Other threads post frames to the
+ *	connection's Mailbox and, if it was empty, wake the owner through an
+ *	eventfd; the owner moves them into the outbound queue on flush( ).
+ */
+
+#include <deque>
+#include <string>
+#include <coroutine>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include "synchronize.h"
+#include "protocol.h"
+#include "frame.h"
+#include "frameparser.h"
+#include "compressor.h"
+#include "mailbox.h"
+
+namespace SCS {
+
+class Connection
+{
+  public:
+	/*
+	 *	What to do when a message would push the outbound queue past
+	 *	the queue limit.
+	 */
+	enum OverflowPolicy {
+		DROP_OLDEST = 0, // discard the oldest messages that have not started sending
+		DISCONNECT,      // drop the client
+		COALESCE         // replace everything unsent with one "messages skipped" notice
+	};
+
+	explicit Connection( int socket, const NetMessaging::PeerAddress &peerAddress = NetMessaging::PeerAddress( ) );
+	virtual ~Connection( );
+
+	int socket( ) const;
+	const NetMessaging::PeerAddress &peerAddress( ) const;
+	int wakeupSocket( ) const;
+	void clearWakeup( );
+
+	NetMessaging::Protocol::Result receive( );
+	size_t deliver( const char *pData, size_t bytes ); // bytes read by someone else, e.g. io_uring
+	bool nextMessage( NetMessaging::Protocol::Message &msg );
+	bool isMalformed( ) const;
+	NetMessaging::Protocol::Byte wireVersion( ) const;
+
+	bool send( const NetMessaging::Protocol::Message &msg );
+	bool send( NetMessaging::Frame *pFrame );
+	void beginBatch( );
+	NetMessaging::Protocol::Result flush( );
+
+	/*
+	 *	While the owner handles an MT_BATCH from this client, replies to
+	 *	it are packed into one batch payload, under the request ID of the
+	 *	entry being handled, instead of going out one frame each.
+	 */
+	void openReplyBatch( std::string *pReplies );
+	void setRequestId( uint32_t requestId );
+	bool packReply( const NetMessaging::Protocol::Message &msg ); // false if no batch is open
+	void closeReplyBatch( );
+
+	// owner only; compress what goes out from now on (see compressor.h)
+	bool enableCompression( );
+	bool isCompressing( ) const;
+
+	// Coroutine owners (see asyncconnection.h) may make a handler that
+	// replies wait here for the queue to drain; returns true if it must.
+	virtual bool awaitDrain( std::coroutine_handle<> handle );
+	bool hasPendingOutput( ) const;
+	size_t queuedBytes( ) const;
+	unsigned long droppedMessages( ) const;
+
+	/*
+	 *	Registration with an epoll event loop: the socket and the
+	 *	wakeup eventfd are both watched edge-triggered, and the event
+	 *	data tells fromEvent( ) which of the two fired.
+	 */
+	bool watch( int epollSocket );
+	void unwatch( int epollSocket );
+	static Connection *fromEvent( const epoll_data_t &data, bool *pWakeup );
+
+	/*
+	 *	Worker pool scheduling (see workerpool.h). The poller calls
+	 *	schedule( ) for every event and only queues the connection when it
+	 *	returns true; the worker running it calls finish( ) when done and
+	 *	runs it again while that returns true, so one worker at a time
+	 *	serves a connection and no edge is lost while it runs.
+	 */
+	bool schedule( );
+	bool finish( );
+
+	// closed by the owner; events still pending for it must be ignored
+	void retire( );
+	bool isRetired( ) const;
+
+	static void setQueueLimit( size_t bytes );
+	static size_t queueLimit( );
+	static void setOverflowPolicy( OverflowPolicy policy );
+	static OverflowPolicy overflowPolicy( );
+
+	/*
+	 *	Counters summed over every connection.
+	 */
+	static long totalQueuedBytes( );
+	static long peakQueuedBytes( );
+	static long totalDroppedMessages( );
+	static long totalOverflowDisconnects( );
+	static long totalReceiveCalls( );
+	static long totalMessagesReceived( );
+	static long totalWakeupCalls( );
+
+	/*
+	 *	Turnaround: from a message being taken off the inbound buffer
+	 *	until the replies it caused (if any) have all been written.
+	 */
+	static long turnaroundPercentile( double fraction );
+	static long turnaroundSamples( );
+
+  protected:
+	typedef Mailbox::FrameQueue FrameQueue;
+
+	static const int WRITE_BATCH_SIZE   = 64; // frames per sendmsg( ); with their vectors well under IOV_MAX
+
+	static const uintptr_t WAKEUP_TAG = 1; // low bit of the event data; Connections are aligned
+
+	enum DispatchState {
+		IDLE = 0,    // waiting for events
+		SCHEDULED,   // queued or running on a worker
+		RESCHEDULED, // running, and more events arrived meanwhile
+		RETIRED      // closed; ignore further events
+	};
+
+	int m_Socket;
+	NetMessaging::PeerAddress m_PeerAddress; // from accept( ); formatted by the owner
+	int m_WakeupSocket;       // eventfd; readable when the mailbox has something
+	NetMessaging::FrameParser m_Parser;
+
+	Mailbox m_Mailbox;        // frames posted by any thread
+	volatile bool m_bBatching; // the owner flushes soon; skip the wakeup
+	FrameQueue m_Outbound;    // frames waiting to be written (owner only); each holds a reference
+	size_t m_nFrontSent;      // bytes of m_Outbound.front( ) already written
+	size_t m_nQueuedBytes;    // unsent bytes across m_Outbound
+	size_t m_nPinned;         // frames at the front of m_Outbound the kernel is still sending from
+	NetMessaging::Compressor *m_pCompressor; // if the client asked for compression (owner only)
+	size_t m_nCompressed;     // frames at the front of m_Outbound already run past the compressor
+	unsigned long m_nDropped;
+	volatile bool m_bOverflowed;
+	volatile int m_nDispatch; // a DispatchState
+	long m_nArrivalStamp;     // CLOCK_MONOTONIC nanoseconds of the oldest unanswered message
+	long m_nArrivals;         // messages taken since the output last drained
+	std::string *m_pReplies;  // the open reply batch, if any (owner only)
+	uint32_t m_nRequestId;    // of the batch entry being handled
+
+	static size_t m_nQueueLimit;
+	static OverflowPolicy m_OverflowPolicy;
+	static StripedCounter m_TotalQueuedBytes;
+	static AtomicCounter m_PeakQueuedBytes;
+	static AtomicCounter m_TotalDropped;
+	static AtomicCounter m_TotalOverflowDisconnects;
+	static StripedCounter m_TotalReceiveCalls;
+	static StripedCounter m_TotalMessagesReceived;
+	static StripedCounter m_TotalWakeupCalls;
+	static LatencyHistogram m_Turnaround;
+
+	bool collectPosted( );
+	void collect( );
+	bool makeRoom( size_t bytes );
+	size_t firstUnsent( ) const;
+	void enqueue( NetMessaging::Frame *pFrame );
+	void erase( size_t index );
+	NetMessaging::Protocol::Result writeQueued( );
+	void compressQueued( size_t frames );
+	int gatherQueued( size_t first, size_t frames, struct iovec *pVectors ) const;
+	void completeWrite( size_t bytes );
+	void recordTurnaround( );
+
+  private:
+	Connection( const Connection &connection );
+	Connection &operator=( const Connection &connection );
+};
+
+inline int Connection::socket( ) const
+{ return m_Socket; }
+
+inline const NetMessaging::PeerAddress &Connection::peerAddress( ) const
+{ return m_PeerAddress; }
+
+inline int Connection::wakeupSocket( ) const
+{ return m_WakeupSocket; }
+
+/*
+ *	The framing the client spoke first, and so is answered in; nothing
+ *	is sent to a client before it has said something.
+ */
+inline NetMessaging::Protocol::Byte Connection::wireVersion( ) const
+{
+	NetMessaging::Protocol::Byte version = m_Parser.version( );
+	return version != 0 ? version : NetMessaging::Protocol::PROTOCOL_VERSION_1;
+}
+
+inline void Connection::openReplyBatch( std::string *pReplies )
+{ m_pReplies = pReplies; }
+
+inline void Connection::setRequestId( uint32_t requestId )
+{ m_nRequestId = requestId; }
+
+inline void Connection::closeReplyBatch( )
+{ m_pReplies = NULL; }
+
+inline bool Connection::isCompressing( ) const
+{ return m_pCompressor != NULL; }
+
+inline bool Connection::awaitDrain( std::coroutine_handle<> handle )
+{ return false; }
+
+inline bool Connection::isMalformed( ) const
+{ return m_Parser.isMalformed( ); }
+
+inline Connection *Connection::fromEvent( const epoll_data_t &data, bool *pWakeup )
+{
+	uintptr_t bits = (uintptr_t) data.ptr;
+	*pWakeup = (bits & WAKEUP_TAG) != 0;
+	return reinterpret_cast<Connection *>( bits & ~WAKEUP_TAG );
+}
+
+inline bool Connection::schedule( )
+{
+	while( true )
+	{
+		int state = m_nDispatch;
+		if( state == IDLE && __sync_bool_compare_and_swap( &m_nDispatch, IDLE, SCHEDULED ) ) return true;
+		if( state == SCHEDULED && __sync_bool_compare_and_swap( &m_nDispatch, SCHEDULED, RESCHEDULED ) ) return false;
+		if( state == RESCHEDULED || state == RETIRED ) return false;
+	}
+}
+
+inline bool Connection::finish( )
+{
+	if( __sync_bool_compare_and_swap( &m_nDispatch, SCHEDULED, IDLE ) ) return false;
+	return __sync_bool_compare_and_swap( &m_nDispatch, RESCHEDULED, SCHEDULED );
+}
+
+inline void Connection::retire( )
+{ __sync_lock_test_and_set( &m_nDispatch, (int) RETIRED ); }
+
+inline bool Connection::isRetired( ) const
+{ return m_nDispatch == RETIRED; }
+
+inline void Connection::setQueueLimit( size_t bytes )
+{ m_nQueueLimit = bytes; }
+
+inline size_t Connection::queueLimit( )
+{ return m_nQueueLimit; }
+
+inline void Connection::setOverflowPolicy( OverflowPolicy policy )
+{ m_OverflowPolicy = policy; }
+
+inline Connection::OverflowPolicy Connection::overflowPolicy( )
+{ return m_OverflowPolicy; }
+
+inline long Connection::totalQueuedBytes( )
+{ return m_TotalQueuedBytes.value( ); }
+
+inline long Connection::peakQueuedBytes( )
+{ return m_PeakQueuedBytes.value( ); }
+
+inline long Connection::totalDroppedMessages( )
+{ return m_TotalDropped.value( ); }
+
+inline long Connection::totalOverflowDisconnects( )
+{ return m_TotalOverflowDisconnects.value( ); }
+
+inline long Connection::totalReceiveCalls( )
+{ return m_TotalReceiveCalls.value( ); }
+
+inline long Connection::totalMessagesReceived( )
+{ return m_TotalMessagesReceived.value( ); }
+
+inline long Connection::totalWakeupCalls( )
+{ return m_TotalWakeupCalls.value( ); }
+
+inline long Connection::turnaroundPercentile( double fraction )
+{ return m_Turnaround.percentile( fraction ); }
+
+inline long Connection::turnaroundSamples( )
+{ return m_Turnaround.samples( ); }
+
+} // end of namespace
+#endif
@@ -0,0 +1,80 @@
+#include <sys/resource.h>
+#include "connectiontable.h"
+
+namespace SCS {
+
+namespace {
+
+const size_t MAX_DESCRIPTORS = 1 << 30; // Linux's ceiling for RLIMIT_NOFILE
+
+/*
+ *	How many descriptors the process could ever have open: the hard
+ *	limit, since the soft one may be raised up to it later.
+ */
+size_t descriptorLimit( )
+{
+	struct rlimit limit;
+
+	if( getrlimit( RLIMIT_NOFILE, &limit ) != 0 ) return 1 << 20; // Linux's default nr_open
+	if( limit.rlim_max == RLIM_INFINITY || limit.rlim_max > MAX_DESCRIPTORS ) return MAX_DESCRIPTORS;
+	return (size_t) limit.rlim_max;
+}
+
+} // end of anonymous namespace
+
+ConnectionTable::ConnectionTable( )
+  : m_pPages(NULL),
+    m_nPages((descriptorLimit( ) + PAGE_SIZE - 1) / PAGE_SIZE)
+{
+	m_pPages = new Page *[ m_nPages ]( );
+}
+
+ConnectionTable::~ConnectionTable( )
+{
+	for( size_t i = 0; i < m_nPages; i++ )
+	{
+		delete m_pPages[ i ];
+	}
+	delete [] m_pPages;
+}
+
+/*
+ *	Publish a connection under its socket. Fails only for a descriptor
+ *	past the limit the table was sized for.
+ */
+bool ConnectionTable::insert( Connection *pConnection )
+{
+	int socket = pConnection->socket( );
+	if( socket < 0 || (size_t) socket / PAGE_SIZE >= m_nPages ) return false;
+
+	m_Lock.lock( );
+		Page *pPage = m_pPages[ socket / PAGE_SIZE ];
+		if( pPage == NULL )
+		{
+			pPage = new Page( ); // all NULL
+			__atomic_store_n( &m_pPages[ socket / PAGE_SIZE ], pPage, __ATOMIC_RELEASE );
+		}
+		__atomic_store_n( &pPage->slots[ socket % PAGE_SIZE ], pConnection, __ATOMIC_RELEASE );
+	m_Lock.unlock( );
+
+	return true;
+}
+
+Connection *ConnectionTable::erase( int socket )
+{
+	Connection *pConnection = NULL;
+	if( socket < 0 || (size_t) socket / PAGE_SIZE >= m_nPages ) return NULL;
+
+	m_Lock.lock( );
+		Page *pPage = m_pPages[ socket / PAGE_SIZE ];
+		if( pPage != NULL )
+		{
+			pConnection = pPage->slots[ socket % PAGE_SIZE ];
+			__atomic_store_n( &pPage->slots[ socket % PAGE_SIZE ], (Connection *) NULL, __ATOMIC_RELEASE );
+		}
+	m_Lock.unlock( );
+
+	return pConnection;
+}
+
+} // end of namespace SCS
@@ -0,0 +1,63 @@
+#ifndef _CONNECTIONTABLE_H_
+#define _CONNECTIONTABLE_H_
+/*
+ *	connectiontable.h
+ *
+ *	Every client's Connection indexed directly by its socket, for the
+ *	broadcast path, which looks one up for each recipient. Like the
+ *	UserTable it is one slot per file descriptor, but lookups take no
+ *	lock at all: the slots live in pages of PAGE_SIZE that are allocated
+ *	the first time a descriptor in their range is used and never move or
+ *	go away, and the directory of pages is sized once, for every
+ *	descriptor the process may ever open. So a lookup is two loads.
+ *
+ *	insert( ) and erase( ) are serialized by the table's own lock. A
+ *	lookup racing an erase( ) may still see the old Connection. That is
+ *	safe because a Connection is only deleted after its socket has left
+ *	every room's published membership and the grace period of that
+ *	Chatroom::publish( ) has passed, so no broadcast can still be
+ *	looking it up (see SimpleChatServer::sendMessage( )).
+ */
+
+#include <cstddef>
+#include "synchronize.h"
+#include "connection.h"
+
+namespace SCS {
+
+class ConnectionTable
+{
+  public:
+	static const int PAGE_SIZE = 1024; // descriptors per page
+
+	ConnectionTable( );
+	~ConnectionTable( ); // frees the pages, not the connections
+
+	bool insert( Connection *pConnection );
+	Connection *erase( int socket ); // the connection that was there, if any
+	Connection *find( int socket ) const;
+
+  private:
+	struct Page
+	{
+		Connection *slots[ PAGE_SIZE ];
+	};
+
+	Page **m_pPages;   // the directory; a NULL page has no connections yet
+	size_t m_nPages;
+	Lock m_Lock;
+
+	ConnectionTable( const ConnectionTable &table );
+	ConnectionTable &operator=( const ConnectionTable &table );
+};
+
+inline Connection *ConnectionTable::find( int socket ) const
+{
+	if( socket < 0 || (size_t) socket / PAGE_SIZE >= m_nPages ) return NULL;
+
+	Page *pPage = __atomic_load_n( &m_pPages[ socket / PAGE_SIZE ], __ATOMIC_ACQUIRE );
+	return pPage != NULL ? __atomic_load_n( &pPage->slots[ socket % PAGE_SIZE ], __ATOMIC_ACQUIRE ) : NULL;
+}
+
+} // end of namespace SCS
+#endif
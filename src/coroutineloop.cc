@@ -0,0 +1,199 @@
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "coroutineloop.h"
+#include "simplechatserver.h"
+#include "engine.h"
+
+namespace SCS {
+
+AtomicCounter CoroutineLoop::m_CoroutinesStarted;
+AtomicCounter CoroutineLoop::m_CoroutinesRunning;
+
+CoroutineLoop::CoroutineLoop( SimpleChatServer *pServer, int listeningSocket )
+  : m_pServer(pServer), m_ListeningSocket(listeningSocket), m_EpollSocket(-1)
+{
+	assert( m_pServer != NULL );
+}
+
+CoroutineLoop::~CoroutineLoop( )
+{
+	if( m_EpollSocket >= 0 ) close( m_EpollSocket );
+}
+
+/*
+ *	One client, start to finish. This is the whole per-client loop; it
+ *	reads like the blocking code of the thread-per-client model but
+ *	only holds on to a thread while a message is being handled.
+ */
+Task<void> CoroutineLoop::serve( AsyncConnection *pConnection )
+{
+	int clientSocket = pConnection->socket( );
+	NetMessaging::Protocol::Message message;
+	bool bKeep = true;
+
+	// not "bKeep && co_await ..." in the loop condition: g++ evaluates a
+	// co_await in a short-circuited operand regardless, and would wait
+	// for one more message from a client a handler wants dropped.
+	while( bKeep )
+	{
+		if( !co_await pConnection->readFrame( message ) ) break;
+
+		bKeep = co_await m_pServer->handleMessageAsync( clientSocket, message );
+		NetMessaging::Protocol::freeMessageData( message );
+	}
+
+	pConnection->unwatch( m_EpollSocket );
+
+	// remove user from all chatrooms...
+	NetMessaging::Protocol::initializeMessage( message );
+	m_pServer->handleUserLeave( clientSocket, message );
+	m_pServer->handleDisconnect( clientSocket );
+
+	m_CoroutinesRunning.subtract( );
+}
+
+bool CoroutineLoop::run( )
+{
+	if( (m_EpollSocket = epoll_create1( EPOLL_CLOEXEC )) < 0 )
+	{
+		Engine::onError( "Could not create epoll instance; errno = %d", errno );
+		return false;
+	}
+
+	if( !NetMessaging::Server::setNonBlocking( m_ListeningSocket ) )
+	{
+		Engine::onError( "Could not make the listening socket non-blocking." );
+		return false;
+	}
+
+	struct epoll_event event;
+	memset( &event, 0, sizeof(event) );
+	event.events   = EPOLLIN;
+	event.data.ptr = NULL;
+
+	if( epoll_ctl( m_EpollSocket, EPOLL_CTL_ADD, m_ListeningSocket, &event ) < 0 )
+	{
+		Engine::onError( "Could not register the listening socket with epoll; errno = %d", errno );
+		return false;
+	}
+
+	Engine::onInfo( "Serving clients from coroutines on an epoll event loop (listener = %d).", m_ListeningSocket );
+
+	struct epoll_event events[ MAX_EVENTS ];
+
+	while( true )
+	{
+		int count = epoll_wait( m_EpollSocket, events, MAX_EVENTS, m_Yielded.empty( ) ? -1 : 0 );
+		NetMessaging::Protocol::countWaitCall( );
+
+		if( count < 0 )
+		{
+			if( errno == EINTR ) continue;
+			Engine::onError( "epoll_wait( ) failed; errno = %d", errno );
+			return false;
+		}
+
+		for( int i = 0; i < count; i++ )
+		{
+			if( events[ i ].data.ptr == NULL )
+			{
+				acceptClients( );
+				continue;
+			}
+
+			bool bWakeup;
+			AsyncConnection *pConnection = static_cast<AsyncConnection *>( Connection::fromEvent( events[ i ].data, &bWakeup ) );
+			if( pConnection->isRetired( ) ) continue;
+
+			if( bWakeup )
+			{
+				pConnection->clearWakeup( );
+				pConnection->onWritable( );
+			}
+			else
+			{
+				if( events[ i ].events & EPOLLOUT ) pConnection->onWritable( );
+				if( !pConnection->isFinished( ) && (events[ i ].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) )
+				{
+					pConnection->onReadable( );
+				}
+			}
+
+			checkConnection( pConnection );
+		}
+
+		// then another turn for clients that had more to read...
+		std::vector<AsyncConnection *> yielded;
+		yielded.swap( m_Yielded );
+		std::sort( yielded.begin( ), yielded.end( ) );
+		yielded.erase( std::unique( yielded.begin( ), yielded.end( ) ), yielded.end( ) );
+
+		for( size_t i = 0; i < yielded.size( ); i++ )
+		{
+			if( yielded[ i ]->isRetired( ) ) continue;
+
+			yielded[ i ]->onReadable( );
+			checkConnection( yielded[ i ] );
+		}
+
+		for( size_t i = 0; i < m_Finished.size( ); i++ )
+		{
+			delete m_Finished[ i ];
+		}
+		m_Finished.clear( );
+	}
+
+	return true;
+}
+
+void CoroutineLoop::acceptClients( )
+{
+	m_pServer->acceptConnections( m_ListeningSocket, m_Admitted );
+
+	for( size_t i = 0; i < m_Admitted.size( ); i++ )
+	{
+		int clientSocket = m_Admitted[ i ].socket;
+
+		AsyncConnection *pConnection = new AsyncConnection( clientSocket, m_Admitted[ i ].address );
+		m_pServer->registerConnection( pConnection );
+
+		if( !pConnection->watch( m_EpollSocket ) )
+		{
+			Engine::onError( "Client socket = %d, could not register with epoll; errno = %d", clientSocket, errno );
+			m_pServer->handleDisconnect( clientSocket );
+			delete pConnection;
+			continue;
+		}
+
+		m_CoroutinesStarted.add( );
+		m_CoroutinesRunning.add( );
+
+		Task<void> task = serve( pConnection );
+		pConnection->setTask( task );
+		checkConnection( pConnection );
+	}
+	m_Admitted.clear( );
+}
+
+/*
+ *	After a client's coroutine ran: retire it if it finished, or give it
+ *	another turn if it stopped reading only to let the others run.
+ */
+void CoroutineLoop::checkConnection( AsyncConnection *pConnection )
+{
+	if( pConnection->isFinished( ) )
+	{
+		pConnection->retire( ); // the current batch may hold another event for it
+		m_Finished.push_back( pConnection );
+	}
+	else if( pConnection->hasYielded( ) )
+	{
+		m_Yielded.push_back( pConnection );
+	}
+}
+
+} // end of namespace
@@ -0,0 +1,59 @@
+#ifndef _COROUTINELOOP_H_
+#define _COROUTINELOOP_H_
+/*
+ *	coroutineloop.h
+ *
+ *	Edge-triggered epoll event loop that serves each client with a C++20
+ *	coroutine (see serve( )) instead of a thread. A client waiting for
+ *	input costs its coroutine frame and its Connection, not a stack.
+ */
+
+#include <vector>
+#include "asyncconnection.h"
+#include "task.h"
+
+namespace SCS {
+
+class SimpleChatServer;
+
+class CoroutineLoop
+{
+  public:
+	CoroutineLoop( SimpleChatServer *pServer, int listeningSocket );
+	virtual ~CoroutineLoop( );
+
+	bool run( );
+
+	static long coroutinesStarted( );
+	static long coroutinesRunning( );
+
+  protected:
+	static const int MAX_EVENTS = 256;
+
+	void acceptClients( );
+	void checkConnection( AsyncConnection *pConnection );
+	Task<void> serve( AsyncConnection *pConnection );
+
+	SimpleChatServer *m_pServer;
+	int m_ListeningSocket;
+	int m_EpollSocket;
+	std::vector<AsyncConnection *> m_Yielded;  // had more input when their turn ended
+	std::vector<AsyncConnection *> m_Finished; // deleted once the current batch of events is done
+	std::vector<NetMessaging::Server::Peer> m_Admitted; // accepted in the current round
+
+	static AtomicCounter m_CoroutinesStarted;
+	static AtomicCounter m_CoroutinesRunning;
+
+  private:
+	CoroutineLoop( const CoroutineLoop &loop );
+	CoroutineLoop &operator=( const CoroutineLoop &loop );
+};
+
+inline long CoroutineLoop::coroutinesStarted( )
+{ return m_CoroutinesStarted.value( ); }
+
+inline long CoroutineLoop::coroutinesRunning( )
+{ return m_CoroutinesRunning.value( ); }
+
+} // end of namespace
+#endif
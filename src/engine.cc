@@ -15,6 +15,8 @@
 #include <cstdio>
 #ifndef WIN32
 #include <syslog.h>
+#include <pthread.h>
+#include <time.h>
 #endif
 #include "engine.h"
 #include "main.h"
@@ -30,7 +32,16 @@ Engine::Engine( )
     m_bLogginEnabled(false), 
     m_usPort(0),
     m_nMaxConnections(0),
+    m_nBacklog(NetMessaging::Server::DEFAULT_BACKLOG),
     m_nMaxChatrooms(0),
+    m_IOModel(SimpleChatServer::IO_THREAD_PER_CLIENT),
+    m_nReactors(1),
+    m_nWorkers(4),
+    m_nStackSize(0),
+    m_nQueueLimit(1024 * 1024),
+    m_OverflowPolicy(Connection::DROP_OLDEST),
+    m_bStripControls(false),
+    m_nCompressThreshold(512),
     m_pServer(NULL)
 {
 }
@@ -40,7 +51,16 @@ Engine::Engine( const Engine& engine )
     m_bLogginEnabled(false), 
     m_usPort(0),
     m_nMaxConnections(0),
+    m_nBacklog(NetMessaging::Server::DEFAULT_BACKLOG),
     m_nMaxChatrooms(0),
+    m_IOModel(SimpleChatServer::IO_THREAD_PER_CLIENT),
+    m_nReactors(1),
+    m_nWorkers(4),
+    m_nStackSize(0),
+    m_nQueueLimit(1024 * 1024),
+    m_OverflowPolicy(Connection::DROP_OLDEST),
+    m_bStripControls(false),
+    m_nCompressThreshold(512),
     m_pServer(NULL)
 {	
     assert(false); // not implemented...
@@ -73,7 +93,14 @@ bool Engine::initialize( )
 
     Engine::onInfo( "Starting..." );
 
-    return m_pServer->initialize( getMaxChatrooms( ), 100, getPort( ), getMaxConnections( ) );
+    Connection::setQueueLimit( getQueueLimit( ) );
+    Connection::setOverflowPolicy( getOverflowPolicy( ) );
+    NetMessaging::FrameParser::setStripControls( getStripControls( ) );
+    NetMessaging::Compressor::setThreshold( getCompressThreshold( ) );
+    m_pServer->setThreadStackSize( getStackSize( ) );
+
+    unsigned int reactors = getIOModel( ) == SimpleChatServer::IO_EPOLL ? getReactors( ) : 1;
+    return m_pServer->initialize( getMaxChatrooms( ), 100, getPort( ), getMaxConnections( ), reactors, getBacklog( ) );
 }
 
 bool Engine::deinitialize( )
@@ -105,16 +132,101 @@ void Engine::go( )
 		exit( EXIT_FAILURE );
 	}
 
-	while( true ) 
+	if( !startReporting( ) )
 	{
-		int clientSocket = m_pServer->acceptConnection( );
-		if( clientSocket > 0 ) m_pServer->handleClient( clientSocket );
+		Engine::onError( "Could not start the statistics reporter." );
+	}
+
+	if( getIOModel( ) == SimpleChatServer::IO_EPOLL )
+	{
+		if( !m_pServer->runEventLoop( ) )
+		{
+			Engine::onError( "The event loop failed!" );
+			exit( EXIT_FAILURE );
+		}
+	}
+	else if( getIOModel( ) == SimpleChatServer::IO_COROUTINES )
+	{
+		if( !m_pServer->runCoroutines( ) )
+		{
+			Engine::onError( "The coroutine event loop failed!" );
+			exit( EXIT_FAILURE );
+		}
+	}
+	else if( getIOModel( ) == SimpleChatServer::IO_URING )
+	{
+		if( !m_pServer->runUring( ) )
+		{
+			Engine::onError( "The io_uring event loop failed!" );
+			exit( EXIT_FAILURE );
+		}
+	}
+	else if( getIOModel( ) == SimpleChatServer::IO_WORKER_POOL )
+	{
+		if( !m_pServer->runWorkerPool( getWorkers( ) ) )
+		{
+			Engine::onError( "The worker pool failed!" );
+			exit( EXIT_FAILURE );
+		}
+	}
+	else if( !m_pServer->runThreadPerClient( ) )
+	{
+		Engine::onError( "The accept loop failed!" );
+		exit( EXIT_FAILURE );
 	}
 	////////////////////////////////////////////////////
 	///////////////// NEVER REACHED ////////////////////
 	////////////////////////////////////////////////////
 }
 
+/*
+ *	Log the server's statistics every STATS_INTERVAL seconds, and
+ *	whenever SIGUSR1 arrives, from a thread of their own so that no
+ *	client ever waits on them. SIGUSR1 is blocked here before any other
+ *	thread is started, so every thread inherits the mask and only the
+ *	reporter takes the signal, through sigtimedwait( ). When there is
+ *	nowhere to log to, SIGUSR1 is just ignored rather than left to
+ *	terminate the server.
+ */
+bool Engine::startReporting( )
+{
+	#ifndef WIN32
+	if( !isVerboseEnabled( ) && !isLoggingEnabled( ) ) return signal( SIGUSR1, SIG_IGN ) != SIG_ERR;
+
+	sigset_t signals;
+	sigemptyset( &signals );
+	sigaddset( &signals, SIGUSR1 );
+	if( pthread_sigmask( SIG_BLOCK, &signals, NULL ) != 0 ) return false;
+
+	pthread_t threadID;
+	if( pthread_create( &threadID, NULL, Engine::reportStats, this ) != 0 ) return false;
+	pthread_detach( threadID );
+	#endif
+	return true;
+}
+
+void *Engine::reportStats( void *pArgs )
+{
+	#ifndef WIN32
+	Engine *pEngine = static_cast<Engine *>( pArgs );
+
+	sigset_t signals;
+	sigemptyset( &signals );
+	sigaddset( &signals, SIGUSR1 );
+
+	for( ;; )
+	{
+		struct timespec interval = { STATS_INTERVAL, 0 };
+		int signal = sigtimedwait( &signals, NULL, &interval );
+
+		if( signal < 0 && errno != EAGAIN ) continue; // interrupted by something else
+
+		pEngine->m_pServer->logStats( );
+	}
+	#endif
+	return NULL;
+}
+
 void Engine::restart( )
 {
 	Engine::onInfo( "Restarting..." );
@@ -39,11 +39,40 @@ class Engine
     void setMaxConnections( unsigned int maxConnections = 100 );
     unsigned short getMaxConnections( ) const;  
   
+    void setBacklog( unsigned int backlog = NetMessaging::Server::DEFAULT_BACKLOG );
+    unsigned int getBacklog( ) const;
+  
     void setMaxChatrooms( unsigned int maxChatrooms = 100 );
     unsigned short getMaxChatrooms( ) const;  
+
+    void setIOModel( SimpleChatServer::IOModel model = SimpleChatServer::IO_THREAD_PER_CLIENT );
+    SimpleChatServer::IOModel getIOModel( ) const;
+
+    void setReactors( unsigned int reactors = 1 );
+    unsigned int getReactors( ) const;
+
+    void setWorkers( unsigned int workers = 4 );
+    unsigned int getWorkers( ) const;
+
+    void setStackSize( size_t bytes = 0 );
+    size_t getStackSize( ) const;
+
+    void setQueueLimit( size_t bytes = 1024 * 1024 );
+    size_t getQueueLimit( ) const;
+
+    void setOverflowPolicy( Connection::OverflowPolicy policy = Connection::DROP_OLDEST );
+    Connection::OverflowPolicy getOverflowPolicy( ) const;
+
+    void setStripControls( bool bStrip = false );
+    bool getStripControls( ) const;
+
+    void setCompressThreshold( size_t bytes = 512 );
+    size_t getCompressThreshold( ) const;
   
     static void onError( const char *pErrorMessageFormat, ... );
     static void onInfo( const char *pInfoMessageFormat, ... );
+
+    static const unsigned int STATS_INTERVAL = 60; // seconds between statistics reports; SIGUSR1 asks for one now
   
   private:
     Engine( );
@@ -55,13 +84,24 @@ class Engine
   
     bool initialize( );
     bool deinitialize( );
+    bool startReporting( );
+    static void *reportStats( void *pArgs );
 	
   private:
     bool m_bVerbose;
     bool m_bLogginEnabled;
     unsigned short m_usPort;
     unsigned int m_nMaxConnections;
+    unsigned int m_nBacklog;
     unsigned int m_nMaxChatrooms;
+    SimpleChatServer::IOModel m_IOModel;
+    unsigned int m_nReactors;
+    unsigned int m_nWorkers;
+    size_t m_nStackSize;
+    size_t m_nQueueLimit;
+    Connection::OverflowPolicy m_OverflowPolicy;
+    bool m_bStripControls;
+    size_t m_nCompressThreshold;
     SimpleChatServer *m_pServer;
 };
 
@@ -90,12 +130,66 @@ inline void Engine::setMaxConnections( unsigned int maxConnections )
 inline unsigned short Engine::getMaxConnections( ) const
 { return m_nMaxConnections; }
 	
+inline void Engine::setBacklog( unsigned int backlog )
+{ m_nBacklog = backlog; }
+
+inline unsigned int Engine::getBacklog( ) const
+{ return m_nBacklog; }
+
 inline void Engine::setMaxChatrooms( unsigned int maxChatrooms )
 { m_nMaxChatrooms = maxChatrooms; }
 
 inline unsigned short Engine::getMaxChatrooms( ) const
 { return m_nMaxChatrooms; }
 
+inline void Engine::setIOModel( SimpleChatServer::IOModel model )
+{ m_IOModel = model; }
+
+inline SimpleChatServer::IOModel Engine::getIOModel( ) const
+{ return m_IOModel; }
+
+inline void Engine::setReactors( unsigned int reactors )
+{ m_nReactors = reactors; }
+
+inline unsigned int Engine::getReactors( ) const
+{ return m_nReactors; }
+
+inline void Engine::setWorkers( unsigned int workers )
+{ m_nWorkers = workers; }
+
+inline unsigned int Engine::getWorkers( ) const
+{ return m_nWorkers; }
+
+inline void Engine::setStackSize( size_t bytes )
+{ m_nStackSize = bytes; }
+
+inline size_t Engine::getStackSize( ) const
+{ return m_nStackSize; }
+
+inline void Engine::setQueueLimit( size_t bytes )
+{ m_nQueueLimit = bytes; }
+
+inline size_t Engine::getQueueLimit( ) const
+{ return m_nQueueLimit; }
+
+inline void Engine::setOverflowPolicy( Connection::OverflowPolicy policy )
+{ m_OverflowPolicy = policy; }
+
+inline Connection::OverflowPolicy Engine::getOverflowPolicy( ) const
+{ return m_OverflowPolicy; }
+
+inline void Engine::setStripControls( bool bStrip )
+{ m_bStripControls = bStrip; }
+
+inline bool Engine::getStripControls( ) const
+{ return m_bStripControls; }
+
+inline void Engine::setCompressThreshold( size_t bytes )
+{ m_nCompressThreshold = bytes; }
+
+inline size_t Engine::getCompressThreshold( ) const
+{ return m_nCompressThreshold; }
+
 
 ////////////////////////////////////////////////////////////////////
 ///////////////////////// SIGNAL HANDLER /////////////////////////// 
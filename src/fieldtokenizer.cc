@@ -0,0 +1,106 @@
+///////////////////////////////////////////////////////////////////////////////////
+//// FieldTokenizer.cc ////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#include "fieldtokenizer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FIELDTOKENIZER_X86
+#endif
+
+namespace NetMessaging {
+
+namespace {
+
+const char *findScalar( const char *pBegin, const char *pEnd, char delimiter )
+{
+	while( pBegin < pEnd && *pBegin != delimiter ) pBegin++;
+	return pBegin;
+}
+
+#ifdef FIELDTOKENIZER_X86
+/*
+ *	Compare 16 bytes at once against the delimiter; the mask has a bit
+ *	set for every byte that matched, the lowest one is the first.
+ */
+__attribute__((target("sse2")))
+const char *findSse2( const char *pBegin, const char *pEnd, char delimiter )
+{
+	const __m128i needle = _mm_set1_epi8( delimiter );
+
+	for( ; pEnd - pBegin >= 16; pBegin += 16 )
+	{
+		__m128i block = _mm_loadu_si128( reinterpret_cast<const __m128i *>( pBegin ) );
+		int mask = _mm_movemask_epi8( _mm_cmpeq_epi8( block, needle ) );
+		if( mask != 0 ) return pBegin + __builtin_ctz( mask );
+	}
+
+	return findScalar( pBegin, pEnd, delimiter );
+}
+
+__attribute__((target("avx2")))
+const char *findAvx2( const char *pBegin, const char *pEnd, char delimiter )
+{
+	const __m256i needle = _mm256_set1_epi8( delimiter );
+
+	for( ; pEnd - pBegin >= 32; pBegin += 32 )
+	{
+		__m256i block = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( pBegin ) );
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8( _mm256_cmpeq_epi8( block, needle ) );
+		if( mask != 0 ) return pBegin + __builtin_ctz( mask );
+	}
+
+	// the last 31 bytes or less, still VEX encoded: calling findSse2( )
+	// with the upper halves dirty would cost an SSE/AVX transition...
+	if( pEnd - pBegin >= 16 )
+	{
+		__m128i block = _mm_loadu_si128( reinterpret_cast<const __m128i *>( pBegin ) );
+		int mask = _mm_movemask_epi8( _mm_cmpeq_epi8( block, _mm256_castsi256_si128( needle ) ) );
+		if( mask != 0 ) return pBegin + __builtin_ctz( mask );
+		pBegin += 16;
+	}
+
+	return findScalar( pBegin, pEnd, delimiter );
+}
+#endif
+
+FieldTokenizer::Implementation selectImplementation( )
+{
+	#ifdef FIELDTOKENIZER_X86
+	__builtin_cpu_init( ); // we run before main( )
+	if( __builtin_cpu_supports( "avx2" ) ) return FieldTokenizer::AVX2;
+	if( __builtin_cpu_supports( "sse2" ) ) return FieldTokenizer::SSE2;
+	#endif
+	return FieldTokenizer::SCALAR;
+}
+
+} // end of anonymous namespace
+
+#ifdef FIELDTOKENIZER_X86
+const FieldTokenizer::FindFunction FieldTokenizer::m_Find[ IMPLEMENTATIONS ] = { findScalar, findSse2, findAvx2 };
+#else
+const FieldTokenizer::FindFunction FieldTokenizer::m_Find[ IMPLEMENTATIONS ] = { findScalar, findScalar, findScalar };
+#endif
+const FieldTokenizer::Implementation FieldTokenizer::m_Implementation = selectImplementation( );
+
+bool FieldTokenizer::isSupported( Implementation implementation )
+{
+	return implementation <= m_Implementation;
+}
+
+const char *FieldTokenizer::name( Implementation implementation )
+{
+	static const char *names[ IMPLEMENTATIONS ] = { "scalar", "SSE2", "AVX2" };
+	return names[ implementation ];
+}
+
+/*
+ * 	The same as find( ) but with the given implementation, which must be
+ * 	supported.
+ */
+const char *FieldTokenizer::find( Implementation implementation, const char *pBegin, const char *pEnd, char delimiter )
+{
+	return m_Find[ implementation ]( pBegin, pEnd, delimiter );
+}
+
+}// end of namespace
@@ -0,0 +1,93 @@
+#ifndef _FIELDTOKENIZER_H_
+#define _FIELDTOKENIZER_H_
+///////////////////////////////////////////////////////////////////////////////////
+//// FieldTokenizer.h /////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <string_view>
+#include "protocol.h"
+
+namespace NetMessaging {
+
+/*
+ *	Splits a message payload into its fields: "room\0text\0" is "room"
+ *	and "text", "alice@1.2.3.4\nbob@5.6.7.8" split on '\n' is the two
+ *	users. Fields are views into the payload, so they are only good for
+ *	as long as the message is. A last field need not be terminated, and
+ *	a delimiter at the very end does not start an empty one.
+ *
+ *	Delimiters are found 32 bytes at a time with AVX2 or 16 at a time
+ *	with SSE2, whichever the CPU has (checked once, at startup), or a
+ *	byte at a time on anything else.
+ */
+class FieldTokenizer
+{
+  public:
+	enum Implementation {
+		SCALAR = 0,
+		SSE2,
+		AVX2,
+		IMPLEMENTATIONS
+	};
+
+	FieldTokenizer( const char *pData, size_t size, char delimiter = '\0' );
+	explicit FieldTokenizer( const Protocol::Message &msg, char delimiter = '\0' );
+
+	bool next( std::string_view &field );
+	std::string_view rest( ) const; // everything not split off yet, as is
+
+	static const char *find( const char *pBegin, const char *pEnd, char delimiter );
+	static Implementation implementation( );
+	static bool isSupported( Implementation implementation );
+	static const char *name( Implementation implementation );
+	static const char *find( Implementation implementation, const char *pBegin, const char *pEnd, char delimiter ); // e.g. to compare them
+
+  protected:
+	typedef const char *(*FindFunction)( const char *pBegin, const char *pEnd, char delimiter );
+
+	const char *m_pNext;
+	const char *m_pEnd;
+	char m_Delimiter;
+
+	static const FindFunction m_Find[ IMPLEMENTATIONS ];
+	static const Implementation m_Implementation; // the best the CPU has
+};
+
+inline FieldTokenizer::FieldTokenizer( const char *pData, size_t size, char delimiter )
+  : m_pNext(pData), m_pEnd(pData + size), m_Delimiter(delimiter)
+{
+}
+
+inline FieldTokenizer::FieldTokenizer( const Protocol::Message &msg, char delimiter )
+  : m_pNext(msg.data), m_pEnd(msg.data + (msg.data != NULL ? msg.header.dataSize : 0)), m_Delimiter(delimiter)
+{
+}
+
+/*
+ * 	The next field, if there is one left.
+ */
+inline bool FieldTokenizer::next( std::string_view &field )
+{
+	if( m_pNext >= m_pEnd ) return false;
+
+	const char *pDelimiter = find( m_pNext, m_pEnd, m_Delimiter );
+	field = std::string_view( m_pNext, pDelimiter - m_pNext );
+	m_pNext = pDelimiter + 1; // past the end when there was no delimiter
+
+	return true;
+}
+
+inline std::string_view FieldTokenizer::rest( ) const
+{ return m_pNext < m_pEnd ? std::string_view( m_pNext, m_pEnd - m_pNext ) : std::string_view( ); }
+
+/*
+ * 	The first delimiter in [pBegin, pEnd), or pEnd.
+ */
+inline const char *FieldTokenizer::find( const char *pBegin, const char *pEnd, char delimiter )
+{ return m_Find[ m_Implementation ]( pBegin, pEnd, delimiter ); }
+
+inline FieldTokenizer::Implementation FieldTokenizer::implementation( )
+{ return m_Implementation; }
+
+}// end of namespace
+#endif
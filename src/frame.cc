@@ -0,0 +1,94 @@
+///////////////////////////////////////////////////////////////////////////////////
+//// Frame.cc /////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#include <new>
+#include <cstring>
+#include "frame.h"
+
+namespace NetMessaging {
+
+Frame::Frame( Protocol::MessageType type, size_t dataSize, Protocol::Byte flags )
+  : m_nReferences(1), m_Type(type), m_Flags(flags), m_bBroadcast(false), m_pCompressed(NULL), m_nDataSize(dataSize),
+    m_pBytes(reinterpret_cast<char *>( this + 1 ))
+{
+}
+
+Frame::~Frame( )
+{
+	if( m_pCompressed != NULL ) m_pCompressed->release( );
+}
+
+/*
+ *	Encode a message once, for either framing. The caller owns the
+ *	returned reference.
+ */
+Frame *Frame::create( Protocol::MessageType type, const char *pData, size_t dataSize, Protocol::Byte flags )
+{
+	const size_t headers = Protocol::LEGACY_HEADER_SIZE + Protocol::FRAME_HEADER_SIZE;
+	void *pMemory = ::operator new( sizeof(Frame) + headers + dataSize );
+	Frame *pFrame = new (pMemory) Frame( type, dataSize, flags );
+
+	Protocol::encodeHeader( Protocol::PROTOCOL_VERSION_1, type, (uint32_t) dataSize, flags, pFrame->m_pBytes );
+	Protocol::encodeHeader( Protocol::PROTOCOL_VERSION_2, type, (uint32_t) dataSize, flags, pFrame->m_pBytes + Protocol::LEGACY_HEADER_SIZE );
+	if( dataSize > 0 ) memcpy( pFrame->m_pBytes + headers, pData, dataSize );
+
+	return pFrame;
+}
+
+Frame *Frame::create( const Protocol::Message &msg )
+{
+	return create( msg.header.type, msg.data, msg.header.dataSize, msg.header.flags );
+}
+
+/*
+ *	Point vectors at the frame's bytes in the given framing, from offset
+ *	on (offset < size( version )). Returns how many were filled in, at
+ *	most MAX_VECTORS.
+ */
+int Frame::gather( Protocol::Byte version, size_t offset, struct iovec *pVectors ) const
+{
+	const char *pPayload = payload( );
+	size_t size = this->size( version );
+
+	if( version == Protocol::PROTOCOL_VERSION_2 || offset >= Protocol::LEGACY_HEADER_SIZE )
+	{
+		// one piece: the version 2 header (if still unsent) runs into the payload...
+		const char *pStart = pPayload + offset - Protocol::headerSize( version );
+		pVectors[ 0 ].iov_base = const_cast<char *>( pStart );
+		pVectors[ 0 ].iov_len  = size - offset;
+		return 1;
+	}
+
+	pVectors[ 0 ].iov_base = m_pBytes + offset;
+	pVectors[ 0 ].iov_len  = Protocol::LEGACY_HEADER_SIZE - offset;
+	if( m_nDataSize == 0 ) return 1;
+
+	pVectors[ 1 ].iov_base = const_cast<char *>( pPayload );
+	pVectors[ 1 ].iov_len  = m_nDataSize;
+	return 2;
+}
+
+/*
+ *	Give the frame its compressed twin, unless another thread already
+ *	has; returns whichever one it keeps, which it owns. The caller's
+ *	reference to pCompressed is taken over either way.
+ */
+Frame *Frame::attachCompressed( Frame *pCompressed )
+{
+	Frame *pAttached = __sync_val_compare_and_swap( &m_pCompressed, (Frame *) NULL, pCompressed );
+	if( pAttached == NULL ) return pCompressed;
+
+	pCompressed->release( );
+	return pAttached;
+}
+
+void Frame::release( )
+{
+	if( __sync_sub_and_fetch( &m_nReferences, 1 ) == 0 )
+	{
+		this->~Frame( );
+		::operator delete( this );
+	}
+}
+
+}// end of namespace
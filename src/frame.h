@@ -0,0 +1,91 @@
+#ifndef _FRAME_H_
+#define _FRAME_H_
+///////////////////////////////////////////////////////////////////////////////////
+//// Frame.h //////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include "protocol.h"
+
+namespace NetMessaging {
+
+/*
+ *	An immutable message already encoded for the wire: its header in
+ *	network order, in both framings (see Protocol), and the payload, all
+ *	in a single buffer. The version 2 header sits right in front of the
+ *	payload so such a frame goes out as one piece; the legacy header
+ *	sits in front of that and goes out as a piece of its own. A frame
+ *	is reference counted so one encoding can sit in many outbound queues
+ *	at once (e.g. a chatroom broadcast), whatever framing each of those
+ *	clients speaks; it is freed when the last reference is released.
+ *
+ *	A broadcast may also carry a compressed twin, made by the first
+ *	recipient that compresses it and shared by the rest (see
+ *	compressor.h); it goes when the broadcast does.
+ */
+class Frame
+{
+  public:
+	static const int MAX_VECTORS = 2; // filled in by gather( )
+
+	static Frame *create( Protocol::MessageType type, const char *pData, size_t dataSize, Protocol::Byte flags = 0 );
+	static Frame *create( const Protocol::Message &msg );
+
+	void retain( );
+	void release( );
+
+	size_t size( Protocol::Byte version ) const;
+	int gather( Protocol::Byte version, size_t offset, struct iovec *pVectors ) const;
+	const char *payload( ) const;
+	size_t dataSize( ) const;
+	Protocol::MessageType type( ) const;
+	Protocol::Byte flags( ) const;
+
+	void setBroadcast( ); // before it is posted to anybody
+	bool isBroadcast( ) const;
+	Frame *compressed( ) const;
+	Frame *attachCompressed( Frame *pCompressed );
+
+  private:
+	Frame( Protocol::MessageType type, size_t dataSize, Protocol::Byte flags );
+	~Frame( );
+	Frame( const Frame &frame );
+	Frame &operator=( const Frame &frame );
+
+	volatile long m_nReferences;
+	Protocol::MessageType m_Type;
+	Protocol::Byte m_Flags;
+	bool m_bBroadcast;
+	Frame * volatile m_pCompressed; // the broadcast's compressed twin, if made yet
+	size_t m_nDataSize;
+	char *m_pBytes; // legacy header, version 2 header, payload; just past this object, in the same allocation
+};
+
+inline void Frame::retain( )
+{ __sync_add_and_fetch( &m_nReferences, 1 ); }
+
+inline size_t Frame::size( Protocol::Byte version ) const
+{ return Protocol::headerSize( version ) + m_nDataSize; }
+
+inline const char *Frame::payload( ) const
+{ return m_pBytes + Protocol::LEGACY_HEADER_SIZE + Protocol::FRAME_HEADER_SIZE; }
+
+inline size_t Frame::dataSize( ) const
+{ return m_nDataSize; }
+
+inline Protocol::MessageType Frame::type( ) const
+{ return m_Type; }
+
+inline Protocol::Byte Frame::flags( ) const
+{ return m_Flags; }
+
+inline void Frame::setBroadcast( )
+{ m_bBroadcast = true; }
+
+inline bool Frame::isBroadcast( ) const
+{ return m_bBroadcast; }
+
+inline Frame *Frame::compressed( ) const
+{ return __atomic_load_n( &m_pCompressed, __ATOMIC_ACQUIRE ); }
+
+}// end of namespace
+#endif
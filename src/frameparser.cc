@@ -0,0 +1,326 @@
+///////////////////////////////////////////////////////////////////////////////////
+//// FrameParser.cc ///////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include "frameparser.h"
+#include "bufferpool.h"
+#include "fieldtokenizer.h"
+#include "textfilter.h"
+
+#ifdef _PROTOCOL_DEBUG
+#include "engine.h"
+#endif
+
+namespace NetMessaging {
+
+AtomicCounter FrameParser::m_LegacyStreams;
+AtomicCounter FrameParser::m_FrameStreams;
+bool FrameParser::m_bStripControls = false;
+StripedCounter FrameParser::m_ScreenedMessages;
+StripedCounter FrameParser::m_ScreenedBytes;
+AtomicCounter FrameParser::m_RejectedMessages;
+AtomicCounter FrameParser::m_StrippedBytes;
+
+FrameParser::FrameParser( size_t capacity )
+  : m_pRing(NULL), m_nCapacity(capacity), m_nHead(0), m_nTail(0),
+    m_State(READING_HEADER), m_bMalformed(false), m_Version(0), m_nHeaderSize(0), m_nHeaderRead(0),
+    m_pPayload(NULL), m_nPayloadRead(0)
+{
+	assert( capacity > 0 && (capacity & (capacity - 1)) == 0 ); // power of two
+	m_pRing = new char[ m_nCapacity ];
+	memset( &m_Header, 0, sizeof(m_Header) );
+}
+
+FrameParser::~FrameParser( )
+{
+	BufferPool::release( m_pPayload ); // a message that never finished arriving
+	delete [] m_pRing;
+}
+
+/*
+ * 	Read as much as fits into the free part of the ring with a single
+ * 	recvmsg( ). Returns what recvmsg( ) returns; 0 means the peer closed
+ * 	the connection. The ring is never full when this is called because
+ * 	next( ) always consumes everything it can.
+ */
+ssize_t FrameParser::fill( int socket, int flags )
+{
+	size_t freeBytes = m_nCapacity - buffered( );
+	assert( freeBytes > 0 );
+
+	size_t tail = m_nTail & (m_nCapacity - 1);
+	size_t firstPart = std::min( freeBytes, m_nCapacity - tail );
+
+	struct iovec vectors[ 2 ];
+	vectors[ 0 ].iov_base = m_pRing + tail;
+	vectors[ 0 ].iov_len  = firstPart;
+	vectors[ 1 ].iov_base = m_pRing;
+	vectors[ 1 ].iov_len  = freeBytes - firstPart;
+
+	struct msghdr mh;
+	memset( &mh, 0, sizeof(mh) );
+	mh.msg_iov    = vectors;
+	mh.msg_iovlen = vectors[ 1 ].iov_len > 0 ? 2 : 1;
+
+	ssize_t rv = recvmsg( socket, &mh, flags );
+	if( rv > 0 ) m_nTail += rv;
+
+	return rv;
+}
+
+/*
+ * 	Copy bytes that were read elsewhere (e.g. into an io_uring provided
+ * 	buffer) into the free part of the ring. Returns how many fit; call
+ * 	next( ) until it returns false to make room for the rest.
+ */
+size_t FrameParser::append( const char *pData, size_t bytes )
+{
+	bytes = std::min( bytes, m_nCapacity - buffered( ) );
+	if( bytes == 0 ) return 0;
+
+	size_t tail = m_nTail & (m_nCapacity - 1);
+	size_t firstPart = std::min( bytes, m_nCapacity - tail );
+
+	memcpy( m_pRing + tail, pData, firstPart );
+	memcpy( m_pRing, pData + firstPart, bytes - firstPart );
+
+	m_nTail += bytes;
+	return bytes;
+}
+
+/*
+ * 	Advance the state machine over buffered bytes. Returns true when a
+ * 	complete message was produced; its payload must be released with
+ * 	Protocol::freeMessageData( ). Returns false when more bytes are
+ * 	needed or the stream turned out to be malformed.
+ */
+bool FrameParser::next( Protocol::Message &msg )
+{
+	while( !m_bMalformed )
+	{
+		switch( m_State )
+		{
+			case READING_HEADER:
+				if( m_Version == 0 && !detectVersion( ) ) return false;
+
+				m_nHeaderRead += consume( m_HeaderBytes + m_nHeaderRead, m_nHeaderSize - m_nHeaderRead );
+				if( m_nHeaderRead < m_nHeaderSize ) return false;
+				m_nHeaderRead = 0;
+
+				if( !(m_Version == Protocol::PROTOCOL_VERSION_2 ? Protocol::decodeFrameHeader( m_HeaderBytes, m_Header )
+				                                                : Protocol::decodeHeader( m_Version, m_HeaderBytes, m_Header )) )
+				{
+					m_bMalformed = true; // the owner reports and drops the peer
+					return false;
+				}
+
+				grow( m_nHeaderSize + m_Header.dataSize );
+
+				m_pPayload     = m_Header.dataSize > 0 ? BufferPool::allocate( m_Header.dataSize ) : NULL;
+				m_nPayloadRead = 0;
+				m_State        = READING_PAYLOAD;
+				break;
+
+			case READING_PAYLOAD:
+				m_nPayloadRead += consume( m_pPayload + m_nPayloadRead, m_Header.dataSize - m_nPayloadRead );
+				if( m_nPayloadRead < m_Header.dataSize ) return false;
+
+				m_State = READING_HEADER;
+
+				if( !screen( m_Header, m_pPayload ) )
+				{
+					BufferPool::release( m_pPayload );
+					m_pPayload = NULL;
+					break; // on to the next one
+				}
+
+				if( m_Header.dataSize == 0 && m_pPayload != NULL ) // screened down to nothing
+				{
+					BufferPool::release( m_pPayload );
+					m_pPayload = NULL;
+				}
+
+				msg.header = m_Header;
+				msg.data   = m_pPayload;
+				m_pPayload = NULL;
+
+				#ifdef _PROTOCOL_DEBUG
+				const std::string &payloadCopy = Protocol::payloadString( msg.data, msg.header.dataSize );
+				SCS::Engine::onInfo( "Received MSG %.4d %s (size = %d)", msg.header.type, payloadCopy.c_str( ), msg.header.dataSize );
+				#endif
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * 	Settle the stream's framing from its first byte, once there is one.
+ * 	Returns false if there is not, or if it is in neither framing.
+ */
+bool FrameParser::detectVersion( )
+{
+	if( buffered( ) == 0 ) return false;
+
+	m_Version = Protocol::detectVersion( (Protocol::Byte) m_pRing[ m_nHead & (m_nCapacity - 1) ] );
+	if( m_Version == 0 )
+	{
+		m_bMalformed = true;
+		return false;
+	}
+
+	m_nHeaderSize = Protocol::headerSize( m_Version );
+	if( m_Version == Protocol::PROTOCOL_VERSION_2 ) m_FrameStreams.add( );
+	else m_LegacyStreams.add( );
+
+	return true;
+}
+
+/*
+ * 	Check a message that just came in, before it is handed out. Returns
+ * 	false to drop it; the header's dataSize shrinks by whatever was
+ * 	stripped out of the payload.
+ */
+bool FrameParser::screen( Protocol::MessageHeader &header, char *pPayload )
+{
+	if( header.dataSize == 0 || (header.flags & Protocol::FLAG_COMPRESSED) ) return true; // nothing, or not text (yet)
+
+	switch( header.type )
+	{
+		case Protocol::MT_SEND_CHATROOM_MESSAGE:
+			return screenChatMessage( pPayload, header.dataSize );
+		case Protocol::MT_BATCH:
+			return screenBatch( header, pPayload );
+		default:
+			return true;
+	}
+}
+
+/*
+ * 	Screen the chat messages in a batch. A rejected one is cut out of it
+ * 	and the entries after it slide down, as they do after one that had
+ * 	characters stripped; the batch itself is always kept. A truncated
+ * 	last entry is left as it is, for the handler to notice.
+ */
+bool FrameParser::screenBatch( Protocol::MessageHeader &header, char *pPayload )
+{
+	Protocol::Message batch;
+	batch.header = header;
+	batch.data   = pPayload;
+
+	Protocol::Message entry;
+	uint32_t requestId;
+	size_t offset  = 0;
+	size_t written = 0;
+
+	for( size_t start = offset; Protocol::nextBatchEntry( batch, offset, requestId, entry ); start = offset )
+	{
+		uint32_t dataSize = entry.header.dataSize;
+
+		if( entry.header.type == Protocol::MT_SEND_CHATROOM_MESSAGE )
+		{
+			if( !screenChatMessage( entry.data, dataSize ) ) continue;
+
+			if( dataSize != entry.header.dataSize )
+			{
+				Protocol::BatchEntryHeader entryHeader;
+				memcpy( &entryHeader, pPayload + start, sizeof(entryHeader) );
+				entryHeader.dataSize = htonl( dataSize );
+				memcpy( pPayload + start, &entryHeader, sizeof(entryHeader) );
+			}
+		}
+
+		memmove( pPayload + written, pPayload + start, Protocol::BATCH_ENTRY_HEADER_SIZE + dataSize );
+		written += Protocol::BATCH_ENTRY_HEADER_SIZE + dataSize;
+	}
+
+	memmove( pPayload + written, pPayload + offset, header.dataSize - offset );
+	header.dataSize = written + (header.dataSize - offset);
+
+	return true;
+}
+
+/*
+ * 	An MT_SEND_CHATROOM_MESSAGE payload, the room name and then the text,
+ * 	must be UTF-8 all the way through. Returns false to reject it; when
+ * 	stripping, size shrinks by the control characters taken out of the
+ * 	text. Missing fields are left for the handler to deal with.
+ */
+bool FrameParser::screenChatMessage( char *pData, uint32_t &size )
+{
+	m_ScreenedMessages.add( );
+	m_ScreenedBytes.add( size );
+
+	if( !TextFilter::isValidUtf8( pData, size ) )
+	{
+		m_RejectedMessages.add( );
+		#ifdef _PROTOCOL_DEBUG
+		SCS::Engine::onInfo( "Rejected chat message that is not UTF-8 (size = %u)", size );
+		#endif
+		return false;
+	}
+
+	std::string_view chatroomName;
+	std::string_view text;
+	FieldTokenizer fields( pData, size );
+
+	if( !m_bStripControls || !fields.next( chatroomName ) || !fields.next( text ) ) return true;
+
+	char *pText    = pData + (text.data( ) - pData);
+	char *pTextEnd = pText + text.length( );
+	size_t length  = TextFilter::stripControls( pText, text.length( ) );
+
+	if( length < text.length( ) )
+	{
+		memmove( pText + length, pTextEnd, pData + size - pTextEnd ); // the terminator, if any
+		size -= pTextEnd - (pText + length);
+		m_StrippedBytes.add( pTextEnd - (pText + length) );
+	}
+
+	return true;
+}
+
+/*
+ * 	Copy up to bytes out of the ring (handling wrap-around).
+ */
+size_t FrameParser::consume( char *pDestination, size_t bytes )
+{
+	bytes = std::min( bytes, buffered( ) );
+	if( bytes == 0 ) return 0;
+
+	size_t head = m_nHead & (m_nCapacity - 1);
+	size_t firstPart = std::min( bytes, m_nCapacity - head );
+
+	memcpy( pDestination, m_pRing + head, firstPart );
+	memcpy( pDestination + firstPart, m_pRing, bytes - firstPart );
+
+	m_nHead += bytes;
+	return bytes;
+}
+
+/*
+ * 	Make the ring big enough for a whole frame of the given size, up to
+ * 	MAX_CAPACITY, keeping whatever is buffered.
+ */
+void FrameParser::grow( size_t frameSize )
+{
+	if( frameSize <= m_nCapacity || m_nCapacity >= MAX_CAPACITY ) return;
+
+	size_t capacity = m_nCapacity;
+	while( capacity < frameSize && capacity < MAX_CAPACITY ) capacity *= 2;
+
+	char *pRing = new char[ capacity ];
+	size_t bytes = buffered( );
+	consume( pRing, bytes );
+
+	delete [] m_pRing;
+	m_pRing     = pRing;
+	m_nCapacity = capacity;
+	m_nHead     = 0;
+	m_nTail     = bytes;
+}
+
+}// end of namespace
@@ -0,0 +1,145 @@
+#ifndef _FRAMEPARSER_H_
+#define _FRAMEPARSER_H_
+///////////////////////////////////////////////////////////////////////////////////
+//// FrameParser.h ////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include "protocol.h"
+
+namespace NetMessaging {
+
+/*
+ *	Per-connection read buffer and resumable message parser. Bytes are
+ *	read into a ring buffer with as few large recv calls as possible and
+ *	a small state machine carves complete messages out of it. A message
+ *	that is split across reads picks up where it left off, and payloads
+ *	larger than the ring are assembled a piece at a time.
+ *
+ *	The ring starts small, since most clients only ever send short
+ *	messages, and grows (up to MAX_CAPACITY) once a frame arrives that
+ *	does not fit in it, so that clients sending large ones get them in
+ *	fewer reads.
+ *
+ *	The first byte of the stream decides its framing (see Protocol);
+ *	every later header has to be in that same framing.
+ *
+ *	Chat text is screened as each message completes, before it can be
+ *	dispatched: an MT_SEND_CHATROOM_MESSAGE, alone or in a batch, that is
+ *	not UTF-8 is dropped, and with setStripControls( true ) the control
+ *	characters are taken out of its text (see TextFilter).
+ */
+class FrameParser
+{
+  public:
+	static const size_t INITIAL_CAPACITY = 4096;  // must be a power of two
+	static const size_t MAX_CAPACITY     = 65536;
+
+	explicit FrameParser( size_t capacity = INITIAL_CAPACITY );
+	~FrameParser( );
+
+	ssize_t fill( int socket, int flags = 0 );
+	size_t append( const char *pData, size_t bytes );
+	bool next( Protocol::Message &msg );
+
+	bool isMalformed( ) const;
+	Protocol::Byte version( ) const; // 0 until the first byte arrived
+	size_t buffered( ) const;
+	size_t capacity( ) const;
+
+	/*
+	 *	Streams seen in each framing, across every parser.
+	 */
+	static long legacyStreams( );
+	static long frameStreams( );
+
+	static void setStripControls( bool bStrip ); // off by default
+	static bool stripsControls( );
+
+	/*
+	 *	Chat messages screened, across every parser.
+	 */
+	static long screenedMessages( );
+	static long screenedBytes( );
+	static long rejectedMessages( ); // not UTF-8, never delivered
+	static long strippedBytes( );
+
+  protected:
+	enum State {
+		READING_HEADER = 0,
+		READING_PAYLOAD
+	};
+
+	char *m_pRing;
+	size_t m_nCapacity;
+	size_t m_nHead; // read position; free-running, masked on access
+	size_t m_nTail; // write position; free-running, masked on access
+
+	State m_State;
+	bool m_bMalformed;
+	Protocol::Byte m_Version;
+	char m_HeaderBytes[ Protocol::MAX_HEADER_SIZE ];
+	size_t m_nHeaderSize;
+	size_t m_nHeaderRead;
+	Protocol::MessageHeader m_Header;
+	char *m_pPayload;
+	size_t m_nPayloadRead;
+
+	static AtomicCounter m_LegacyStreams;
+	static AtomicCounter m_FrameStreams;
+
+	static bool m_bStripControls;
+	static StripedCounter m_ScreenedMessages;
+	static StripedCounter m_ScreenedBytes;
+	static AtomicCounter m_RejectedMessages;
+	static AtomicCounter m_StrippedBytes;
+
+	size_t consume( char *pDestination, size_t bytes );
+	void grow( size_t frameSize );
+	bool detectVersion( );
+	bool screen( Protocol::MessageHeader &header, char *pPayload );
+	bool screenBatch( Protocol::MessageHeader &header, char *pPayload );
+	bool screenChatMessage( char *pData, uint32_t &size );
+
+  private:
+	FrameParser( const FrameParser &parser );
+	FrameParser &operator=( const FrameParser &parser );
+};
+
+inline bool FrameParser::isMalformed( ) const
+{ return m_bMalformed; }
+
+inline Protocol::Byte FrameParser::version( ) const
+{ return m_Version; }
+
+inline long FrameParser::legacyStreams( )
+{ return m_LegacyStreams.value( ); }
+
+inline long FrameParser::frameStreams( )
+{ return m_FrameStreams.value( ); }
+
+inline void FrameParser::setStripControls( bool bStrip )
+{ m_bStripControls = bStrip; }
+
+inline bool FrameParser::stripsControls( )
+{ return m_bStripControls; }
+
+inline long FrameParser::screenedMessages( )
+{ return m_ScreenedMessages.value( ); }
+
+inline long FrameParser::screenedBytes( )
+{ return m_ScreenedBytes.value( ); }
+
+inline long FrameParser::rejectedMessages( )
+{ return m_RejectedMessages.value( ); }
+
+inline long FrameParser::strippedBytes( )
+{ return m_StrippedBytes.value( ); }
+
+inline size_t FrameParser::buffered( ) const
+{ return m_nTail - m_nHead; }
+
+inline size_t FrameParser::capacity( ) const
+{ return m_nCapacity; }
+
+}// end of namespace
+#endif
@@ -0,0 +1,71 @@
+#include <cassert>
+#include <algorithm>
+#include "mailbox.h"
+
+namespace SCS {
+
+Mailbox::Mailbox( )
+  : m_pHead(NULL)
+{
+}
+
+Mailbox::~Mailbox( )
+{
+	FrameQueue frames;
+	collect( frames );
+
+	for( FrameQueue::iterator itr = frames.begin( ); itr != frames.end( ); ++itr )
+	{
+		(*itr)->release( );
+	}
+}
+
+/*
+ *	Safe from any thread. The mailbox takes its own reference to the
+ *	frame. Returns true if the mailbox was empty, i.e. the owner has to
+ *	be told there is something to collect.
+ */
+bool Mailbox::post( NetMessaging::Frame *pFrame )
+{
+	Node *pNode   = new Node;
+	pNode->pFrame = pFrame;
+	pFrame->retain( );
+
+	Node *pHead;
+	do
+	{
+		pHead        = m_pHead;
+		pNode->pNext = pHead;
+	} while( !__sync_bool_compare_and_swap( &m_pHead, pHead, pNode ) );
+
+	return pHead == NULL;
+}
+
+/*
+ *	Owner only. Appends everything posted so far to frames, oldest
+ *	first, handing over the mailbox's references. Returns the number of
+ *	frames collected.
+ */
+size_t Mailbox::collect( FrameQueue &frames )
+{
+	Node *pNode = __sync_lock_test_and_set( &m_pHead, (Node *) NULL );
+	__sync_synchronize( ); // test-and-set is only an acquire barrier
+
+	size_t first = frames.size( );
+	size_t count = 0;
+
+	while( pNode != NULL )
+	{
+		frames.push_back( pNode->pFrame );
+		count++;
+
+		Node *pNext = pNode->pNext;
+		delete pNode;
+		pNode = pNext;
+	}
+
+	std::reverse( frames.begin( ) + first, frames.end( ) );
+	return count;
+}
+
+} // end of namespace
@@ -0,0 +1,46 @@
+#ifndef _MAILBOX_H_
+#define _MAILBOX_H_
+/*
+ *	mailbox.h
+ *
+ *	Frames posted to a connection by any thread, collected by the one
+ *	thread that owns the connection's socket. Posting is a single
+ *	compare-and-swap onto a linked stack; collecting swaps the whole
+ *	stack out and reverses it, so there is no lock and no ABA problem
+ *	(nodes are only ever removed all at once, by the single consumer).
+ */
+
+#include <deque>
+#include "frame.h"
+
+namespace SCS {
+
+class Mailbox
+{
+  public:
+	typedef std::deque<NetMessaging::Frame *> FrameQueue;
+
+	Mailbox( );
+	~Mailbox( );
+
+	bool post( NetMessaging::Frame *pFrame );
+	size_t collect( FrameQueue &frames );
+	bool isEmpty( ) const;
+
+  private:
+	struct Node {
+		NetMessaging::Frame *pFrame;
+		Node *pNext;
+	};
+
+	Node * volatile m_pHead; // newest first
+
+	Mailbox( const Mailbox &mailbox );
+	Mailbox &operator=( const Mailbox &mailbox );
+};
+
+inline bool Mailbox::isEmpty( ) const
+{ return __atomic_load_n( &m_pHead, __ATOMIC_ACQUIRE ) == NULL; }
+
+} // end of namespace
+#endif
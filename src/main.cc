@@ -33,8 +33,17 @@ bool bVerbose                = false;
 bool bLoggingEnabled         = false;
 unsigned short nPort         = SimpleChatServer::DEFAULT_PORT;
 unsigned int nMaxConnections = 100;
+unsigned int nBacklog        = NetMessaging::Server::DEFAULT_BACKLOG;
 unsigned int nMaxChatrooms   = 100;
 bool bDaemonMode             = false;
+SimpleChatServer::IOModel ioModel = SimpleChatServer::IO_THREAD_PER_CLIENT;
+unsigned int nReactors       = 1;
+unsigned int nWorkers        = 4;
+size_t nStackSize            = 0;
+size_t nQueueLimit           = 1024 * 1024;
+Connection::OverflowPolicy overflowPolicy = Connection::DROP_OLDEST;
+bool bStripControls          = false;
+size_t nCompressThreshold    = 512;
 
 enum DaemonAction {
     START,
@@ -57,8 +66,62 @@ int main( int argc, char *argv[] )
 			nPort = atoi( argv[ ++arg ] );		
 		else if( !strcmp( argv[ arg ], "--max-connections" ) || !strcmp( argv[ arg ], "-m" ) )
 			nMaxConnections = atoi( argv[ ++arg ] );		
+		else if( !strcmp( argv[ arg ], "--backlog" ) || !strcmp( argv[ arg ], "-b" ) )
+			nBacklog = atoi( argv[ ++arg ] );
 		else if( !strcmp( argv[ arg ], "--max-chatrooms" ) || !strcmp( argv[ arg ], "-c" ) )
 			nMaxChatrooms = atoi( argv[ ++arg ] );
+		else if( !strcmp( argv[ arg ], "--io-model" ) || !strcmp( argv[ arg ], "-i" ) )
+		{
+			arg++;
+			if( arg < argc && !strcmp( argv[ arg ], "threads" ) )
+				ioModel = SimpleChatServer::IO_THREAD_PER_CLIENT;
+			else if( arg < argc && !strcmp( argv[ arg ], "epoll" ) )
+				ioModel = SimpleChatServer::IO_EPOLL;
+			else if( arg < argc && !strcmp( argv[ arg ], "pool" ) )
+				ioModel = SimpleChatServer::IO_WORKER_POOL;
+			else if( arg < argc && !strcmp( argv[ arg ], "coro" ) )
+				ioModel = SimpleChatServer::IO_COROUTINES;
+			else if( arg < argc && !strcmp( argv[ arg ], "uring" ) )
+				ioModel = SimpleChatServer::IO_URING;
+			else
+			{
+				cerr << SCS_ERROR_HEADER << argv[ arg - 1 ] << " option expects to be followed by [threads | epoll | pool | coro | uring]" << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if( !strcmp( argv[ arg ], "--reactors" ) || !strcmp( argv[ arg ], "-t" ) )
+		{
+			nReactors = atoi( argv[ ++arg ] );
+			ioModel   = SimpleChatServer::IO_EPOLL;
+		}
+		else if( !strcmp( argv[ arg ], "--workers" ) || !strcmp( argv[ arg ], "-w" ) )
+		{
+			nWorkers = atoi( argv[ ++arg ] );
+			ioModel  = SimpleChatServer::IO_WORKER_POOL;
+		}
+		else if( !strcmp( argv[ arg ], "--stack-size" ) || !strcmp( argv[ arg ], "-s" ) )
+			nStackSize = strtoul( argv[ ++arg ], NULL, 10 ) * 1024;
+		else if( !strcmp( argv[ arg ], "--queue-limit" ) || !strcmp( argv[ arg ], "-q" ) )
+			nQueueLimit = strtoul( argv[ ++arg ], NULL, 10 );
+		else if( !strcmp( argv[ arg ], "--overflow-policy" ) || !strcmp( argv[ arg ], "-o" ) )
+		{
+			arg++;
+			if( arg < argc && !strcmp( argv[ arg ], "drop-oldest" ) )
+				overflowPolicy = Connection::DROP_OLDEST;
+			else if( arg < argc && !strcmp( argv[ arg ], "disconnect" ) )
+				overflowPolicy = Connection::DISCONNECT;
+			else if( arg < argc && !strcmp( argv[ arg ], "coalesce" ) )
+				overflowPolicy = Connection::COALESCE;
+			else
+			{
+				cerr << SCS_ERROR_HEADER << argv[ arg - 1 ] << " option expects to be followed by [drop-oldest | disconnect | coalesce]" << endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if( !strcmp( argv[ arg ], "--strip-controls" ) || !strcmp( argv[ arg ], "-x" ) )
+			bStripControls = true;
+		else if( !strcmp( argv[ arg ], "--compress" ) || !strcmp( argv[ arg ], "-z" ) )
+			nCompressThreshold = strtoul( argv[ ++arg ], NULL, 10 );
 		else if( !strcmp( argv[ arg ], "--daemon" ) || !strcmp( argv[ arg ], "-D" ) )
 		{
 			bDaemonMode = true;
@@ -195,7 +258,16 @@ bool start( )
     eng->setLogging( bLoggingEnabled );
     eng->setPort( nPort );
     eng->setMaxConnections( nMaxConnections );
+    eng->setBacklog( nBacklog );
     eng->setMaxChatrooms( nMaxChatrooms );
+    eng->setIOModel( ioModel );
+    eng->setReactors( nReactors );
+    eng->setWorkers( nWorkers );
+    eng->setStackSize( nStackSize );
+    eng->setQueueLimit( nQueueLimit );
+    eng->setOverflowPolicy( overflowPolicy );
+    eng->setStripControls( bStripControls );
+    eng->setCompressThreshold( nCompressThreshold );
 
 	#ifndef WIN32
     signal( SIGPIPE, engineSignalHandler );	
@@ -287,7 +359,16 @@ void about( const char *progName )
     //cout << setw(2) << "" << setw(25) << left << "-f, --config-file F"				<< setw(40) << "Uses the config file F" << endl;
     cout << setw(2) << "" << setw(25) << left << "-p, --port N"				<< setw(40) << "Sets the port number to N." << endl;
     cout << setw(2) << "" << setw(25) << left << "-m, --max-connections N" 	<< setw(40) << "Sets the maximum concurrent connections to N." << endl;
+    cout << setw(2) << "" << setw(25) << left << "-b, --backlog N" 		<< setw(40) << "Lets N connections wait to be accepted (listen backlog)." << endl;
     cout << setw(2) << "" << setw(25) << left << "-c, --max-chatrooms N" 	<< setw(40) << "Sets the max chatrooms to N." << endl;
+    cout << setw(2) << "" << setw(25) << left << "-i, --io-model MODEL" 	<< setw(40) << "Client handling; MODEL is threads (default), epoll, pool, coro, or uring." << endl;
+    cout << setw(2) << "" << setw(25) << left << "-t, --reactors N" 		<< setw(40) << "Runs N epoll reactor threads, one per CPU (implies -i epoll)." << endl;
+    cout << setw(2) << "" << setw(25) << left << "-w, --workers N" 		<< setw(40) << "Pre-spawns N worker threads that share clients (implies -i pool)." << endl;
+    cout << setw(2) << "" << setw(25) << left << "-s, --stack-size KB" 		<< setw(40) << "Sets the stack size of client and worker threads to KB kilobytes." << endl;
+    cout << setw(2) << "" << setw(25) << left << "-q, --queue-limit N" 		<< setw(40) << "Caps each client's outbound queue at N bytes." << endl;
+    cout << setw(2) << "" << setw(25) << left << "-o, --overflow-policy P" 	<< setw(40) << "On a full queue; P is drop-oldest (default), disconnect, or coalesce." << endl;
+    cout << setw(2) << "" << setw(25) << left << "-x, --strip-controls" 	<< setw(40) << "Strips control characters out of chat messages." << endl;
+    cout << setw(2) << "" << setw(25) << left << "-z, --compress N" 		<< setw(40) << "Compresses messages of N bytes or more (default 512) to clients that ask; 0 turns it off." << endl;
     cout << setw(2) << "" << setw(25) << left << "-v, --verbose"			<< setw(40) << "Turn on extra messages and echo to stdout." << endl;
     cout << setw(2) << "" << setw(25) << left << "-l, --enable-logging" 	<< setw(40) << "Turn on logging; this decreases performance." << endl;
 	#ifndef WIN32
@@ -11,19 +11,31 @@
 #include <algorithm>
 #include <cerrno>
 #include "protocol.h"
+#include "bufferpool.h"
 #ifdef WIN32
 #include <winsock2.h>
 #else
 #include <unistd.h>
+#include <fcntl.h>
 #include <netdb.h> //gethostbyname()
 #endif
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
 #ifdef _PROTOCOL_DEBUG
 #include "engine.h"
 #endif
 
 namespace NetMessaging {
 
+StripedCounter Protocol::m_SendCalls;
+StripedCounter Protocol::m_FramesSent;
+StripedCounter Protocol::m_WaitCalls;
+AtomicCounter Server::m_ConnectionsAccepted;
+AtomicCounter Server::m_AcceptBatches;
+
 
 bool initialize( )
 {
@@ -55,51 +67,115 @@ void deinitialize( )
 
 
 
+PeerAddress::PeerAddress( )
+{
+	memset( &m_Address, 0, sizeof(struct sockaddr_in) );
+	m_Text[ 0 ] = '\0';
+}
+
+PeerAddress::PeerAddress( const struct sockaddr_in &address )
+  : m_Address(address)
+{
+	m_Text[ 0 ] = '\0';
+}
+
+const char *PeerAddress::text( ) const
+{
+	if( !isKnown( ) ) return "Unknown IP";
+
+	if( m_Text[ 0 ] == '\0' && inet_ntop( AF_INET, &m_Address.sin_addr, m_Text, sizeof(m_Text) ) == NULL )
+	{
+		return "Unknown IP";
+	}
+
+	return m_Text;
+}
+
+
 Server::Server( )
-  : m_ServerSocket(-1)
+  : m_ServerSocket(-1), m_Backlog(DEFAULT_BACKLOG), m_bReusePort(false)
 {
 	memset( &m_ServerAddress, 0, sizeof(struct sockaddr_in) );
 }
 
 
-bool Server::startListening( unsigned short _port, unsigned int _maxConnections )
+/*
+ * 	_backlog is the length of the kernel's queue of connections waiting
+ * 	to be accepted, which has nothing to do with how many we serve at
+ * 	once; a reconnect storm needs it long.
+ */
+bool Server::startListening( unsigned short _port, unsigned int _maxConnections, bool _reusePort, unsigned int _backlog )
 {
 	m_Port           = _port;
 	m_MaxConnections = _maxConnections;
+	m_Backlog        = _backlog;
+	m_bReusePort     = _reusePort;
 
     // configure server address... 
     m_ServerAddress.sin_family      = AF_INET;
     m_ServerAddress.sin_port        = htons( m_Port );
     m_ServerAddress.sin_addr.s_addr = htonl( INADDR_ANY );
 
+	m_ServerSocket = openListener( );
+	return m_ServerSocket >= 0;
+}
+
+/*
+ * 	Opens another socket listening on the same address and port. Only
+ * 	possible when startListening( ) was asked to use SO_REUSEPORT; the
+ * 	kernel then spreads incoming connections across all the listeners.
+ */
+int Server::addListener( )
+{
+	assert( m_ServerSocket >= 0 ); // need to call startListening() first!
+	assert( m_bReusePort );
+	return openListener( );
+}
+
+int Server::openListener( )
+{
+	int listener;
+
     // create a socket...
-    if( (m_ServerSocket = socket( PF_INET, SOCK_STREAM, IPPROTO_TCP ) ) < 0 )
+    if( (listener = socket( PF_INET, SOCK_STREAM, IPPROTO_TCP ) ) < 0 )
     {
 		#ifdef _PROTOCOL_DEBUG
 		SCS::Engine::onError( "Could not create server socket." );
 		#endif
-		return false;
+		return -1;
     }
 
-    if( bind( m_ServerSocket, (const struct sockaddr *) &m_ServerAddress, sizeof(struct sockaddr_in) ) < 0 )
+	#ifdef SO_REUSEPORT
+	int on = 1;
+	if( m_bReusePort && setsockopt( listener, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on) ) < 0 )
+	{
+		close( listener );
+		#ifdef _PROTOCOL_DEBUG
+		SCS::Engine::onError( "Could not enable SO_REUSEPORT on server socket." );
+		#endif
+		return -1;
+	}
+	#endif
+
+    if( bind( listener, (const struct sockaddr *) &m_ServerAddress, sizeof(struct sockaddr_in) ) < 0 )
     {
-		close( m_ServerSocket );
+		close( listener );
 		#ifdef _PROTOCOL_DEBUG
 		SCS::Engine::onError( "Could not bind socket to address %s and m_Port %u.", inet_ntoa(m_ServerAddress.sin_addr), m_Port );
 		#endif
-		return false;
+		return -1;
     }
 
-	if( listen( m_ServerSocket, m_MaxConnections ) < 0 ) // instruct to listen on this socket...
+	if( listen( listener, m_Backlog ) < 0 ) // instruct to listen on this socket...
 	{
-		close( m_ServerSocket );
+		close( listener );
 		#ifdef _PROTOCOL_DEBUG
 		SCS::Engine::onError( "Could not listen on socket." );
 		#endif
-		return false;
+		return -1;
 	}
 	
-	return true;
+	return listener;
 }
 
 void Server::stopListening( )
@@ -110,9 +186,18 @@ void Server::stopListening( )
 int Server::acceptConnection( )
 {
 	assert( m_ServerSocket >= 0 ); // need to call startListening() first!
+	return acceptConnection( m_ServerSocket );
+}
+
+/*
+ * 	flags are accept4( )'s: SOCK_NONBLOCK and/or SOCK_CLOEXEC.
+ */
+int Server::acceptConnection( int listeningSocket, int flags )
+{
+	assert( listeningSocket >= 0 );
 	struct sockaddr_in clientAddress;
 	socklen_t addressSize = sizeof( struct sockaddr_in );
-	int clientSocket = accept( m_ServerSocket, (struct sockaddr *) &clientAddress, &addressSize );
+	int clientSocket = accept4( listeningSocket, (struct sockaddr *) &clientAddress, &addressSize, flags );
 
     /*
    struct timeval timeOut;
@@ -126,43 +211,95 @@ int Server::acceptConnection( )
 	if( clientSocket < 0 )
 	{
 		#ifdef _PROTOCOL_DEBUG
-		SCS::Engine::onError( "Could not accept connection." );
+		if( errno != EAGAIN && errno != EWOULDBLOCK ) // nothing pending on a non-blocking listener
+			SCS::Engine::onError( "Could not accept connection." );
 		#endif
+		return -1;
 	}
 
-	#ifdef _PROTOCOL_DEBUG
-    SCS::Engine::onInfo( "Connection established with client %s (client socket = %d).", inet_ntoa( clientAddress.sin_addr ), clientSocket );
-	#endif
-
+	m_ConnectionsAccepted.add( );
 	return clientSocket;
 }
 
-void Server::disconnectPeer( int peerSocket )
+/*
+ * 	Accept up to maxPeers pending connections from a non-blocking
+ * 	listener into pPeers without logging each one. Returns how many
+ * 	were accepted; fewer than maxPeers means the backlog was drained
+ * 	(or accepting failed, e.g. out of descriptors).
+ */
+int Server::acceptConnections( int listeningSocket, Peer *pPeers, int maxPeers, int flags )
+{
+	assert( listeningSocket >= 0 );
+	int count = 0;
+
+	while( count < maxPeers )
+	{
+		struct sockaddr_in clientAddress;
+		socklen_t addressSize = sizeof( struct sockaddr_in );
+		int clientSocket = accept4( listeningSocket, (struct sockaddr *) &clientAddress, &addressSize, flags );
+
+		if( clientSocket < 0 )
+		{
+			if( errno == EINTR || errno == ECONNABORTED ) continue; // that one is gone, there may be more
+
+			#ifdef _PROTOCOL_DEBUG
+			if( errno != EAGAIN && errno != EWOULDBLOCK )
+				SCS::Engine::onError( "Could not accept connection; errno = %d", errno );
+			#endif
+			break;
+		}
+
+		pPeers[ count ].socket  = clientSocket;
+		pPeers[ count ].address = PeerAddress( clientAddress );
+		count++;
+	}
+
+	if( count > 0 ) countAcceptBatch( count );
+	return count;
+}
+
+/*
+ * 	address is the peer's, if known, for the log.
+ */
+void Server::disconnectPeer( int peerSocket, const PeerAddress &address )
 {
 	assert( peerSocket >= 0 );
-	struct sockaddr_in clientAddress;
-	socklen_t addressSize = sizeof( struct sockaddr_in );
-	getpeername( peerSocket, (struct sockaddr *) &clientAddress, &addressSize );
 
 	#ifdef _PROTOCOL_DEBUG
-	SCS::Engine::onInfo( "Closing connection with %s.", inet_ntoa( clientAddress.sin_addr ) );
+	SCS::Engine::onInfo( "Closing connection with %s.", address.text( ) );
 	#endif
 
 	close( peerSocket );	// close the connection		
 }
 
-const char *Server::peerAddress( int peerSocket )
+/*
+ * 	Asks the kernel; for sockets accepted without their address.
+ */
+PeerAddress Server::peerAddress( int peerSocket )
 {
     struct sockaddr_in clientAddress;
     socklen_t clientAddressSize = sizeof( struct sockaddr_in );
 
-    // save ip address of remote user...
     if( getpeername( peerSocket, (struct sockaddr *) &clientAddress, &clientAddressSize ) == 0 ) // on success
 	{
-		return inet_ntoa( clientAddress.sin_addr );
+		return PeerAddress( clientAddress );
 	}
 
-	return NULL;
+	return PeerAddress( );
+}
+
+bool Server::setNonBlocking( int socket, bool on )
+{
+	#ifdef WIN32
+	u_long mode = on ? 1 : 0;
+	return ioctlsocket( socket, FIONBIO, &mode ) == 0;
+	#else
+	int flags = fcntl( socket, F_GETFL, 0 );
+	if( flags < 0 ) return false;
+
+	flags = on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	return fcntl( socket, F_SETFL, flags ) == 0;
+	#endif
 }
 
 
@@ -175,106 +312,14 @@ void Protocol::initializeMessage( Message &msg, MessageType type /*= 0*/, size_t
     msg.header.marker = PROTOCOL_MARKER;
     msg.header.type = type;
     msg.header.dataSize = dataSize;
+    msg.header.version = 0;
+    msg.header.flags = 0;
     msg.data = const_cast<char *>( pData );
 }
 
-bool Protocol::sendServerMessage( int clientSocket, MessageType type, const std::string &message )
-{
-    Message msg;
-    initializeMessage( msg, type, message.length( ) + 1 /* plus 1 for '\0'*/, const_cast<char *>( &message[ 0 ] ) );
-
-    if( !sendMessage( clientSocket, msg ) )
-		return false;
-
-    return true;
-}
-
-bool Protocol::sendErrorMessage( int clientSocket, const std::string &error )
-{
-    Message errMsg;
-    initializeMessage( errMsg, MT_NOTIFY_ERROR, error.length( ) + 1 /* plus 1 for '\0'*/, const_cast<char *>( &error[ 0 ] ) );
-
-    if( !sendMessage( clientSocket, errMsg ) )
-		return false;
-
-    return true;
-}
-
-Protocol::Result Protocol::receiveMessage( int clientSocket, Message &msg )
-{
-    if( _receiveMessage( clientSocket, msg ) == false ) // on failure, handle it...
-    {
-		#ifdef _PROTOCOL_DEBUG
-		SCS::Engine::onError( "receivedMessage(): errno = %d", errno );
-		#endif
-
-		#ifdef _PROTOCOL_SIMULATE_LATENCY
-		sleep( 1 );
-		#endif
-
-		switch( errno )
-		{
-			case EINTR: // interrupted by signal...
-			case EAGAIN: // EWOULDBLOCK
-				return TRYAGAIN;
-			case ENOTSOCK: // client socket is not a socket.
-			case ENOTCONN: // not connected yet.
-			case EINVAL: // invalid argument passed.
-			case EFAULT: // the receive buffer is outside process's address space
-			case EBADF:  // bad socket/file descriptor
-				assert( false ); // these are programming errors
-			case ECONNREFUSED:
-			default:
-				return FAILED;
-		}
-    }
-
-	#ifdef _PROTOCOL_SIMULATE_LATENCY
-	sleep( 1 );
-	#endif
-
-    return SUCCESS;
-}
-
-Protocol::Result Protocol::sendMessage( int clientSocket, const Message &msg )
-{
-    // the const_cast here is needed because the data has to be encoded to
-    // network Byte order (but the data is not changed).
-    if( _sendMessage( clientSocket, const_cast<Message &>(msg) ) == false ) // on failure, handle it...
-    {
-		#ifdef _PROTOCOL_SIMULATE_LATENCY
-		sleep( 1 );
-		#endif
-
-		switch( errno )
-		{
-			case EINTR: // interrupted by signal...
-			case EAGAIN: // EWOULDBLOCK
-				return TRYAGAIN;
-			case ENOTSOCK: // client socket is not a socket.
-			case ENOTCONN: // not connected yet.
-			case EINVAL: // invalid argument passed.
-			case EFAULT: // an argument is outside process's address space
-			case EBADF:  // bad socket/file descriptor
-			case EOPNOTSUPP: // some socket flag is inappropriate for this socket type.
-				assert( false ); // these are programming errors
-			case ECONNRESET: // connection reset by peer
-			case ENOMEM: // no memory available
-			default:
-				return FAILED;
-		}
-    }
-
-
-	#ifdef _PROTOCOL_SIMULATE_LATENCY
-	sleep( 1 );
-	#endif
-
-    return SUCCESS;
-}
-
 /*
- * 	Free allocated memory from receiveMessage( )
+ * 	Free the payload of a message that FrameParser::next( ) handed out;
+ * 	the buffer goes back to the calling thread's pool.
  */
 void Protocol::freeMessageData( Message &m )
 {
@@ -284,158 +329,112 @@ void Protocol::freeMessageData( Message &m )
 		const std::string &dbg = payloadString( m.data, m.header.dataSize );
 		SCS::Engine::onInfo( "Freeing message; type = %.4x, payload = %s (size = %d).", m.header.type, dbg.c_str( ), m.header.dataSize );
 		#endif
-		delete [] m.data;
+		BufferPool::release( m.data );
     }
 }
 
-std::string Protocol::payloadString( const char *data, size_t size )
+/*
+ * 	Write a header in network order to wire in the given framing; flags
+ * 	do not exist in the legacy one. Returns the header's size.
+ */
+size_t Protocol::encodeHeader( Byte version, MessageType type, uint32_t dataSize, Byte flags, char *wire )
 {
-    std::string payloadCopy(size + 2, '[' );
-    std::replace_copy( data, data + size, payloadCopy.begin( ) + 1, '\0', '&' ); // Replace NULL bytes for string printing.
-    payloadCopy[ size + 1 ] = ']';
-    return payloadCopy;		
-}
+	if( version == PROTOCOL_VERSION_2 )
+	{
+		uint32_t words[ 2 ];
+		words[ 0 ] = htonl( ((uint32_t) PROTOCOL_VERSION_2 << 24) | ((uint32_t) flags << 16) | (uint16_t) type );
+		words[ 1 ] = htonl( dataSize );
+		memcpy( wire, words, sizeof(words) );
+		return FRAME_HEADER_SIZE;
+	}
 
+	LegacyHeader header;
+	header.marker   = htons( PROTOCOL_MARKER );
+	header.type     = htons( type );
+	header.dataSize = htonl( dataSize );
+	header.padding  = 0;
+	memcpy( wire, &header, sizeof(LegacyHeader) );
+	return LEGACY_HEADER_SIZE;
+}
 
-bool Protocol::_receiveMessage( int clientSocket, Message &msg )
+/*
+ * 	Decode a header that arrived off the wire into host order. Returns
+ * 	false if it is not a header in that framing, or if it announces a
+ * 	payload larger than MAX_DATA_SIZE.
+ */
+bool Protocol::decodeHeader( Byte version, const char *wire, MessageHeader &header )
 {
-    unsigned int rBytes = 0;
-    int rv = 0;
-    char *pHeader = (char *) &msg.header;
-
-    // receive the message header...
-    for( rBytes = 0, rv = 0; rBytes < sizeof(MessageHeader); rBytes += rv )
-    {
-		if( (rv = recv( clientSocket, pHeader + rBytes, sizeof(MessageHeader) - rBytes, 0 ) ) < 0 )
-		{				
-			//if( errno == EINTR || errno == EAGAIN ) continue;
-			
-			#ifdef _PROTOCOL_DEBUG
-			SCS::Engine::onError( "Receive message header error." );
-			#endif
-
-			return false;
-		}
-		else if( rv == 0 )
-		{
-			return false; // connection closed by peer
-		}
-    }
+	if( version == PROTOCOL_VERSION_2 ) return decodeFrameHeader( wire, header );
 
-    // convert to message header to host order...
-	assert( sizeof(msg.header.marker) == sizeof(short) ); // ensure use of ntohs()
-    msg.header.marker = ntohs( msg.header.marker );
-	assert( sizeof(msg.header.type) == sizeof(short) ); // ensure use of ntohs()
-    msg.header.type = ntohs( msg.header.type );
-    msg.header.dataSize = ntohl( msg.header.dataSize );
+	LegacyHeader legacy;
+	memcpy( &legacy, wire, sizeof(LegacyHeader) );
+	header.marker   = ntohs( legacy.marker );
+	header.type     = ntohs( legacy.type );
+	header.dataSize = ntohl( legacy.dataSize );
+	header.version  = PROTOCOL_VERSION_1;
+	header.flags    = 0;
 
-    if( !isMessage( msg ) )
-    {
-		#ifdef _PROTOCOL_DEBUG
-		SCS::Engine::onError( "Marker mismatch error on received message; message ignored and connection with peer will be dropped. " );
-		#endif
-		return false;
-    }
-
-    if( msg.header.dataSize > 0 )
-    {
-		// allocate memory for data...
-		msg.data = new char[ msg.header.dataSize ];
-
-		// receive the data...
-		for( rBytes = 0, rv = 0; rBytes < (unsigned) msg.header.dataSize; rBytes += rv )
-		{
-			if( (rv = recv( clientSocket, msg.data + rBytes, msg.header.dataSize - rBytes, 0 ) ) < 0 )
-			{
-				//if( errno == EINTR || errno == EAGAIN ) continue;
-				
-				#ifdef _PROTOCOL_DEBUG
-				SCS::Engine::onError( "Received message data error." );
-				#endif
-
-				delete [] msg.data;
-				return false;
-			}
-			else if( rv == 0 )
-			{
-				delete [] msg.data;
-				return false; // connection closed by peer
-			}
-		}
-    }
-
-    #ifdef _PROTOCOL_DEBUG
-    const std::string &payloadCopy = payloadString( msg.data, msg.header.dataSize );
-    SCS::Engine::onInfo( "Received MSG %.4d %s (size = %d)", msg.header.type, payloadCopy.c_str( ), msg.header.dataSize );
-    #endif
-    return true;
+	return header.marker == PROTOCOL_MARKER && legacy.padding == 0 && header.dataSize <= MAX_DATA_SIZE;
 }
 
-bool Protocol::_sendMessage( int clientSocket, Message &msg )
+/*
+ * 	Pack one message onto the end of a batch payload.
+ */
+void Protocol::appendBatchEntry( std::string &payload, uint32_t requestId, MessageType type, const char *pData, uint32_t dataSize )
 {
-    assert( isMessage( msg ) == true );
-    assert( msg.header.type != 0 );
-    assert( msg.header.dataSize >= 0 );
-    int dataSize = msg.header.dataSize;
-
-    #ifdef _PROTOCOL_DEBUG
-    const std::string &payloadCopy = payloadString( msg.data, msg.header.dataSize );
-    SCS::Engine::onInfo( "Sending MSG %.4d %s (size = %d)", msg.header.type, payloadCopy.c_str( ), msg.header.dataSize );
-    #endif
-
-    // convert to message header to network order...
-	assert( sizeof(msg.header.marker) == sizeof(short) ); // ensure use of htons()
-    msg.header.marker = htons( PROTOCOL_MARKER );
-	assert( sizeof(msg.header.type) == sizeof(short) ); // ensure use of htons()
-    msg.header.type = htons( msg.header.type );
-    msg.header.dataSize = htonl( msg.header.dataSize );
-
-    int count = 0;
-    int size = sizeof( MessageHeader );
-
-    // send the header...
-    while( size > 0 )
-    {
-		int sentBytes = send( clientSocket, reinterpret_cast<char *>(&msg.header + count), size, 0 );
+	BatchEntryHeader entryHeader;
+	entryHeader.requestId = htonl( requestId );
+	entryHeader.type      = htons( type );
+	entryHeader.dataSize  = htonl( dataSize );
 
-		if( sentBytes <= 0 )
-		{
-			//if( errno == EINTR || errno == EAGAIN ) continue;
-			
-			#ifdef _PROTOCOL_DEBUG
-			SCS::Engine::onError( "Sending message header error." );
-			#endif
-
-			return false;
-		}
+	payload.append( reinterpret_cast<const char *>( &entryHeader ), sizeof(BatchEntryHeader) );
+	if( dataSize > 0 ) payload.append( pData, dataSize );
+}
 
-		size -= sentBytes;
-		count += sentBytes;
-    }
+/*
+ * 	Unpack the batch entry at offset and move offset past it. The entry's
+ * 	data points into the batch, which keeps ownership of it. Returns false
+ * 	at the end of the batch, and also when the entry runs past it; tell
+ * 	the two apart by offset, which only reaches the end in the first case.
+ */
+bool Protocol::nextBatchEntry( const Message &batch, size_t &offset, uint32_t &requestId, Message &entry )
+{
+	if( batch.header.dataSize - offset < BATCH_ENTRY_HEADER_SIZE ) return false;
 
-    count = 0;
+	BatchEntryHeader entryHeader;
+	memcpy( &entryHeader, batch.data + offset, sizeof(BatchEntryHeader) );
+	uint32_t dataSize = ntohl( entryHeader.dataSize );
 
-    while( dataSize > 0 )
-    {
-		// send the data...
-		int sentBytes = send( clientSocket, msg.data + count, dataSize, 0 );
+	if( batch.header.dataSize - offset - BATCH_ENTRY_HEADER_SIZE < dataSize ) return false;
 
-		if( sentBytes <= 0 )
-		{
-			//if( errno == EINTR || errno == EAGAIN ) continue;
+	requestId = ntohl( entryHeader.requestId );
+	initializeMessage( entry, ntohs( entryHeader.type ), dataSize, dataSize > 0 ? batch.data + offset + BATCH_ENTRY_HEADER_SIZE : NULL );
+	entry.header.version = batch.header.version;
 
-			#ifdef _PROTOCOL_DEBUG
-			SCS::Engine::onError( "Sending message data error." );
-			#endif
+	offset += BATCH_ENTRY_HEADER_SIZE + dataSize;
+	return true;
+}
 
-			return false;
-		}
+std::string Protocol::payloadString( const char *data, size_t size )
+{
+    std::string payloadCopy(size + 2, '[' );
+    std::replace_copy( data, data + size, payloadCopy.begin( ) + 1, '\0', '&' ); // Replace NULL bytes for string printing.
+    payloadCopy[ size + 1 ] = ']';
+    return payloadCopy;		
+}
 
-		dataSize -= sentBytes;
-		count += sentBytes;
-    }
+/*
+ * 	One sendmsg( ) for a batch of buffers. Returns what sendmsg( ) does.
+ */
+ssize_t Protocol::sendVectors( int clientSocket, struct iovec *pVectors, int vectorCount, int flags )
+{
+	struct msghdr mh;
+	memset( &mh, 0, sizeof(mh) );
+	mh.msg_iov    = pVectors;
+	mh.msg_iovlen = vectorCount;
 
-    return true;
+	m_SendCalls.add( );
+	return sendmsg( clientSocket, &mh, flags | MSG_NOSIGNAL );
 }
 
 // TO DO REWRITE THIS! gethostbyname() is obsolete.
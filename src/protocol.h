@@ -7,14 +7,18 @@
 //// joe@manvscode.com ////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////
 #include <cassert>
+#include <cstring>
 #include <string>
+#include <stdint.h>
 #ifdef WIN32
 #include <winsock2.h>
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #endif
+#include "synchronize.h"
 
 namespace NetMessaging {
 
@@ -27,6 +31,35 @@ typedef int socklen_t;
 #define close closesocket
 #endif
 
+/*
+ * 	A peer's IPv4 address, kept as accept( ) reported it and only turned
+ * 	into text the first time text( ) is asked for, into the object
+ * 	itself. Copies carry the text along; formatting is not locked, so
+ * 	share an object between threads only once it has been formatted (or
+ * 	under a lock).
+ */
+class PeerAddress
+{
+  public:
+	PeerAddress( );
+	explicit PeerAddress( const struct sockaddr_in &address );
+
+	bool isKnown( ) const;
+	const struct sockaddr_in &address( ) const;
+	const char *text( ) const;
+
+  protected:
+	struct sockaddr_in m_Address;
+	mutable char m_Text[ INET_ADDRSTRLEN ]; // empty until formatted
+};
+
+inline bool PeerAddress::isKnown( ) const
+{ return m_Address.sin_family == AF_INET; }
+
+inline const struct sockaddr_in &PeerAddress::address( ) const
+{ return m_Address; }
+
+
 class Server
 {
   protected:
@@ -34,26 +67,52 @@ class Server
     struct sockaddr_in m_ServerAddress;
 	unsigned short m_Port;
 	unsigned int m_MaxConnections;
+	unsigned int m_Backlog;
+	bool m_bReusePort;
+
+	int openListener( );
 
   public:
 	static const short DEFAULT_PORT          = 7575;
 	static const int DEFAULT_MAX_CONNECTIONS = 50;
+	static const int DEFAULT_BACKLOG         = SOMAXCONN;
+
+	/*
+	 * 	An accepted socket and who is on the other end.
+	 */
+	struct Peer {
+		int socket;
+		PeerAddress address;
+	};
 
 	Server( );
 
-	bool startListening( unsigned short _port = DEFAULT_PORT, unsigned int _maxConnections = DEFAULT_MAX_CONNECTIONS );
+	bool startListening( unsigned short _port = DEFAULT_PORT, unsigned int _maxConnections = DEFAULT_MAX_CONNECTIONS, bool _reusePort = false,
+	                     unsigned int _backlog = DEFAULT_BACKLOG );
 	void stopListening( );
+	int addListener( );
 	int acceptConnection( );
+	int acceptConnection( int listeningSocket, int flags = 0 );
+	int acceptConnections( int listeningSocket, Peer *pPeers, int maxPeers, int flags = SOCK_NONBLOCK | SOCK_CLOEXEC );
 
-	void disconnectPeer( int peerSocket );
+	void disconnectPeer( int peerSocket, const PeerAddress &address = PeerAddress( ) );
 
-	static const char *peerAddress( int peerSocket );
+	static PeerAddress peerAddress( int peerSocket );
+	static bool setNonBlocking( int socket, bool on = true );
 
 	int serverSocket( ) const;
 	unsigned short port( ) const;
 	const char *address( ) const;
 	unsigned int maxConnections( ) const;
+	unsigned int backlog( ) const;
 
+	static long connectionsAccepted( );
+	static long acceptBatches( );
+	static void countAcceptBatch( int count );
+
+  protected:
+	static AtomicCounter m_ConnectionsAccepted;
+	static AtomicCounter m_AcceptBatches;
 };
 
 inline int Server::serverSocket( ) const
@@ -80,6 +139,27 @@ inline unsigned int Server::maxConnections( ) const
 	return m_MaxConnections;
 }
 
+inline unsigned int Server::backlog( ) const
+{ 
+	assert( m_ServerSocket >= 0 ); 
+	return m_Backlog;
+}
+
+inline long Server::connectionsAccepted( )
+{ return m_ConnectionsAccepted.value( ); }
+
+inline long Server::acceptBatches( )
+{ return m_AcceptBatches.value( ); }
+
+/*
+ * 	For connections accepted on our behalf (io_uring).
+ */
+inline void Server::countAcceptBatch( int count )
+{
+	m_ConnectionsAccepted.add( count );
+	m_AcceptBatches.add( );
+}
+
 
 class Protocol
 {
@@ -108,7 +188,7 @@ class Protocol
 	//                  Type                           Code         [ args (from) ]  where 'from' is either server or client //	
 	///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     static const MessageType MT_NO_MESSAGE                 = 0x00000000;
-    static const MessageType MT_USER_ENTER                 = 0x00000001;  // user name (client)
+    static const MessageType MT_USER_ENTER                 = 0x00000001;  // user name and optionally "deflate" (client), "deflate" or nothing (server)
     static const MessageType MT_USER_LEAVE                 = 0x00000002;  // NIL (client)
     static const MessageType MT_CHATROOM_LIST              = 0x00000003;  // NIL (client), list of chatrooms (server)
     static const MessageType MT_USER_LIST                  = 0x00000004;  // chatroom name (client), list of username@ip (server)
@@ -120,37 +200,135 @@ class Protocol
     static const MessageType MT_NOTIFY_ERROR               = 0x0000000A;  // error message (server)
     static const MessageType MT_NOTIFY_USER_JOINED         = 0x0000000B;  // Chatroom Username IP (server)
     static const MessageType MT_NOTIFY_USER_LEFT           = 0x0000000C;  // Chatroom Username@IP (server)
+    static const MessageType MT_BATCH                      = 0x0000000D;  // batch entries (client), batch entries of replies (server)
 
 
     /*
      * 	Message Definition
      *
      *	This section defines the structure of
-     *	protocol messages.
+     *	protocol messages, as handed around in
+     *	memory (host order, whatever framing
+     *	they arrived in).
      */
-    #pragma pack(push, 1) // align to 2 bytes
     typedef struct tagMessageHeader {
 		Marker marker; // = 0xFFEF;
 		MessageType type;
-		size_t dataSize;
+		uint32_t dataSize;
+		Byte version; // framing it arrived in; 0 for messages built here
+		Byte flags;   // FLAG_* bits
     } MessageHeader;
 
     typedef struct tagMessage {
 		MessageHeader header;
 		char *data; // avoids endian problems
     } Message;
+
+    /*
+     * 	Wire Framing
+     *
+     *	Version 1 is the legacy framing the GTK and PHP clients speak: the
+     *	old MessageHeader struct as 64-bit hosts laid it out, a marker, the
+     *	type and a length that was only ever 32 bits wide followed by the
+     *	4 zero bytes that padded it to a size_t. Version 2 is fixed-width
+     *	and carries a version byte and flags instead of the marker.
+     *
+     *	Which one a client speaks is decided by the first byte it sends: a
+     *	legacy header starts with the marker's 0xFF, a version 2 header
+     *	with its version. The server answers in the same framing for the
+     *	rest of the connection.
+     */
+    static const Byte PROTOCOL_VERSION_1 = 1;
+    static const Byte PROTOCOL_VERSION_2 = 2;
+
+    static const Byte FLAG_COMPRESSED = 0x01; // the payload is compressed
+    static const Byte FLAG_BATCH      = 0x02; // the payload packs several messages
+    static const Byte KNOWN_FLAGS     = FLAG_COMPRESSED | FLAG_BATCH;
+
+    #pragma pack(push, 1)
+    typedef struct tagLegacyHeader {
+		uint16_t marker;   // PROTOCOL_MARKER
+		uint16_t type;
+		uint32_t dataSize;
+		uint32_t padding;  // always 0
+    } LegacyHeader;
+
+    typedef struct tagFrameHeader {
+		Byte version;      // PROTOCOL_VERSION_2
+		Byte flags;
+		uint16_t type;
+		uint32_t dataSize;
+    } FrameHeader;
     #pragma pack(pop)
 
+    static const size_t LEGACY_HEADER_SIZE = sizeof(LegacyHeader); // 12 bytes
+    static const size_t FRAME_HEADER_SIZE  = sizeof(FrameHeader);  // 8 bytes
+    static const size_t MAX_HEADER_SIZE    = LEGACY_HEADER_SIZE;
+    static const uint32_t MAX_DATA_SIZE    = 1024 * 1024; // larger payloads are refused before anything is allocated for them
+
+    /*
+     * 	Batches
+     *
+     *	An MT_BATCH payload packs any number of messages, each one a batch
+     *	entry header in network order followed by its data. The client
+     *	numbers its entries as it likes; the server answers with one
+     *	MT_BATCH of the replies they caused, each under the request ID of
+     *	the entry it answers. Entries that cause no reply have none in it.
+     *	On the version 2 wire batches carry FLAG_BATCH as well.
+     */
+    #pragma pack(push, 1)
+    typedef struct tagBatchEntryHeader {
+		uint32_t requestId;
+		uint16_t type;
+		uint32_t dataSize;
+    } BatchEntryHeader;
+    #pragma pack(pop)
+
+    static const size_t BATCH_ENTRY_HEADER_SIZE = sizeof(BatchEntryHeader); // 10 bytes
+
+    /*
+     * 	Compression
+     *
+     *	A version 2 client may ask for what the server sends it to be
+     *	compressed by adding "deflate" after its name in MT_USER_ENTER.
+     *	It is answered with an MT_USER_ENTER of "deflate" if it got it, or
+     *	an empty one if not; clients that do not ask get no answer. From
+     *	then on any frame may come with FLAG_COMPRESSED set: its payload is
+     *	the next piece of one raw deflate stream (RFC 1951, a window of up
+     *	to 32 KB) ending in a sync flush, and inflates to what the frame
+     *	would otherwise have carried. Frames without the flag are not part
+     *	of the stream. What clients send is never compressed.
+     */
+
     static void initializeMessage( Message &msg, MessageType type = 0, size_t dataSize = 0, const char *pData = NULL );
     static bool isMessage( const Message &msg );
-    static bool sendServerMessage( int clientSocket, MessageType type, const std::string &message );
-    static bool sendErrorMessage( int clientSocket, const std::string &error );
     static void freeMessageData( Message &m );
-    static Result receiveMessage( int clientSocket, Message &msg );
-    static Result sendMessage( int clientSocket, const Message &msg );  
+    static size_t headerSize( Byte version );
+    static Byte detectVersion( Byte firstByte );
+    static size_t encodeHeader( Byte version, MessageType type, uint32_t dataSize, Byte flags, char *wire );
+    static bool decodeHeader( Byte version, const char *wire, MessageHeader &header );
+    static bool decodeFrameHeader( const char *wire, MessageHeader &header );
+    static void appendBatchEntry( std::string &payload, uint32_t requestId, MessageType type, const char *pData, uint32_t dataSize );
+    static bool nextBatchEntry( const Message &batch, size_t &offset, uint32_t &requestId, Message &entry );
     static std::string payloadString( const char *data, size_t size );
 	static bool resolveName( const char *pName, unsigned long *address );
 
+    static ssize_t sendVectors( int clientSocket, struct iovec *pVectors, int vectorCount, int flags = 0 );
+
+    /*
+     * 	Send path statistics: sendmsg( ) calls made and frames completed.
+     */
+    static void countFramesSent( long frames );
+    static long sendCalls( );
+    static long framesSent( );
+
+    /*
+     * 	Event loop statistics: epoll_wait( ), poll( ) and io_uring_enter( )
+     * 	calls made by whichever IO model is running.
+     */
+    static void countWaitCall( );
+    static long waitCalls( );
+
     static bool isBigEndian( );
     static void swap2Bytes( Byte *&mem );
     static void swapEvery2Bytes( Byte *&mem, size_t size );
@@ -159,9 +337,6 @@ class Protocol
   //////////////////// PRIVATE IMPLEMENTATION DETAILS ///////////////////
   ///////////////////////////////////////////////////////////////////////
   private:
-    static bool _receiveMessage( int clientSocket, Message &msg ); // no error handling...
-    static bool _sendMessage( int clientSocket, Message &msg ); // no error handling...
-
     union ShortAndBytes {
 		unsigned short s;
 		Byte bytes[2];
@@ -169,12 +344,66 @@ class Protocol
 
     static void hton( void *mem, size_t size );
     static void ntoh( void *mem, size_t size );
+
+    static StripedCounter m_SendCalls;
+    static StripedCounter m_FramesSent;
+    static StripedCounter m_WaitCalls;
 };
 
 
+inline void Protocol::countFramesSent( long frames )
+{ m_FramesSent.add( frames ); }
+
+inline long Protocol::sendCalls( )
+{ return m_SendCalls.value( ); }
+
+inline long Protocol::framesSent( )
+{ return m_FramesSent.value( ); }
+
+inline void Protocol::countWaitCall( )
+{ m_WaitCalls.add( ); }
+
+inline long Protocol::waitCalls( )
+{ return m_WaitCalls.value( ); }
+
+
 inline bool Protocol::isMessage( const Message &msg )
 { return msg.header.marker == PROTOCOL_MARKER; }
 
+inline size_t Protocol::headerSize( Byte version )
+{ return version == PROTOCOL_VERSION_2 ? FRAME_HEADER_SIZE : LEGACY_HEADER_SIZE; }
+
+/*
+ * 	The framing a stream that starts with firstByte is in, or 0 if it is
+ * 	in neither.
+ */
+inline Protocol::Byte Protocol::detectVersion( Byte firstByte )
+{
+	if( firstByte == (Byte) ((PROTOCOL_MARKER >> 8) & 0xFF) ) return PROTOCOL_VERSION_1;
+	if( firstByte == PROTOCOL_VERSION_2 ) return PROTOCOL_VERSION_2;
+	return 0;
+}
+
+/*
+ * 	The version 2 fast path: two 32-bit loads and some shifts, no
+ * 	marker to check. Returns false on flags this build does not know
+ * 	or a payload larger than MAX_DATA_SIZE.
+ */
+inline bool Protocol::decodeFrameHeader( const char *wire, MessageHeader &header )
+{
+	uint32_t words[ 2 ];
+	memcpy( words, wire, sizeof(words) );
+
+	uint32_t first  = ntohl( words[ 0 ] );
+	header.marker   = PROTOCOL_MARKER;
+	header.version  = (Byte) (first >> 24);
+	header.flags    = (Byte) (first >> 16);
+	header.type     = (MessageType) (first & 0xFFFF);
+	header.dataSize = ntohl( words[ 1 ] );
+
+	return header.version == PROTOCOL_VERSION_2 && (header.flags & ~KNOWN_FLAGS) == 0 && header.dataSize <= MAX_DATA_SIZE;
+}
+
 #ifdef BIG_ENDIAN
 inline void Protocol::hton( void *mem, size_t size ){} // Already in network-order; no implementation by intention.
 inline void Protocol::ntoh( void *mem, size_t size ){} // Already in network-order; no implementation by intention.
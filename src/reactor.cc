@@ -0,0 +1,210 @@
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include "reactor.h"
+#include "simplechatserver.h"
+#include "engine.h"
+
+namespace SCS {
+
+Reactor::Reactor( SimpleChatServer *pServer, int listeningSocket, int cpu )
+  : m_pServer(pServer), m_ListeningSocket(listeningSocket), m_EpollSocket(-1), m_nCpu(cpu)
+{
+	assert( m_pServer != NULL );
+}
+
+Reactor::~Reactor( )
+{
+	if( m_EpollSocket >= 0 ) close( m_EpollSocket );
+}
+
+/*
+ *	Thread entry point for additional reactors.
+ */
+void *Reactor::run( void *pReactor )
+{
+	Reactor *pSelf = static_cast<Reactor *>( pReactor );
+	assert( pSelf != NULL );
+
+	if( !pSelf->run( ) )
+	{
+		Engine::onError( "Reactor on CPU %d stopped.", pSelf->m_nCpu );
+	}
+
+	delete pSelf;
+	return NULL;
+}
+
+bool Reactor::run( )
+{
+	if( m_nCpu >= 0 )
+	{
+		cpu_set_t cpus;
+		CPU_ZERO( &cpus );
+		CPU_SET( m_nCpu, &cpus );
+
+		if( pthread_setaffinity_np( pthread_self( ), sizeof(cpu_set_t), &cpus ) != 0 )
+		{
+			Engine::onError( "Could not pin reactor to CPU %d.", m_nCpu );
+		}
+	}
+
+	if( (m_EpollSocket = epoll_create1( EPOLL_CLOEXEC )) < 0 )
+	{
+		Engine::onError( "Could not create epoll instance; errno = %d", errno );
+		return false;
+	}
+
+	if( !NetMessaging::Server::setNonBlocking( m_ListeningSocket ) )
+	{
+		Engine::onError( "Could not make the listening socket non-blocking." );
+		return false;
+	}
+
+	// The listener is level-triggered so a backlog that is left behind
+	// (e.g. when the connection limit is hit) is reported again.
+	struct epoll_event event;
+	memset( &event, 0, sizeof(event) );
+	event.events   = EPOLLIN;
+	event.data.ptr = NULL;
+
+	if( epoll_ctl( m_EpollSocket, EPOLL_CTL_ADD, m_ListeningSocket, &event ) < 0 )
+	{
+		Engine::onError( "Could not register the listening socket with epoll; errno = %d", errno );
+		return false;
+	}
+
+	Engine::onInfo( "Serving clients from an epoll event loop (listener = %d, CPU = %d).", m_ListeningSocket, m_nCpu );
+
+	struct epoll_event events[ MAX_EVENTS ];
+
+	while( true )
+	{
+		int count = epoll_wait( m_EpollSocket, events, MAX_EVENTS, m_Unfinished.empty( ) ? -1 : 0 );
+		NetMessaging::Protocol::countWaitCall( );
+
+		if( count < 0 )
+		{
+			if( errno == EINTR ) continue;
+			Engine::onError( "epoll_wait( ) failed; errno = %d", errno );
+			return false;
+		}
+
+		for( int i = 0; i < count; i++ )
+		{
+			if( events[ i ].data.ptr == NULL )
+			{
+				acceptClients( );
+			}
+			else
+			{
+				bool bWakeup;
+				Connection *pConnection = Connection::fromEvent( events[ i ].data, &bWakeup );
+				if( pConnection->isRetired( ) ) continue;
+
+				if( bWakeup ) pConnection->clearWakeup( );
+
+				if( (bWakeup || (events[ i ].events & EPOLLOUT)) && pConnection->flush( ) == NetMessaging::Protocol::FAILED )
+				{
+					closeConnection( pConnection );
+					continue;
+				}
+
+				if( !bWakeup && (events[ i ].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) )
+				{
+					handleReadable( pConnection );
+				}
+			}
+		}
+
+		// then another turn for clients that had more to read...
+		std::vector<Connection *> unfinished;
+		unfinished.swap( m_Unfinished );
+		std::sort( unfinished.begin( ), unfinished.end( ) );
+		unfinished.erase( std::unique( unfinished.begin( ), unfinished.end( ) ), unfinished.end( ) );
+
+		for( size_t i = 0; i < unfinished.size( ); i++ )
+		{
+			if( !unfinished[ i ]->isRetired( ) ) handleReadable( unfinished[ i ] );
+		}
+
+		for( size_t i = 0; i < m_Closed.size( ); i++ )
+		{
+			delete m_Closed[ i ];
+		}
+		m_Closed.clear( );
+	}
+
+	return true;
+}
+
+/*
+ *	Take the whole backlog, already non-blocking, before setting up any
+ *	of it.
+ */
+void Reactor::acceptClients( )
+{
+	m_pServer->acceptConnections( m_ListeningSocket, m_Admitted );
+
+	for( size_t i = 0; i < m_Admitted.size( ); i++ )
+	{
+		int clientSocket = m_Admitted[ i ].socket;
+
+		Connection *pConnection = new Connection( clientSocket, m_Admitted[ i ].address );
+		m_pServer->registerConnection( pConnection );
+
+		if( !pConnection->watch( m_EpollSocket ) )
+		{
+			Engine::onError( "Client socket = %d, could not register with epoll; errno = %d", clientSocket, errno );
+			m_pServer->handleDisconnect( clientSocket );
+			delete pConnection;
+		}
+	}
+	m_Admitted.clear( );
+}
+
+/*
+ *	Replies posted while handling the messages are written by the
+ *	flush( ) right after, without a wakeup. A client that still has
+ *	input after READ_BUDGET reads goes to the back of the line: the
+ *	messages it sent can only reach clients on this reactor once we get
+ *	back to their events.
+ */
+void Reactor::handleReadable( Connection *pConnection )
+{
+	pConnection->beginBatch( );
+
+	NetMessaging::Protocol::Result result = m_pServer->receiveMessages( pConnection, READ_BUDGET );
+
+	if( result == NetMessaging::Protocol::FAILED || pConnection->flush( ) == NetMessaging::Protocol::FAILED )
+	{
+		closeConnection( pConnection );
+	}
+	else if( result == NetMessaging::Protocol::SUCCESS )
+	{
+		m_Unfinished.push_back( pConnection );
+	}
+}
+
+void Reactor::closeConnection( Connection *pConnection )
+{
+	int clientSocket = pConnection->socket( );
+	pConnection->retire( );
+	pConnection->unwatch( m_EpollSocket );
+
+	// remove user from all chatrooms...
+	NetMessaging::Protocol::Message message;
+	NetMessaging::Protocol::initializeMessage( message );
+	m_pServer->handleUserLeave( clientSocket, message );
+	m_pServer->handleDisconnect( clientSocket );
+
+	// the current batch may hold another event for it...
+	m_Closed.push_back( pConnection );
+}
+
+} // end of namespace
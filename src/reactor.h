@@ -0,0 +1,50 @@
+#ifndef _REACTOR_H_
+#define _REACTOR_H_
+/*
+ *	reactor.h
+ *
+ *	Edge-triggered epoll event loop. Each reactor runs on one thread and
+ *	owns its listening socket and every client socket accepted from it;
+ *	received messages are dispatched to SimpleChatServer::handleMessage( )
+ *	without a thread per client.
+ */
+
+#include <vector>
+#include "connection.h"
+
+namespace SCS {
+
+class SimpleChatServer;
+
+class Reactor
+{
+  public:
+	Reactor( SimpleChatServer *pServer, int listeningSocket, int cpu = -1 );
+	virtual ~Reactor( );
+
+	bool run( );
+	static void *run( void *pReactor );
+
+  protected:
+	static const int MAX_EVENTS  = 256;
+	static const int READ_BUDGET = 4; // reads per client before the others get a turn
+
+	void acceptClients( );
+	void handleReadable( Connection *pConnection );
+	void closeConnection( Connection *pConnection );
+
+	SimpleChatServer *m_pServer;
+	int m_ListeningSocket;
+	int m_EpollSocket;
+	int m_nCpu; // CPU to pin the reactor thread to, or -1
+	std::vector<Connection *> m_Unfinished; // ran out of budget with input left over
+	std::vector<Connection *> m_Closed;     // deleted once the current batch of events is done
+	std::vector<NetMessaging::Server::Peer> m_Admitted; // accepted in the current round
+
+  private:
+	Reactor( const Reactor &reactor );
+	Reactor &operator=( const Reactor &reactor );
+};
+
+} // end of namespace
+#endif
@@ -0,0 +1,243 @@
+///////////////////////////////////////////////////////////////////////////////////
+//// Ring.cc //////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#include "ring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "protocol.h"
+
+namespace NetMessaging {
+
+Ring::Ring( )
+  : m_RingSocket(-1),
+    m_pSqRing(MAP_FAILED), m_nSqRingSize(0), m_pSqHead(NULL), m_pSqTail(NULL),
+    m_nSqMask(0), m_nSqEntries(0), m_nSqPrepared(0), m_nSqSubmitted(0),
+    m_pSqes((struct io_uring_sqe *) MAP_FAILED), m_nSqesSize(0),
+    m_pCqRing(MAP_FAILED), m_nCqRingSize(0), m_pCqHead(NULL), m_pCqTail(NULL),
+    m_nCqMask(0), m_pCqes(NULL),
+    m_pBufferRing((struct io_uring_buf_ring *) MAP_FAILED), m_nBufferRingSize(0),
+    m_pBuffers(NULL), m_nBufferCount(0), m_nBufferSize(0), m_nBufferTail(0), m_BufferGroup(0)
+{
+	memset( m_Supported, 0, sizeof(m_Supported) );
+}
+
+Ring::~Ring( )
+{
+	if( m_pSqes != MAP_FAILED ) munmap( m_pSqes, m_nSqesSize );
+	if( m_pCqRing != MAP_FAILED && m_pCqRing != m_pSqRing ) munmap( m_pCqRing, m_nCqRingSize );
+	if( m_pSqRing != MAP_FAILED ) munmap( m_pSqRing, m_nSqRingSize );
+	if( m_RingSocket >= 0 ) close( m_RingSocket ); // unregisters the buffers too
+
+	if( m_pBufferRing != MAP_FAILED ) munmap( m_pBufferRing, m_nBufferRingSize );
+	delete [] m_pBuffers;
+}
+
+/*
+ *	Create the ring and map its queues. Returns false, with errno set,
+ *	if the kernel has no io_uring (ENOSYS) or it is disabled (EPERM).
+ */
+bool Ring::setup( unsigned int entries )
+{
+	struct io_uring_params params;
+	memset( &params, 0, sizeof(params) );
+
+	// room for every multishot completion a busy batch produces...
+	params.flags      = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+	params.cq_entries = entries * 4;
+
+	m_RingSocket = syscall( __NR_io_uring_setup, entries, &params );
+
+	if( m_RingSocket < 0 && errno == EINVAL ) // a kernel from before 5.18
+	{
+		memset( &params, 0, sizeof(params) );
+		params.flags      = IORING_SETUP_CQSIZE;
+		params.cq_entries = entries * 4;
+
+		m_RingSocket = syscall( __NR_io_uring_setup, entries, &params );
+	}
+
+	if( m_RingSocket < 0 ) return false;
+
+	m_nSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	m_nCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	if( params.features & IORING_FEAT_SINGLE_MMAP )
+	{
+		if( m_nCqRingSize > m_nSqRingSize ) m_nSqRingSize = m_nCqRingSize;
+		m_nCqRingSize = m_nSqRingSize;
+	}
+
+	m_pSqRing = mmap( NULL, m_nSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingSocket, IORING_OFF_SQ_RING );
+	if( m_pSqRing == MAP_FAILED ) return false;
+
+	if( params.features & IORING_FEAT_SINGLE_MMAP )
+	{
+		m_pCqRing = m_pSqRing;
+	}
+	else
+	{
+		m_pCqRing = mmap( NULL, m_nCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingSocket, IORING_OFF_CQ_RING );
+		if( m_pCqRing == MAP_FAILED ) return false;
+	}
+
+	m_nSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	m_pSqes = (struct io_uring_sqe *) mmap( NULL, m_nSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingSocket, IORING_OFF_SQES );
+	if( m_pSqes == MAP_FAILED ) return false;
+
+	char *pSq = static_cast<char *>( m_pSqRing );
+	m_pSqHead    = (unsigned int *) (pSq + params.sq_off.head);
+	m_pSqTail    = (unsigned int *) (pSq + params.sq_off.tail);
+	m_nSqMask    = *(unsigned int *) (pSq + params.sq_off.ring_mask);
+	m_nSqEntries = params.sq_entries;
+	m_nSqPrepared = m_nSqSubmitted = *m_pSqTail;
+
+	// submission queue entry i always lives in slot i...
+	unsigned int *pArray = (unsigned int *) (pSq + params.sq_off.array);
+	for( unsigned int i = 0; i < m_nSqEntries; i++ ) pArray[ i ] = i;
+
+	char *pCq = static_cast<char *>( m_pCqRing );
+	m_pCqHead = (unsigned int *) (pCq + params.cq_off.head);
+	m_pCqTail = (unsigned int *) (pCq + params.cq_off.tail);
+	m_nCqMask = *(unsigned int *) (pCq + params.cq_off.ring_mask);
+	m_pCqes   = (struct io_uring_cqe *) (pCq + params.cq_off.cqes);
+
+	probe( );
+	return true;
+}
+
+void Ring::probe( )
+{
+	const unsigned int OPS = 256;
+	struct io_uring_probe *pProbe = (struct io_uring_probe *) calloc( 1, sizeof(struct io_uring_probe) + OPS * sizeof(struct io_uring_probe_op) );
+	if( pProbe == NULL ) return;
+
+	if( syscall( __NR_io_uring_register, m_RingSocket, IORING_REGISTER_PROBE, pProbe, OPS ) == 0 )
+	{
+		for( unsigned int i = 0; i < pProbe->ops_len && i < OPS; i++ )
+		{
+			if( pProbe->ops[ i ].flags & IO_URING_OP_SUPPORTED )
+			{
+				m_Supported[ pProbe->ops[ i ].op / 8 ] |= 1 << (pProbe->ops[ i ].op % 8);
+			}
+		}
+	}
+
+	free( pProbe );
+}
+
+/*
+ *	Register count buffers of size bytes (count a power of two) as
+ *	buffer group group and hand them all to the kernel. Needs 5.19.
+ */
+bool Ring::setupBuffers( unsigned short group, unsigned int count, unsigned int size )
+{
+	m_nBufferRingSize = count * sizeof(struct io_uring_buf);
+	m_pBufferRing = (struct io_uring_buf_ring *) mmap( NULL, m_nBufferRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+	if( m_pBufferRing == MAP_FAILED ) return false;
+
+	struct io_uring_buf_reg registration;
+	memset( &registration, 0, sizeof(registration) );
+	registration.ring_addr    = (uint64_t) (uintptr_t) m_pBufferRing;
+	registration.ring_entries = count;
+	registration.bgid         = group;
+
+	if( syscall( __NR_io_uring_register, m_RingSocket, IORING_REGISTER_PBUF_RING, &registration, 1 ) < 0 ) return false;
+
+	m_pBuffers     = new char[ (size_t) count * size ];
+	m_nBufferCount = count;
+	m_nBufferSize  = size;
+	m_BufferGroup  = group;
+
+	for( unsigned int i = 0; i < count; i++ ) recycle( (unsigned short) i );
+	return true;
+}
+
+/*
+ *	Give a buffer reported by a completion back to the kernel.
+ */
+void Ring::recycle( unsigned short id )
+{
+	// not m_pBufferRing->bufs: compiled as C++, __DECLARE_FLEX_ARRAY
+	// puts a padded empty struct in front of it...
+	struct io_uring_buf *pBuffer = reinterpret_cast<struct io_uring_buf *>( m_pBufferRing ) + (m_nBufferTail & (m_nBufferCount - 1));
+	pBuffer->addr = (uint64_t) (uintptr_t) buffer( id );
+	pBuffer->len  = m_nBufferSize;
+	pBuffer->bid  = id;
+
+	m_nBufferTail++;
+	__atomic_store_n( &m_pBufferRing->tail, m_nBufferTail, __ATOMIC_RELEASE );
+}
+
+/*
+ *	Make sure the next entries requests fit into the submission queue,
+ *	submitting what is there if need be; a chain of linked requests must
+ *	not be split across two submissions.
+ */
+bool Ring::reserve( unsigned int entries )
+{
+	if( m_nSqPrepared - __atomic_load_n( m_pSqHead, __ATOMIC_ACQUIRE ) + entries <= m_nSqEntries ) return true;
+
+	submitAndWait( 0 );
+	return m_nSqPrepared - __atomic_load_n( m_pSqHead, __ATOMIC_ACQUIRE ) + entries <= m_nSqEntries;
+}
+
+/*
+ *	A cleared submission queue entry for the given request, or NULL if
+ *	the queue is full and the kernel would not take any of it.
+ */
+struct io_uring_sqe *Ring::prepare( unsigned char opcode, int fd, uint64_t userData )
+{
+	if( !reserve( 1 ) ) return NULL;
+
+	struct io_uring_sqe *pSqe = &m_pSqes[ m_nSqPrepared & m_nSqMask ];
+	memset( pSqe, 0, sizeof(*pSqe) );
+	pSqe->opcode    = opcode;
+	pSqe->fd        = fd;
+	pSqe->user_data = userData;
+
+	m_nSqPrepared++;
+	return pSqe;
+}
+
+/*
+ *	Submit everything prepared and, if waitFor > 0, wait until at least
+ *	that many completions are ready. Returns what io_uring_enter( ) does.
+ */
+int Ring::submitAndWait( unsigned int waitFor )
+{
+	unsigned int pending = m_nSqPrepared - m_nSqSubmitted;
+	if( pending == 0 && waitFor == 0 ) return 0;
+
+	__atomic_store_n( m_pSqTail, m_nSqPrepared, __ATOMIC_RELEASE );
+
+	int rv = syscall( __NR_io_uring_enter, m_RingSocket, pending, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0 );
+	Protocol::countWaitCall( );
+
+	if( rv > 0 ) m_nSqSubmitted += rv;
+	return rv;
+}
+
+/*
+ *	The oldest completion not yet advance( )d past, or NULL.
+ */
+struct io_uring_cqe *Ring::peek( )
+{
+	unsigned int head = *m_pCqHead;
+	if( head == __atomic_load_n( m_pCqTail, __ATOMIC_ACQUIRE ) ) return NULL;
+
+	return &m_pCqes[ head & m_nCqMask ];
+}
+
+void Ring::advance( )
+{
+	__atomic_store_n( m_pCqHead, *m_pCqHead + 1, __ATOMIC_RELEASE );
+}
+
+}// end of namespace
+#endif
@@ -0,0 +1,98 @@
+#ifndef _RING_H_
+#define _RING_H_
+///////////////////////////////////////////////////////////////////////////////////
+//// Ring.h ///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <cstddef>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+namespace NetMessaging {
+
+/*
+ *	A bare io_uring instance driven through the raw system calls, for one
+ *	thread. Requests are prepared in the submission queue with prepare( )
+ *	and handed to the kernel, together with waiting for completions, by a
+ *	single io_uring_enter( ) in submitAndWait( ), which is counted as a
+ *	Protocol::countWaitCall( ). Completions are read with peek( ) and
+ *	advance( ).
+ *
+ *	The ring can also own a group of provided buffers that multishot
+ *	receives pick from (IOSQE_BUFFER_SELECT); a buffer reported in a
+ *	completion belongs to us until it is recycle( )d.
+ */
+class Ring
+{
+  public:
+	Ring( );
+	~Ring( );
+
+	bool setup( unsigned int entries );
+	bool supports( unsigned char opcode ) const;
+	bool setupBuffers( unsigned short group, unsigned int count, unsigned int size );
+
+	char *buffer( unsigned short id ) const;
+	void recycle( unsigned short id );
+
+	bool reserve( unsigned int entries );
+	struct io_uring_sqe *prepare( unsigned char opcode, int fd, uint64_t userData );
+	int submitAndWait( unsigned int waitFor );
+
+	struct io_uring_cqe *peek( );
+	void advance( );
+
+  protected:
+	int m_RingSocket;
+
+	// submission queue...
+	void *m_pSqRing;
+	size_t m_nSqRingSize;
+	unsigned int *m_pSqHead;
+	unsigned int *m_pSqTail;
+	unsigned int m_nSqMask;
+	unsigned int m_nSqEntries;
+	unsigned int m_nSqPrepared; // our tail; published by submitAndWait( )
+	unsigned int m_nSqSubmitted;
+	struct io_uring_sqe *m_pSqes;
+	size_t m_nSqesSize;
+
+	// completion queue...
+	void *m_pCqRing;
+	size_t m_nCqRingSize;
+	unsigned int *m_pCqHead;
+	unsigned int *m_pCqTail;
+	unsigned int m_nCqMask;
+	struct io_uring_cqe *m_pCqes;
+
+	unsigned char m_Supported[ 256 / 8 ]; // opcodes the kernel knows, one bit each
+
+	// provided buffers...
+	struct io_uring_buf_ring *m_pBufferRing;
+	size_t m_nBufferRingSize;
+	char *m_pBuffers;
+	unsigned int m_nBufferCount;
+	unsigned int m_nBufferSize;
+	unsigned short m_nBufferTail;
+	unsigned short m_BufferGroup;
+
+	void probe( );
+
+  private:
+	Ring( const Ring &ring );
+	Ring &operator=( const Ring &ring );
+};
+
+inline bool Ring::supports( unsigned char opcode ) const
+{ return (m_Supported[ opcode / 8 ] & (1 << (opcode % 8))) != 0; }
+
+inline char *Ring::buffer( unsigned short id ) const
+{ return m_pBuffers + (size_t) id * m_nBufferSize; }
+
+}// end of namespace
+#endif
+#endif
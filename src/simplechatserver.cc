@@ -1,14 +1,26 @@
 #include <cassert>
 #include <cerrno>
+#include <climits>
 #include <cstdarg>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include <csignal>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
 using namespace std;
 #include "simplechatserver.h"
 #include "engine.h"
 #include "protocol.h"
+#include "reactor.h"
+#include "workerpool.h"
+#include "coroutineloop.h"
+#include "uringloop.h"
+#include "bufferpool.h"
+#include "fieldtokenizer.h"
+#include "textfilter.h"
 
 namespace SCS {
 
@@ -29,6 +41,8 @@ SimpleChatServer::SimpleChatServer( )
   m_nMaxChatrooms(0), 
   m_nMaxUsersPerChatroom(0),
   m_nNumberOfConnections(0),
+  m_nReactors(1),
+  m_nStackSize(0),
   m_bVerbose(false)
 {
 }
@@ -38,62 +52,250 @@ SimpleChatServer::~SimpleChatServer( )
 }
 
 
-bool SimpleChatServer::initialize( unsigned int maxChatrooms, unsigned int maxUsersPerChatroom, unsigned short port, unsigned int maxConnectionsAllowed )
+bool SimpleChatServer::initialize( unsigned int maxChatrooms, unsigned int maxUsersPerChatroom, unsigned short port, unsigned int maxConnectionsAllowed,
+                                   unsigned int reactors, unsigned int backlog )
 {
 	if( !NetMessaging::initialize( ) ) return false;
     m_nMaxChatrooms               = maxChatrooms;
+    m_nReactors                   = reactors > 0 ? reactors : 1;
 
-	if( !startListening( port, maxConnectionsAllowed ) )
+	// every reactor gets its own SO_REUSEPORT listener...
+	if( !startListening( port, maxConnectionsAllowed, m_nReactors > 1, backlog ) )
 	{
 		return false;
 	}
 
 	Engine::onInfo( "Using address %s and port %u.", address( ), this->port( ) );
 	Engine::onInfo( "Max Connections Allowed: %d", maxConnections( ) );	
+	Engine::onInfo( "Listen Backlog: %u", this->backlog( ) );
     Engine::onInfo( "Max Chatrooms Allowed: %d", m_nMaxChatrooms );
 
+	Engine::onInfo( "Field splitter: %s. Text filter: %s, UTF-8 validation%s.",
+	                NetMessaging::FieldTokenizer::name( NetMessaging::FieldTokenizer::implementation( ) ),
+	                NetMessaging::TextFilter::name( NetMessaging::TextFilter::implementation( ) ),
+	                NetMessaging::FrameParser::stripsControls( ) ? " and control character stripping" : " only" );
+
     return true;
 }
 
 bool SimpleChatServer::deinitialize( )
 {
+	for( size_t i = 0; i < m_Listeners.size( ); i++ )
+	{
+		close( m_Listeners[ i ] );
+	}
+	m_Listeners.clear( );
+
 	stopListening( );
 	NetMessaging::deinitialize( );
     return true;
 }
 
-int SimpleChatServer::acceptConnection( )
+/*
+ *	Drain listeningSocket's backlog, ACCEPT_BATCH sockets per round, and
+ *	append the sockets admitted under the connection limit to admitted;
+ *	the caller then sets them all up in one go. Sockets are accepted
+ *	with flags (accept4( )'s), non-blocking and close-on-exec by default.
+ */
+void SimpleChatServer::acceptConnections( int listeningSocket, std::vector<Peer> &admitted, int flags )
 {
-	int clientSocket = Server::acceptConnection( );
+	Peer peers[ ACCEPT_BATCH ];
+	int count;
 
-    if( m_nNumberOfConnections >= maxConnections( ) )
-    {		
-		close( clientSocket );
-		Engine::onInfo( "Max connection limit reached! Connection will be refused." );
-		return -1;
-    }
+	do
+	{
+		count = Server::acceptConnections( listeningSocket, peers, ACCEPT_BATCH, flags );
+		size_t kept = admitConnections( peers, count );
+		admitted.insert( admitted.end( ), peers, peers + kept );
+	} while( count == ACCEPT_BATCH );
+}
+
+/*
+ *	Count a batch of freshly accepted sockets against the connection
+ *	limit under one lock and close the ones over it. The admitted ones
+ *	are the first of pPeers; returns how many there are.
+ */
+size_t SimpleChatServer::admitConnections( Peer *pPeers, size_t count )
+{
+	if( count == 0 ) return 0;
 
 	generalLock.lock( );
-    	m_nNumberOfConnections++;
+		unsigned int room = m_nNumberOfConnections < maxConnections( ) ? maxConnections( ) - m_nNumberOfConnections : 0;
+		size_t admitted = count < room ? count : room;
+		m_nNumberOfConnections += admitted;
 	generalLock.unlock( );
 
+    if( admitted < count )
+    {		
+		for( size_t i = admitted; i < count; i++ ) close( pPeers[ i ].socket );
+		m_ConnectionsRefused.add( count - admitted );
+		Engine::onInfo( "Max connection limit reached! %u connection(s) refused.", (unsigned int) (count - admitted) );
+    }
+
+    return admitted;
+}
+
+/*
+ *	Serve every client from its own thread; the calling thread waits for
+ *	the listener to become readable and then takes the whole backlog at
+ *	once. Client sockets stay blocking. Only returns if accepting fails.
+ */
+bool SimpleChatServer::runThreadPerClient( )
+{
+	int listener = serverSocket( );
+
+	if( !setNonBlocking( listener ) )
+	{
+		Engine::onError( "Could not make the listening socket non-blocking." );
+		return false;
+	}
+
+	std::vector<Peer> admitted;
+	admitted.reserve( ACCEPT_BATCH );
+
+	while( true )
+	{
+		struct pollfd pfd;
+		pfd.fd      = listener;
+		pfd.events  = POLLIN;
+		pfd.revents = 0;
+
+		int rv = poll( &pfd, 1, -1 );
+		NetMessaging::Protocol::countWaitCall( );
+
+		if( rv < 0 )
+		{
+			if( errno == EINTR ) continue;
+			Engine::onError( "poll( ) on the listening socket failed; errno = %d", errno );
+			return false;
+		}
+
+		acceptConnections( listener, admitted, SOCK_CLOEXEC );
+
+		for( size_t i = 0; i < admitted.size( ); i++ )
+		{
+			handleClient( admitted[ i ] );
+		}
+		admitted.clear( );
+	}
 
-    return clientSocket;
+	return true;
 }
 
-void SimpleChatServer::handleClient( int clientSocket )
+void SimpleChatServer::handleClient( const Peer &peer )
 {
+    int clientSocket = peer.socket;
     pthread_t threadID;
     ThreadArgs *args = new ThreadArgs;
     args->clientSocket = clientSocket;
+    args->pConnection  = new Connection( clientSocket, peer.address );
+    registerConnection( args->pConnection );
 
-    if( pthread_create( &threadID, NULL, SimpleChatServer::handleClient, args ) != 0 )
+    pthread_attr_t attributes;
+    pthread_attr_init( &attributes );
+    pthread_attr_setdetachstate( &attributes, PTHREAD_CREATE_DETACHED ); // nobody joins client threads
+    if( m_nStackSize > 0 )
+    {
+		pthread_attr_setstacksize( &attributes, m_nStackSize < (size_t) PTHREAD_STACK_MIN ? (size_t) PTHREAD_STACK_MIN : m_nStackSize );
+    }
+
+    int rv = pthread_create( &threadID, &attributes, SimpleChatServer::handleClient, args );
+    pthread_attr_destroy( &attributes );
+
+    if( rv != 0 )
     {
 		Engine::onError( "Failed to create thread to handle client." );
+		handleDisconnect( clientSocket );
+		delete args->pConnection;
+		delete args;
 		return;
     }
 }
 
+void SimpleChatServer::setThreadStackSize( size_t bytes )
+{
+	m_nStackSize = bytes;
+}
+
+/*
+ *	Serve every client from epoll event loops instead of spawning a
+ *	thread per connection. The calling thread runs the first reactor;
+ *	any additional reactors get their own thread and SO_REUSEPORT
+ *	listener so the kernel spreads accepts across them. Reactor i is
+ *	pinned to CPU i (modulo the number of online CPUs). Only returns
+ *	if an event loop could not be set up.
+ */
+bool SimpleChatServer::runEventLoop( )
+{
+	long nCpus = sysconf( _SC_NPROCESSORS_ONLN );
+	if( nCpus < 1 ) nCpus = 1;
+
+	for( unsigned int i = 1; i < m_nReactors; i++ )
+	{
+		int listener = addListener( );
+		if( listener < 0 )
+		{
+			Engine::onError( "Could not open a listener for reactor %u.", i );
+			return false;
+		}
+		m_Listeners.push_back( listener );
+
+		Reactor *pReactor = new Reactor( this, listener, i % nCpus );
+		pthread_t threadID;
+
+		if( pthread_create( &threadID, NULL, Reactor::run, pReactor ) != 0 )
+		{
+			Engine::onError( "Failed to create thread for reactor %u.", i );
+			delete pReactor;
+			return false;
+		}
+		pthread_detach( threadID );
+	}
+
+	Reactor reactor( this, serverSocket( ), m_nReactors > 1 ? 0 : -1 );
+	return reactor.run( );
+}
+
+/*
+ *	Serve every client from a coroutine on one epoll event loop run by
+ *	the calling thread. Only returns if the loop could not be set up.
+ */
+bool SimpleChatServer::runCoroutines( )
+{
+	CoroutineLoop loop( this, serverSocket( ) );
+	return loop.run( );
+}
+
+/*
+ *	Serve every client from one io_uring event loop run by the calling
+ *	thread. When the kernel cannot run it (no io_uring, io_uring turned
+ *	off, or older than 6.0) the clients are served by epoll instead.
+ *	Only returns if the loop could not be set up.
+ */
+bool SimpleChatServer::runUring( )
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	UringLoop loop( this, serverSocket( ) );
+	if( loop.setup( ) ) return loop.run( );
+#else
+	Engine::onInfo( "Built without io_uring support." );
+#endif
+
+	Engine::onInfo( "Falling back to an epoll event loop." );
+	return runEventLoop( );
+}
+
+/*
+ *	Serve every client from a fixed pool of worker threads that are
+ *	spawned before the first accept; the calling thread polls for
+ *	events. Only returns if the pool could not be set up.
+ */
+bool SimpleChatServer::runWorkerPool( unsigned int workers )
+{
+	WorkerPool pool( this, serverSocket( ), workers, m_nStackSize );
+	return pool.run( );
+}
+
 void *SimpleChatServer::handleClient( void *thread_args )
 {
     ThreadArgs *args = static_cast<ThreadArgs *>( thread_args ); 
@@ -104,230 +306,477 @@ void *SimpleChatServer::handleClient( void *thread_args )
 
     while( !bDone )
     {
-		//NetMessaging::Protocol::initializeMessage( message );
-
-		if( NetMessaging::Protocol::receiveMessage( args->clientSocket, message ) == NetMessaging::Protocol::FAILED )
+		/*
+		 *	Wait for a message from the client, for other threads to
+		 *	post messages to it or, when our outbound queue is backed
+		 *	up, for room to send them.
+		 */
+		struct pollfd pfd[ 2 ];
+		pfd[ 0 ].fd      = args->clientSocket;
+		pfd[ 0 ].events  = POLLIN | (args->pConnection->hasPendingOutput( ) ? POLLOUT : 0);
+		pfd[ 0 ].revents = 0;
+		pfd[ 1 ].fd      = args->pConnection->wakeupSocket( );
+		pfd[ 1 ].events  = POLLIN;
+		pfd[ 1 ].revents = 0;
+
+		int rv = poll( pfd, 2, -1 );
+		NetMessaging::Protocol::countWaitCall( );
+		if( rv < 0 && errno != EINTR )
 		{
-			// remove user from all chatrooms in the case of an orderly shutdown...
-			#ifdef _DEBUG
-			Engine::onError( "Failed to receive message!" );
-			#endif
+			Engine::onError( "Client socket = %d, poll( ) failed; errno = %d", args->clientSocket, errno );
+			NetMessaging::Protocol::initializeMessage( message );
 			pServer->handleUserLeave( args->clientSocket, message );
 			bDone = true;
+			continue;
 		}
-		else // received valid message & no errors occurred...
-		{					
-			/*
-			 *	Here we handle the message that was received
-			 * 	from the call to receiveMessage(). If handleMessage( )
-			 * 	returns false, then we received a MT_USER_LEAVE or the
-			 * 	user disconnected.
-			 */
-			#ifdef _DEBUG
-			Engine::onInfo( "Handling received message..." );
-			#endif
 
-			if( !pServer->handleMessage( args->clientSocket, message ) )
+		if( rv <= 0 ) continue;
+		if( pfd[ 1 ].revents & POLLIN ) args->pConnection->clearWakeup( );
+
+		if( (pfd[ 1 ].revents & POLLIN) || (pfd[ 0 ].revents & POLLOUT) )
+		{
+			if( args->pConnection->flush( ) == NetMessaging::Protocol::FAILED )
 			{
-				// remove user from all chatrooms in the case of an orderly shutdown...
+				NetMessaging::Protocol::initializeMessage( message );
 				pServer->handleUserLeave( args->clientSocket, message );
 				bDone = true;
+				continue;
 			}
+		}
+
+		if( !(pfd[ 0 ].revents & (POLLIN | POLLHUP | POLLERR)) ) continue;
+
+		/*
+		 *	Read everything pending in as few recv calls as the buffer
+		 *	allows and handle each complete message that came with it;
+		 *	the replies are flushed together afterwards.
+		 */
+		NetMessaging::Protocol::Result result;
+		args->pConnection->beginBatch( );
+		do
+		{
+			result = args->pConnection->receive( );
 
+			while( !bDone && args->pConnection->nextMessage( message ) )
+			{
+				#ifdef _DEBUG
+				Engine::onInfo( "Handling received message..." );
+				#endif
+
+				/*
+				 * 	If handleMessage( ) returns false, then we received a
+				 * 	MT_USER_LEAVE or the user disconnected.
+				 */
+				if( !pServer->handleMessage( args->clientSocket, message ) )
+				{
+					// remove user from all chatrooms in the case of an orderly shutdown...
+					pServer->handleUserLeave( args->clientSocket, message );
+					bDone = true;
+				}
+
+				#ifdef _DEBUG
+				Engine::onInfo( "Received message handling done..." );
+				#endif
+
+				NetMessaging::Protocol::freeMessageData( message ); //free data allocated by the parser
+			}
+		} while( result == NetMessaging::Protocol::SUCCESS && !bDone );
+
+		if( !bDone && (result == NetMessaging::Protocol::FAILED || args->pConnection->isMalformed( )) )
+		{
+			// remove user from all chatrooms in the case of an orderly shutdown...
 			#ifdef _DEBUG
-			Engine::onInfo( "Received message handling done..." );
+			Engine::onError( "Failed to receive message!" );
 			#endif
+			NetMessaging::Protocol::initializeMessage( message );
+			pServer->handleUserLeave( args->clientSocket, message );
+			bDone = true;
+		}
 
-			NetMessaging::Protocol::freeMessageData( message ); //free data allocated in receiveMessage()
+		if( !bDone && args->pConnection->flush( ) == NetMessaging::Protocol::FAILED )
+		{
+			NetMessaging::Protocol::initializeMessage( message );
+			pServer->handleUserLeave( args->clientSocket, message );
+			bDone = true;
 		}
     }
 
     pServer->handleDisconnect( args->clientSocket );
 
     // free memory and let the thread exit...
+    delete args->pConnection;
     delete args;
     pthread_exit( NULL );
     return NULL;
 }
 
+void SimpleChatServer::registerConnection( Connection *pConnection )
+{
+	if( !m_Connections.insert( pConnection ) )
+	{
+		Engine::onError( "Client socket = %d, past the descriptor limit the connection table was sized for.", pConnection->socket( ) );
+	}
+}
+
+/*
+ *	Read and handle everything pending on a non-blocking socket; with
+ *	edge-triggered epoll we will not be told about it again. A budget
+ *	limits the number of reads so that one busy client cannot keep its
+ *	thread from the others. Returns TRYAGAIN once the socket is drained,
+ *	SUCCESS if the budget ran out first (call again soon) and FAILED
+ *	when the connection should be closed: the peer went away, sent
+ *	garbage or a MT_USER_LEAVE, or a handler asked us to drop it.
+ */
+NetMessaging::Protocol::Result SimpleChatServer::receiveMessages( Connection *pConnection, int budget )
+{
+	NetMessaging::Protocol::Result result;
+	NetMessaging::Protocol::Message message;
+	bool bClose = false;
+	int reads   = 0;
+
+	do
+	{
+		result = pConnection->receive( );
+		bClose = (result == NetMessaging::Protocol::FAILED);
+		reads++;
+
+		while( pConnection->nextMessage( message ) )
+		{
+			bool bKeep = handleMessage( pConnection->socket( ), message );
+			NetMessaging::Protocol::freeMessageData( message );
+
+			if( !bKeep ) // MT_USER_LEAVE or a handler asked us to drop the client
+			{
+				bClose = true;
+				break;
+			}
+		}
+	} while( result == NetMessaging::Protocol::SUCCESS && !bClose && !pConnection->isMalformed( ) && (budget <= 0 || reads < budget) );
+
+	return bClose || pConnection->isMalformed( ) ? NetMessaging::Protocol::FAILED : result;
+}
+
+/*
+ *	Same as above for bytes that were read from the client's socket by
+ *	someone else (io_uring); returns SUCCESS or FAILED.
+ */
+NetMessaging::Protocol::Result SimpleChatServer::deliverMessages( Connection *pConnection, const char *pData, size_t bytes )
+{
+	NetMessaging::Protocol::Message message;
+	size_t delivered = 0;
+
+	while( delivered < bytes )
+	{
+		// every message taken out makes room for the rest...
+		delivered += pConnection->deliver( pData + delivered, bytes - delivered );
+
+		while( pConnection->nextMessage( message ) )
+		{
+			bool bKeep = handleMessage( pConnection->socket( ), message );
+			NetMessaging::Protocol::freeMessageData( message );
+
+			if( !bKeep ) return NetMessaging::Protocol::FAILED;
+		}
+
+		if( pConnection->isMalformed( ) ) return NetMessaging::Protocol::FAILED;
+	}
+
+	return NetMessaging::Protocol::SUCCESS;
+}
+
+/*
+ *	Post a reply to a handler's own client. The handler is suspended
+ *	while the client's outbound queue is congested if a coroutine
+ *	serves the client; otherwise it carries straight on.
+ */
+SimpleChatServer::ReplyAwaiter SimpleChatServer::reply( int clientSocket, const NetMessaging::Protocol::Message &msg )
+{
+	Connection *pConnection = findConnection( clientSocket );
+
+	if( pConnection != NULL && pConnection->packReply( msg ) )
+	{
+		ReplyAwaiter packed = { NULL, true }; // goes out with the rest of the batch
+		return packed;
+	}
+
+	ReplyAwaiter awaiter = { pConnection, pConnection != NULL && pConnection->send( msg ) };
+	return awaiter;
+}
+
+/*
+ *	Post a message to a client without blocking; the thread that owns
+ *	the client's socket writes it. A connection is only deleted once
+ *	its socket is out of every chatroom's published membership and the
+ *	grace period of that Chatroom::publish( ) has passed, so no broadcast
+ *	can still be walking a snapshot that holds it. That is why
+ *	Chatroom::sendMessage( ) reaches the members without the room lock;
+ *	a thread may always send to its own client.
+ */
+bool SimpleChatServer::sendMessage( int clientSocket, const NetMessaging::Protocol::Message &msg )
+{
+	NetMessaging::Frame *pFrame = NetMessaging::Frame::create( msg );
+	bool bSent = sendMessage( clientSocket, pFrame );
+	pFrame->release( );
+
+	return bSent;
+}
+
+/*
+ *	Queue an encoded frame; used to fan one encoding out to many clients.
+ */
+bool SimpleChatServer::sendMessage( int clientSocket, NetMessaging::Frame *pFrame )
+{
+	Connection *pConnection = findConnection( clientSocket );
+
+	if( pConnection == NULL ) return false;
+	return pConnection->send( pFrame );
+}
+
+Connection *SimpleChatServer::findConnection( int clientSocket )
+{
+	return m_Connections.find( clientSocket ); // no lock; see connectiontable.h
+}
+
 void SimpleChatServer::handleDisconnect( int clientSocket )
 {
+	NetMessaging::PeerAddress address;
+
+	Connection *pConnection = m_Connections.erase( clientSocket );
+	if( pConnection != NULL ) address = pConnection->peerAddress( );
+
     // log the disconnection...
 	generalLock.lock( );
-		disconnectPeer( clientSocket );
+		disconnectPeer( clientSocket, address );
 		m_nNumberOfConnections--;
 	generalLock.unlock( );
 }
 
+/*
+ *	For the IO models that handle messages synchronously; nothing a
+ *	handler awaits suspends unless the client is served by a coroutine.
+ */
 bool SimpleChatServer::handleMessage( int clientSocket, const NetMessaging::Protocol::Message &msg )
+{
+	Task<bool> task = handleMessageAsync( clientSocket, msg );
+	return task.run( );
+}
+
+Task<bool> SimpleChatServer::handleMessageAsync( int clientSocket, const NetMessaging::Protocol::Message &msg )
 {
     #ifdef _DEBUG
 	std::string debugMsg = NetMessaging::Protocol::payloadString( msg.data, msg.header.dataSize );
     Engine::onInfo( "Client socket = %d, handling message %.4x with %s (size = %d).", clientSocket, msg.header.type, debugMsg.c_str( ), msg.header.dataSize );
     #endif
 
+    if( (msg.header.flags & ~NetMessaging::Protocol::FLAG_BATCH) != 0 )
+    {
+		Engine::onInfo( "Message %.4x from client socket %d has flags %.2x set that are not handled yet. We will ignore this.", msg.header.type, clientSocket, msg.header.flags );
+		co_return true;
+    }
+
     switch( msg.header.type )
     {
 		case NetMessaging::Protocol::MT_USER_ENTER:
-			return handleUserEnter( clientSocket, msg );			
+			co_return co_await handleUserEnter( clientSocket, msg );			
 		case NetMessaging::Protocol::MT_USER_LEAVE:
-			return handleUserLeave( clientSocket, msg );	// this case must return false		
+			co_return handleUserLeave( clientSocket, msg );	// this case must return false		
 		case NetMessaging::Protocol::MT_CHATROOM_LIST:
-			return handleChatroomList( clientSocket, msg );
+			co_return co_await handleChatroomList( clientSocket, msg );
 		case NetMessaging::Protocol::MT_USER_LIST:
-			return handleUserList( clientSocket, msg );	
+			co_return co_await handleUserList( clientSocket, msg );	
 		case NetMessaging::Protocol::MT_ENTER_CHATROOM:	
-			return handleEnterChatroom( clientSocket, msg );
+			co_return co_await handleEnterChatroom( clientSocket, msg );
 		case NetMessaging::Protocol::MT_LEAVE_CHATROOM:
-			return handleLeaveChatroom( clientSocket, msg );
+			co_return co_await handleLeaveChatroom( clientSocket, msg );
 		case NetMessaging::Protocol::MT_SEND_CHATROOM_MESSAGE:
-			return handleSendChatroomMessage( clientSocket, msg );
+			co_return co_await handleSendChatroomMessage( clientSocket, msg );
+		case NetMessaging::Protocol::MT_BATCH:
+			co_return co_await handleBatch( clientSocket, msg );
 			/*case MT_SEND_USER_MESSAGE:
-			  return handleSendUserMessage( clientSocket, msg );*/
+			  co_return co_await handleSendUserMessage( clientSocket, msg );*/
 		default:
 			Engine::onInfo( "Unknown message type %.8x received from client socket %d. We will ignore this.", msg.header.type, clientSocket );
-			return true; // ignore this message.
+			co_return true; // ignore this message.
     }
 }
 
+namespace {
+
+long nanosSince( const struct timespec &start )
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec);
+}
+
+/*
+ *	ChatroomRegistry::forEach( ) visitor gathering room names.
+ */
+struct ChatroomNameCollector
+{
+	std::vector<std::string> names;
+
+	void operator()( const Chatroom &chatroom ) { names.push_back( chatroom.getName( ) ); }
+	void sort( ) { std::sort( names.begin( ), names.end( ) ); }
+};
+
+#ifdef _DEBUG
+/*
+ *	UserTable::forEach( ) visitor for the debug dumps.
+ */
+struct UserLister
+{
+	int count;
+
+	UserLister( ) : count(1) { }
+	void operator()( const User &user ) { SCS::Engine::onInfo( "   %.2d %s (%d)", count++, user.username( ), user.socket( ) ); }
+};
+#endif
+
+} // end of anonymous namespace
+
 /*
  *  Message Handlers
  */
-bool SimpleChatServer::handleUserEnter( int clientSocket, const NetMessaging::Protocol::Message &msg )
+Task<bool> SimpleChatServer::handleUserEnter( int clientSocket, const NetMessaging::Protocol::Message &msg )
 {
     Engine::onInfo( "Client socket = %d, handleUserEnter( )", clientSocket );
+	NetMessaging::FieldTokenizer fields( msg );
+	std::string_view username;
+	std::string_view compression;
 
-    if( msg.data == NULL )
+    if( !fields.next( username ) )
     {
 		Engine::onInfo( "Client socket = %d, User supplied no username. The user will be disconnected. %p", clientSocket, msg.data );
-		return false; // no username came along? so disconnect
+		co_return false; // no username came along? so disconnect
     }
 
-	std::string ip( Server::peerAddress( clientSocket ) );
-	if( ip.length( ) == 0 ) // save ip address of remote user...
-	{
-		ip.assign( "Unknown IP" );
-	}
+	// captured when the client was accepted...
+	Connection *pConnection = findConnection( clientSocket );
+	NetMessaging::PeerAddress address = pConnection != NULL ? pConnection->peerAddress( ) : NetMessaging::PeerAddress( );
 
-	std::string username( msg.data );
 
     #ifdef _DEBUG
-    cout << "DEBUG handleUserEnter( ): username = " << username << ", ip = " << ip << endl;
+    cout << "DEBUG handleUserEnter( ): username = " << username << ", ip = " << address.text( ) << endl;
     #endif
 
-    User user( clientSocket, username, ip );
+    User user( clientSocket, username, address );
 
 	usersLock.lock( ); // crtical section...
+		struct timespec start;
+		clock_gettime( CLOCK_MONOTONIC, &start );
+
 		// check if username is already in use:
 		// if so, disconnect
 		// otherwise, proceed...
-		UserCollection::iterator itr;
-		for( itr = m_Users.begin( ); itr != m_Users.end( ); ++itr )
+		if( m_Users.findByName( username ) != NULL )
 		{
-			if( itr->username( ) == username )
-			{
-				usersLock.unlock( );
-				return false; 
-			}
+			usersLock.unlock( );
+			co_return false; 
 		}
 
 		// Insert the user 
-    	pair<UserCollection::iterator, bool> pr = m_Users.insert( user );
-
-		if( !pr.second ) // insertion failed
+		if( m_Users.insert( user ) == NULL ) // insertion failed
 		{
 			Engine::onInfo( "Client socket = %d, User tried to log in twice.", clientSocket );
 		}
 
-		// log some statistics
-		logStats( );
+		m_Logins.add( );
+		m_LoginNanos.add( nanosSince( start ) );
     usersLock.unlock( );
 
+	// a client that asks for compression is told whether it got it,
+	// with the name back or nothing; the others hear nothing...
+	if( fields.next( compression ) )
+	{
+		bool bCompress = false;
+		if( compression == NetMessaging::Compressor::name( ) && pConnection != NULL ) bCompress = pConnection->enableCompression( );
 
-    return true;
+		std::string accepted( bCompress ? NetMessaging::Compressor::name( ) : "" );
+		if( bCompress ) accepted.append( 1, '\0' );
+
+		NetMessaging::Protocol::Message returnMsg;
+		NetMessaging::Protocol::initializeMessage( returnMsg, NetMessaging::Protocol::MT_USER_ENTER, accepted.length( ), accepted.data( ) );
+
+		if( !co_await reply( clientSocket, returnMsg ) )
+		{
+			Engine::onError( "Client socket = %d, handleUserEnter( ) failed to send response.", clientSocket );
+			co_return false;
+		}
+	}
+
+    co_return true;
 }
 
 bool SimpleChatServer::handleUserLeave( int clientSocket, const NetMessaging::Protocol::Message &msg )
 {
-    bool bReturn = false;
     Engine::onInfo( "Client socket = %d, handleUserLeave( )", clientSocket );
-    User user( clientSocket );
+	std::vector<ChatroomId> chatroomIds;
+	std::string userLabel;
 
-	chatroomsLock.lock( );
-		usersLock.lock( ); // crtical section...
-			UserCollection::iterator itr = m_Users.find( user );
+	usersLock.lock( ); // crtical section...
+		User *pUser = m_Users.find( clientSocket );
 
-			if( itr != m_Users.end( ) ) // found user...
-			{
-				User::ChatroomCollection chatroomNameList = itr->chatrooms( );
-				User::ChatroomCollection::iterator crNameItr;
+		if( pUser == NULL )
+		{
+			usersLock.unlock( );
+			return true; // avoid disconnecting client if MT_USER_LEAVE came before MT_USER_ENTER
+		}
 
-				// remove the user from each chatroom he was participating in...
-				for( crNameItr = chatroomNameList.begin( ); crNameItr != chatroomNameList.end( ); ++crNameItr )
-				{
-					TreeMapChatrooms::iterator crItr = m_Chatrooms.find( *crNameItr );
+		chatroomIds.assign( pUser->chatrooms( ), pUser->chatrooms( ) + pUser->numberOfChatrooms( ) );
+		userLabel.assign( pUser->username( ) ).append( 1, '@' ).append( pUser->ipAddress( ) );
+	usersLock.unlock( );
 
-					if( crItr != m_Chatrooms.end( ) )
-					{
-						crItr->second.removeUser( clientSocket );			
+	// remove the user from each chatroom he was participating in...
+	for( size_t i = 0; i < chatroomIds.size( ); i++ )
+	{
+		leaveChatroom( clientSocket, chatroomIds[ i ], userLabel );
+	}
 
-						// obscure case: one user in chatroom disconnects, chatroom is removed.
-						if( crItr->second.getNumberOfUsers( ) <= 0 ) // chatroom is empty so remove it
-							m_Chatrooms.erase( crItr );
-					}
-				}
+	usersLock.lock( ); // crtical section...
+		#ifdef _DEBUG
+		unsigned int nNumberOfUsers = m_Users.size( );
+		#endif
 
-				#ifdef _DEBUG
-				unsigned int nNumberOfUsers = m_Users.size( );
-				#endif
+		// remove the user from the main user list.
+		m_Users.erase( clientSocket ); // remove the user...				
 
-				// remove the user from the main user list.
-				m_Users.erase( itr ); // remove the user...				
-				
-				// log some statistics
-				logStats( );
+		#ifdef _DEBUG
+		assert( m_Users.size( ) + 1 == nNumberOfUsers );
+		#endif
+	usersLock.unlock( );
 
-				#ifdef _DEBUG
-				assert( m_Users.size( ) + 1 == nNumberOfUsers );
-				#endif
-			}
-			else
-			{
-				bReturn = true; // avoid disconnecting client if MT_USER_LEAVE came before MT_USER_ENTER
-			}
-		usersLock.unlock( );
-	chatroomsLock.unlock( );
-    return bReturn; // return false on success
+    return false; // return false on success
 }
 
-bool SimpleChatServer::handleChatroomList( int clientSocket, const NetMessaging::Protocol::Message &msg )
+Task<bool> SimpleChatServer::handleChatroomList( int clientSocket, const NetMessaging::Protocol::Message &msg )
 {
     Engine::onInfo( "Client socket = %d, handleChatroomList( )", clientSocket );
 	std::string chatroomList("");
 
 
-	chatroomsLock.lock( ); // bof critical section...
-    	TreeMapChatrooms::const_iterator itr;
-    	for( itr = m_Chatrooms.begin( ); itr != m_Chatrooms.end( ); ++itr )
-		{
-			chatroomList += itr->first + '\n';
-		}
-    chatroomsLock.unlock( ); // eof critical section...
+	ChatroomNameCollector collector;
+	m_Chatrooms.forEach( collector ); // locks one shard at a time
+	collector.sort( );
+
+	std::vector<std::string>::const_iterator itr;
+	for( itr = collector.names.begin( ); itr != collector.names.end( ); ++itr )
+	{
+		chatroomList += *itr + '\n';
+	}
 
     #ifdef _DEBUG
     cout << "DEBUG handleChatroomList( ): Chatroom list = {";
-    for( size_t i = 0; i < msg.header.dataSize; i++ )
+    NetMessaging::FieldTokenizer listed( chatroomList.data( ), chatroomList.length( ), '\n' );
+    for( std::string_view name; listed.next( name ); )
     {
-		if( msg.data[ i ] == '\n' )
-		{ cout << ", ";	/*i++;*/ } // skip over extra '\n'
-		else
-		{ cout << msg.data[ i ]; }
+		cout << name << ", ";
     }
     cout << "}" << endl;
     //debugString( chatroomList );
     #endif
 
-    if( m_Chatrooms.size( ) > 0 )
+    if( collector.names.size( ) > 0 )
     {
 		chatroomList.erase( chatroomList.length( ) - 1 ); // remove the extra '\n'
 		chatroomList.append( 1, '\0' );
@@ -336,68 +785,71 @@ bool SimpleChatServer::handleChatroomList( int clientSocket, const NetMessaging:
     NetMessaging::Protocol::Message returnMsg;	
     NetMessaging::Protocol::initializeMessage( returnMsg, NetMessaging::Protocol::MT_CHATROOM_LIST, chatroomList.length( ), &chatroomList[ 0 ] ); 
 
-    if( NetMessaging::Protocol::sendMessage( clientSocket, returnMsg ) == NetMessaging::Protocol::FAILED )
+    if( !co_await reply( clientSocket, returnMsg ) )
     {
 		Engine::onError( "Client socket = %d, handleChatroomList( ) failed to send respone.", clientSocket );
-		return false;
+		co_return false;
     }
 
-    return true;
+    co_return true;
 }
 
-bool SimpleChatServer::handleUserList( int clientSocket, const NetMessaging::Protocol::Message &msg )
+Task<bool> SimpleChatServer::handleUserList( int clientSocket, const NetMessaging::Protocol::Message &msg )
 {
     Engine::onInfo( "Client socket = %d, handleUserList( )", clientSocket );
 	std::string userList("");
-	std::string chatroomName( msg.data, msg.header.dataSize - 1 );
+	std::string_view chatroomName;
+    NetMessaging::FieldTokenizer( msg ).next( chatroomName ); // no name is an empty one
 
 
-	chatroomsLock.lock( ); // bof critical section
-		TreeMapChatrooms::const_iterator itrChatroom = m_Chatrooms.find( chatroomName );
+	Chatroom *pChatroom = m_Chatrooms.acquire( chatroomName );
 
-		if( itrChatroom != m_Chatrooms.end( ) ) // found a chatroom
-		{
-			Chatroom::UserSocketCollection userSocketList = itrChatroom->second.getUsers( );
-			Chatroom::UserSocketCollection::const_iterator itrUserSockets;
-
-			for( itrUserSockets = userSocketList.begin( ); itrUserSockets != userSocketList.end( ); ++itrUserSockets )
-			{
-				User theUser( *itrUserSockets );
+	if( pChatroom != NULL ) // found a chatroom
+	{
+		pChatroom->lock( ); // bof critical section
+			const Chatroom::Members &userSocketList = pChatroom->getUsers( );
+			const int *itrUserSockets;
 
-				usersLock.lock( ); // bof critical section
-					UserCollection::const_iterator itrUsers = m_Users.find( theUser );
+			usersLock.lock( ); // bof critical section
+				// newest sockets first, as the list has always been sent
+				for( itrUserSockets = userSocketList.end( ); itrUserSockets-- != userSocketList.begin( ); )
+				{
+					const User *pUser = m_Users.find( *itrUserSockets );
 
-					if( itrUsers != m_Users.end( ) )
+					if( pUser != NULL )
 					{
-						userList += itrUsers->username( ) + "@" + itrUsers->ipAddress( ) + '\n';
+						userList.append( pUser->username( ) ).append( 1, '@' ).append( pUser->ipAddress( ) ).append( 1, '\n' );
 					}
-				usersLock.unlock( ); // eof critical section
-			}
+				}
+			usersLock.unlock( ); // eof critical section
 
 			if( userSocketList.size( ) > 0 )
 			{
 				userList.erase( userList.length( ) - 1 ); // remove the extra '\n'
 				userList.append( 1, '\0' );
 			}
-		}
-	chatroomsLock.unlock( ); // eof critical section
+		pChatroom->unlock( ); // eof critical section
+
+		pChatroom->release( );
+	}
 
     NetMessaging::Protocol::Message returnMsg;
     NetMessaging::Protocol::initializeMessage( returnMsg, NetMessaging::Protocol::MT_USER_LIST, userList.length( ), &userList[ 0 ] );
 
-    if( NetMessaging::Protocol::sendMessage( clientSocket, returnMsg ) == NetMessaging::Protocol::FAILED )
+    if( !co_await reply( clientSocket, returnMsg ) )
     {
 		Engine::onError( "Client socket = %d, handleUserList( ) failed to send respone.", clientSocket );
-		return false;
+		co_return false;
     }
 
-    return true;
+    co_return true;
 }
 
-bool SimpleChatServer::handleEnterChatroom( int clientSocket, const NetMessaging::Protocol::Message &msg )
+Task<bool> SimpleChatServer::handleEnterChatroom( int clientSocket, const NetMessaging::Protocol::Message &msg )
 {
     Engine::onInfo( "Client socket = %d, handleEnterChatroom( )", clientSocket );
-	std::string chatroomName( msg.data, msg.header.dataSize - 1 );
+	std::string_view chatroomName;
+    NetMessaging::FieldTokenizer( msg ).next( chatroomName ); // no name is an empty one
 
     #ifdef _DEBUG
     cout << "DEBUG handleEnterChatroom( ): chatroom name = " << chatroomName << endl;
@@ -405,183 +857,122 @@ bool SimpleChatServer::handleEnterChatroom( int clientSocket, const NetMessaging
     #endif
 
 
-	chatroomsLock.lock( ); // crtical section...
-		TreeMapChatrooms::iterator itr = m_Chatrooms.find( chatroomName );
-
-		if( itr != m_Chatrooms.end( ) ) // found existing chatroom
-		{
-			#ifdef _DEBUG
-			cout << "DEBUG handleEnterChatroom( ): joining existing room."<< endl;
-			#endif
-			// this looks inefficient, but hash_set's iterator is actually
-			// a const_iterator and therefore I cannot mutate the chatroom in
-			// the hash_set
-			User user( clientSocket );
+	// our reference keeps the ID until we are in the room (which has its own)...
+	ChatroomId chatroomId = m_Chatrooms.intern( chatroomName );
+	if( chatroomId == ChatroomNames::INVALID_ID )
+	{
+		Engine::onError( "Client socket = %d, no more chatroom names can be interned; the join is refused.", clientSocket );
+		co_return true;
+	}
 
-			usersLock.lock( ); // bof critical section
-				UserCollection::iterator userItr = m_Users.find( user );
-				if( userItr != m_Users.end( ) )
-				{
-					User copy = *userItr;
-					copy.addChatroom( chatroomName );
-					m_Users.erase( userItr );
-					m_Users.insert( copy );
-				}
-				else
-				{ // error: could not find user...
-					#ifdef _DEBUG
-					SCS::Engine::onError( "Could not find user." );
-					int count = 1;
-					SCS::Engine::onInfo( "bof Chatroom List:" );
-					for( UserCollection::const_iterator itr = m_Users.begin( ); itr != m_Users.end( ); ++itr )
-						SCS::Engine::onInfo( "   %.2d %s (%d)", count++, itr->username( ).c_str( ), itr->socket( ) );
-					SCS::Engine::onInfo( "eof Chatroom List:" );
-					#endif
-					usersLock.unlock( );
-					chatroomsLock.unlock( );
-					return false;				
-				}		
-			usersLock.unlock( ); // eof critical section
+	std::string userLabel;
 
-			itr->second.addUser( clientSocket ); // add client socket to chatroom
-			
-			// log some statistics
-			logStats( );
+	usersLock.lock( ); // bof critical section
+		User *pUser = m_Users.find( clientSocket );
+		if( pUser != NULL )
+		{
+			pUser->addChatroom( chatroomId );
+			userLabel.assign( pUser->username( ) ).append( 1, '@' ).append( pUser->ipAddress( ) );
 		}
 		else
-		{ // chatroom not found so create one for the user
+		{ // error: could not find user...
 			#ifdef _DEBUG
-			cout << "DEBUG handleEnterChatroom( ): creating room."<< endl;
-			unsigned int sz = m_Chatrooms.size( );
+			SCS::Engine::onError( "Could not find user." );
+			UserLister lister;
+			SCS::Engine::onInfo( "bof Chatroom List:" );
+			m_Users.forEach( lister );
+			SCS::Engine::onInfo( "eof Chatroom List:" );
 			#endif
+			usersLock.unlock( );
+			m_Chatrooms.releaseName( chatroomId );
+			co_return false;				
+		}		
+	usersLock.unlock( ); // eof critical section
 
-			User user( clientSocket );
+	while( true )
+	{
+		bool bCreated = false;
+		Chatroom *pChatroom = m_Chatrooms.acquireOrCreate( chatroomId, &bCreated );
 
-			usersLock.lock( ); // bof critical section
-				UserCollection::iterator userItr;
-				userItr = m_Users.find( user );
-				if( userItr != m_Users.end( ) )
-				{
-					User copy = *userItr;
-					copy.addChatroom( chatroomName );
-					m_Users.erase( userItr );
-					m_Users.insert( copy );
-				}
-				else
-				{ // error: could not find user...
-					#ifdef _DEBUG
-					SCS::Engine::onError( "Could not find user." );
-					int count = 1;
-					SCS::Engine::onInfo( "bof Chatroom List:" );
-					for( UserCollection::const_iterator itr = m_Users.begin( ); itr != m_Users.end( ); ++itr )
-						SCS::Engine::onInfo( "   %.2d %s (%d)", count++, itr->username( ).c_str( ), itr->socket( ) );
-					SCS::Engine::onInfo( "eof Chatroom List:" );
-					#endif
-					usersLock.unlock( );
-					chatroomsLock.unlock( );
-					return false;				
-				}		
-			usersLock.unlock( ); // eof critical section
+		#ifdef _DEBUG
+		cout << "DEBUG handleEnterChatroom( ): " << (bCreated ? "creating room." : "joining existing room.") << endl;
+		#endif
 
-			Chatroom chatroom( chatroomName );
-			chatroom.addUser( clientSocket );  // add client socket to new chatroom
-			m_Chatrooms.insert( make_pair( chatroomName, chatroom ) );
-			#ifdef _DEBUG
-			assert( sz < m_Chatrooms.size( ) );
-			#endif
+		pChatroom->lock( ); // crtical section...
+			// the last member may have left (and the room been unlisted)
+			// between acquiring the room and locking it; start over.
+			bool bClosed = pChatroom->isClosed( );
+			if( !bClosed )
+			{
+				pChatroom->addUser( clientSocket, userLabel ); // add client socket to chatroom
+			}
+		pChatroom->unlock( );
+		pChatroom->release( );
 
-			// log some statistics
-			logStats( );
-		}
-    chatroomsLock.unlock( );
+		if( !bClosed ) break;
+	}
 
-    return true;
+	m_Chatrooms.releaseName( chatroomId );
+    co_return true;
 }
 
-bool SimpleChatServer::handleLeaveChatroom( int clientSocket, const NetMessaging::Protocol::Message &msg )
+Task<bool> SimpleChatServer::handleLeaveChatroom( int clientSocket, const NetMessaging::Protocol::Message &msg )
 {
-    if( msg.data == NULL ) return false;
-	std::string chatroomName( msg.data, msg.header.dataSize - 1 );
+	std::string_view chatroomName;
+    if( !NetMessaging::FieldTokenizer( msg ).next( chatroomName ) ) co_return false;
 
     #ifdef _DEBUG
     cout << "DEBUG handleLeaveChatroom( ): chatroom name = \"" << chatroomName << "\"" << endl;
     //debugString( chatroomName );
 
 
-    TreeMapChatrooms::const_iterator crItr;
+	ChatroomNameCollector collector;
 	std::string chatroomList;
 
-    chatroomsLock.lock( ); // bof critical section...
-    	for( crItr = m_Chatrooms.begin( ); crItr != m_Chatrooms.end( ); ++crItr )
-		{
-			chatroomList += "\"" + crItr->first + "\", ";
-		}
-    chatroomsLock.unlock( ); // eof critical section...
+	m_Chatrooms.forEach( collector );
+	for( std::vector<std::string>::const_iterator crItr = collector.names.begin( ); crItr != collector.names.end( ); ++crItr )
+	{
+		chatroomList += "\"" + *crItr + "\", ";
+	}
 
     cout << "Chatrooms = {" << chatroomList << "}" << endl;
     #endif
 
-    chatroomsLock.lock( ); // crtical section...
-		TreeMapChatrooms::iterator itr = m_Chatrooms.find( chatroomName );
+	ChatroomId chatroomId = m_Chatrooms.find( chatroomName ); // INVALID_ID if there is no such room
+	std::string userLabel;
 
-		if( itr != m_Chatrooms.end( ) ) // found existing chatroom
+	usersLock.lock( ); // bof critical section
+		User *pUser = m_Users.find( clientSocket );
+		if( pUser != NULL )
 		{
-			// this looks inefficient, but hash_set's iterator is actually
-			// a const_iterator and therefore I cannot mutate the chatroom in
-			// the hash_set
-			User user( clientSocket );			
-
-			usersLock.lock( ); // bof critical section
-				UserCollection::iterator userItr = m_Users.find( user );
-				if( userItr != m_Users.end( ) )
-				{					
-					// Update user object; remove chatroom from user object.
-					User copy = *userItr;
-					copy.removeChatroom( chatroomName );
-					m_Users.erase( userItr );
-					m_Users.insert( copy );										
-				}
-			usersLock.unlock( ); // eof critical section
+			// Update user object; remove chatroom from user object.
+			if( chatroomId != ChatroomNames::INVALID_ID ) pUser->removeChatroom( chatroomId );
+			userLabel.assign( pUser->username( ) ).append( 1, '@' ).append( pUser->ipAddress( ) );
+		}
+	usersLock.unlock( ); // eof critical section
 
-			// Remove user from chatroom.
-			itr->second.removeUser( clientSocket );		
+	// Remove user from chatroom. If there is no such chatroom or user,
+	// this must be an error from the client, so we will forgive him.
+	if( !userLabel.empty( ) && chatroomId != ChatroomNames::INVALID_ID )
+	{
+		leaveChatroom( clientSocket, chatroomId, userLabel );
+	}
 
-			if( itr->second.getNumberOfUsers( ) <= 0 ) // chatroom is empty so remove it
-			{
-				m_Chatrooms.erase( itr );
-				
-				// log some statistics
-				logStats( );
-			}
-		}
-		// else
-		// this must be an error from the client, so
-		// we will forgive him.
-    chatroomsLock.unlock( );
+	if( chatroomId != ChatroomNames::INVALID_ID ) m_Chatrooms.releaseName( chatroomId );
 
-    return true;
+    co_return true;
 }
 
-bool SimpleChatServer::handleSendChatroomMessage( int clientSocket, const NetMessaging::Protocol::Message &msg )
+Task<bool> SimpleChatServer::handleSendChatroomMessage( int clientSocket, const NetMessaging::Protocol::Message &msg )
 {
-	std::string chatroomName;
-	std::string textMessage;
-    const char *pData = static_cast<char *>( msg.data );
-    size_t i = 0;
+	std::string_view chatroomName;
+	std::string_view textMessage;
 
-    // extract chatroom name
-    for( ; pData[ i ] != '\0' && i < msg.header.dataSize; i++ )
-	{
-		chatroomName.append( 1, pData[ i ] );
-	}
-
-    i++;
-
-    // extract text message
-    for( ; pData[ i ] != '\0' && i < msg.header.dataSize; i++ )
-	{
-		textMessage.append( 1, pData[ i ] );
-	}
+    // extract chatroom name and text message (views into msg.data); a
+    // missing one is empty
+    NetMessaging::FieldTokenizer fields( msg );
+    fields.next( chatroomName );
+    fields.next( textMessage );
 
     #ifdef _DEBUG
     cout << "DEBUG handleSendChatroomMessage( ): chatroom = " << chatroomName << ", textMessage = " << textMessage << endl;
@@ -592,109 +983,229 @@ bool SimpleChatServer::handleSendChatroomMessage( int clientSocket, const NetMes
 
 
 
-    chatroomsLock.lock( ); // crtical section...
-		TreeMapChatrooms::iterator itr = m_Chatrooms.find( chatroomName );
+	std::string username;
+	bool bLoggedIn = false;
 
-		if( itr != m_Chatrooms.end( ) ) // found existing chatroom
+	usersLock.lock( ); // bof critical section
+		const User *pUser = m_Users.find( clientSocket );
+		if( pUser != NULL )
 		{
-			itr->second.sendMessage( clientSocket, textMessage );
+			username  = pUser->username( );
+			bLoggedIn = true;
 		}
-		#ifdef _DEBUG
-		else
+	usersLock.unlock( ); // eof critical section
+
+	if( !bLoggedIn ) co_return true; // not logged in; ignore it
+
+	Chatroom *pChatroom = m_Chatrooms.acquire( chatroomName );
+
+	if( pChatroom != NULL ) // found existing chatroom
+	{
+		pChatroom->sendMessage( username, textMessage ); // no lock needed; see Chatroom
+		pChatroom->release( );
+	}
+	#ifdef _DEBUG
+	else
+	{
+		ChatroomNameCollector collector;
+		m_Chatrooms.forEach( collector );
+
+		cout << "DEBUG handleSendChatroomMessage( ): Opps!" << endl;
+		cout << "DEBUG Chatroom List = {";
+		for( std::vector<std::string>::const_iterator itr = collector.names.begin( ); itr != collector.names.end( ); ++itr )
 		{
-			cout << "DEBUG handleSendChatroomMessage( ): Opps!" << endl;
-			cout << "DEBUG Chatroom List Mappings = {";
-			for( itr = m_Chatrooms.begin( ); itr != m_Chatrooms.end( ); ++itr )
-			{
-				cout << "(" << itr->first << ", " << itr->second.getName( ) << ")" << ", ";
-			}
-			cout << "\b\b}" << endl;
+			cout << *itr << ", ";
 		}
-		#endif
-		// else
-		// this must be an error from the client, so
-		// we will forgive him.
-    chatroomsLock.unlock( );
-    return true;
+		cout << "\b\b}" << endl;
+	}
+	#endif
+	// else
+	// this must be an error from the client, so
+	// we will forgive him.
+    co_return true;
 }
 
-bool SimpleChatServer::handleSendUserMessage( int clientSocket, const NetMessaging::Protocol::Message &msg )
+/*
+ *	Handle every entry of an MT_BATCH in order, as if each had come in a
+ *	frame of its own, and answer with one MT_BATCH of their replies. An
+ *	entry whose handler drops the client ends the batch there; the
+ *	replies so far are not sent. Batches do not nest.
+ */
+Task<bool> SimpleChatServer::handleBatch( int clientSocket, const NetMessaging::Protocol::Message &msg )
 {
-    assert( false ); //feature not implemented yet.
-    return true;
-}
+	Connection *pConnection = findConnection( clientSocket );
+	if( pConnection == NULL ) co_return false;
 
-bool SimpleChatServer::getUserFromSocket( int clientSocket, User &user ) // not thread safe!
-{
-    User hashKeyUser( clientSocket );
-    bool bRet = false;
+	std::string replies;
+	size_t offset = 0;
+	uint32_t requestId = 0;
+	NetMessaging::Protocol::Message entry;
+	bool bKeep = true;
 
-    UserCollection::iterator itr = m_Users.find( hashKeyUser );
+	pConnection->openReplyBatch( &replies );
 
-    if( itr != m_Users.end( ) ) // found user...
-    {
-		user = *itr;
-		bRet = true;
-    }
+	while( bKeep && NetMessaging::Protocol::nextBatchEntry( msg, offset, requestId, entry ) )
+	{
+		m_BatchedMessages.add( );
+		pConnection->setRequestId( requestId );
 
-    return bRet;
-}
+		if( entry.header.type == NetMessaging::Protocol::MT_BATCH )
+		{
+			Engine::onInfo( "Client socket = %d, nested batch (request %u) ignored.", clientSocket, requestId );
+			continue;
+		}
 
+		bKeep = co_await handleMessageAsync( clientSocket, entry );
+	}
 
-bool SimpleChatServer::updateUser( User &user )
-{
-    bool bRet = false;
+	pConnection->closeReplyBatch( );
+	m_Batches.add( );
 
-    usersLock.lock( ); // bof crtical section...
-    	UserCollection::iterator itr = m_Users.find( user );
-    	if( itr != m_Users.end( ) ) // found user...
-		{
-			m_Users.erase( itr );
-			m_Users.insert( user );
-			bRet = true;
-		}
-    usersLock.unlock( ); // eof crtical section...
+	if( !bKeep ) co_return false;
 
-    return bRet; // bRet = false;
-}
+	if( offset != msg.header.dataSize )
+	{
+		Engine::onError( "Client socket = %d, batch entry runs past the end of the batch; the client will be disconnected.", clientSocket );
+		co_return false;
+	}
 
-bool SimpleChatServer::getCopyOfChatroom( const std::string &chatroomName, Chatroom &chatroom )
-{
-    bool bRet = false;
+	if( replies.empty( ) ) co_return true;
 
-    chatroomsLock.lock( ); // bof crtical section...
-		TreeMapChatrooms::iterator itr = m_Chatrooms.find( chatroomName );
+	NetMessaging::Protocol::Message returnMsg;
+	NetMessaging::Protocol::initializeMessage( returnMsg, NetMessaging::Protocol::MT_BATCH, replies.length( ), replies.data( ) );
+	returnMsg.header.flags = NetMessaging::Protocol::FLAG_BATCH;
 
-		if( itr != m_Chatrooms.end( ) ) // found chatroom...
-		{
-			chatroom = itr->second;
-			bRet = true;
-		}
-    chatroomsLock.unlock( ); // eof crtical section...
+	if( !co_await reply( clientSocket, returnMsg ) )
+	{
+		Engine::onError( "Client socket = %d, handleBatch( ) failed to send respone.", clientSocket );
+		co_return false;
+	}
 
-    return bRet; // bRet = false;
+	co_return true;
 }
 
-bool SimpleChatServer::updateChatroom( Chatroom &chatroom )
+Task<bool> SimpleChatServer::handleSendUserMessage( int clientSocket, const NetMessaging::Protocol::Message &msg )
 {
-    bool bRet = false;
+    assert( false ); //feature not implemented yet.
+    co_return true;
+}
 
-    chatroomsLock.lock( ); // bof crtical section...
-		TreeMapChatrooms::iterator itr = m_Chatrooms.find( chatroom.getName( ) );
+/*
+ *	Take clientSocket out of the chatroom, telling the remaining members,
+ *	and unlist the room if that emptied it.
+ */
+void SimpleChatServer::leaveChatroom( int clientSocket, ChatroomId chatroomId, const std::string &userLabel )
+{
+	Chatroom *pChatroom = m_Chatrooms.acquire( chatroomId );
+	if( pChatroom == NULL ) return;
 
-		if( itr != m_Chatrooms.end( ) ) // found chatroom...
-		{
-			itr->second = chatroom;
-			bRet = true;
-		}
-    chatroomsLock.unlock( ); // eof crtical section...
+	pChatroom->lock( ); // crtical section...
+		pChatroom->removeUser( clientSocket, userLabel );
+		bool bEmpty = pChatroom->getNumberOfUsers( ) <= 0;
+	pChatroom->unlock( );
+
+	// obscure case: one user in chatroom disconnects, chatroom is removed.
+	if( bEmpty ) m_Chatrooms.removeIfEmpty( pChatroom );
 
-    return bRet; // bRet = false;
+	pChatroom->release( );
+}
+
+/*
+ *	The user logged in on clientSocket, or NULL. Not thread safe by
+ *	itself: hold usersLock for as long as the pointer is used.
+ */
+const User *SimpleChatServer::getUserFromSocket( int clientSocket ) const
+{
+    return m_Users.find( clientSocket );
 }
 
+
+/*
+ *	Called from the engine's reporter thread, never from a handler.
+ */
 void SimpleChatServer::logStats( )
 {
-	SCS::Engine::onInfo( "Statistics: # of Users: %d, # of Chatrooms: %d", m_Users.size( ), m_Chatrooms.size( ) );
+	// per-user memory, records and indexes; the lock is only held to read them...
+	usersLock.lock( );
+		long users = m_Users.size( );
+		size_t userIndexBytes = m_Users.indexBytes( );
+	usersLock.unlock( );
+
+	SCS::Engine::onInfo( "Statistics: # of Users: %ld, # of Chatrooms: %ld", users, (long) m_Chatrooms.size( ) );
+	long userBytes = users * sizeof(User) + User::heapBytes( ) + userIndexBytes;
+	SCS::Engine::onInfo( "User records: %ld bytes each + %ld bytes of names and room lists on the heap + %ld bytes of indexes; %.1f bytes per user, %ld room names interned in %ld bytes",
+	                     (long) sizeof(User), User::heapBytes( ), (long) userIndexBytes, users > 0 ? (double) userBytes / users : 0.0,
+	                     (long) m_Chatrooms.names( ).size( ), (long) m_Chatrooms.names( ).bytes( ) );
+
+	SCS::Engine::onInfo( "Outbound queues: %ld bytes queued, deepest queue %ld bytes, %ld messages dropped, %ld overflow disconnects",
+	                     Connection::totalQueuedBytes( ), Connection::peakQueuedBytes( ),
+	                     Connection::totalDroppedMessages( ), Connection::totalOverflowDisconnects( ) );
+
+	long framesSent = NetMessaging::Protocol::framesSent( );
+	SCS::Engine::onInfo( "Send path: %ld frames in %ld sendmsg( ) calls (%.2f calls per frame)",
+	                     framesSent, NetMessaging::Protocol::sendCalls( ),
+	                     framesSent > 0 ? (double) NetMessaging::Protocol::sendCalls( ) / framesSent : 0.0 );
+
+	long messagesReceived = Connection::totalMessagesReceived( );
+	SCS::Engine::onInfo( "Receive path: %ld messages in %ld recvmsg( ) calls (%.2f calls per message)",
+	                     messagesReceived, Connection::totalReceiveCalls( ),
+	                     messagesReceived > 0 ? (double) Connection::totalReceiveCalls( ) / messagesReceived : 0.0 );
+
+	SCS::Engine::onInfo( "Wire framing: %ld legacy clients, %ld version 2 clients",
+	                     NetMessaging::FrameParser::legacyStreams( ), NetMessaging::FrameParser::frameStreams( ) );
+
+	SCS::Engine::onInfo( "Chat text: %ld messages (%ld bytes) screened, %ld rejected as not UTF-8, %ld control characters stripped",
+	                     NetMessaging::FrameParser::screenedMessages( ), NetMessaging::FrameParser::screenedBytes( ),
+	                     NetMessaging::FrameParser::rejectedMessages( ), NetMessaging::FrameParser::strippedBytes( ) );
+
+	long compressedIn = NetMessaging::Compressor::bytesIn( );
+	SCS::Engine::onInfo( "Compression: %ld clients, %ld messages compressed from %ld to %ld bytes (%.1f%%), %ld broadcasts compressed once and sent %ld times",
+	                     NetMessaging::Compressor::streams( ), NetMessaging::Compressor::compressedFrames( ), compressedIn, NetMessaging::Compressor::bytesOut( ),
+	                     compressedIn > 0 ? 100.0 * NetMessaging::Compressor::bytesOut( ) / compressedIn : 0.0,
+	                     NetMessaging::Compressor::sharedFrames( ), NetMessaging::Compressor::sharedUses( ) );
+
+	long batches = m_Batches.value( );
+	SCS::Engine::onInfo( "Batches: %ld carrying %ld messages (%.2f per batch)",
+	                     batches, m_BatchedMessages.value( ), batches > 0 ? (double) m_BatchedMessages.value( ) / batches : 0.0 );
+
+	long logins = m_Logins.value( );
+	SCS::Engine::onInfo( "Logins: %ld, %.2f us average to check and index the name",
+	                     logins, logins > 0 ? m_LoginNanos.value( ) / 1000.0 / logins : 0.0 );
+
+	SCS::Engine::onInfo( "Chatroom locks: %ld acquisitions, %ld contended",
+	                     ChatroomRegistry::lockAcquisitions( ), ChatroomRegistry::lockContentions( ) );
+
+	long updates = Chatroom::membershipUpdates( );
+	SCS::Engine::onInfo( "Membership updates: %ld, %.2f us average and %.2f us longest to publish (incl. grace period)",
+	                     updates, updates > 0 ? Chatroom::membershipUpdateNanos( ) / 1000.0 / updates : 0.0,
+	                     Chatroom::longestMembershipUpdateNanos( ) / 1000.0 );
+
+	long accepted = NetMessaging::Server::connectionsAccepted( );
+	SCS::Engine::onInfo( "Accept path: %ld connections in %ld batches (%.2f per batch), %ld refused over the limit",
+	                     accepted, NetMessaging::Server::acceptBatches( ),
+	                     NetMessaging::Server::acceptBatches( ) > 0 ? (double) accepted / NetMessaging::Server::acceptBatches( ) : 0.0,
+	                     m_ConnectionsRefused.value( ) );
+
+	SCS::Engine::onInfo( "Payload buffers: %ld pool hits, %ld misses",
+	                     NetMessaging::BufferPool::hits( ), NetMessaging::BufferPool::misses( ) );
+
+	SCS::Engine::onInfo( "Worker pool: %ld runs, %ld stolen from another worker's queue",
+	                     WorkerPool::tasksRun( ), WorkerPool::tasksStolen( ) );
+
+	SCS::Engine::onInfo( "Coroutines: %ld started, %ld running",
+	                     CoroutineLoop::coroutinesStarted( ), CoroutineLoop::coroutinesRunning( ) );
+
+	// to compare the IO models...
+	long syscalls = Connection::totalReceiveCalls( ) + NetMessaging::Protocol::sendCalls( ) +
+	                NetMessaging::Protocol::waitCalls( ) + Connection::totalWakeupCalls( );
+	SCS::Engine::onInfo( "Syscalls: %ld recvmsg( ), %ld sendmsg( ), %ld epoll_wait( )/poll( )/io_uring_enter( ), %ld eventfd; %.2f per message received",
+	                     Connection::totalReceiveCalls( ), NetMessaging::Protocol::sendCalls( ),
+	                     NetMessaging::Protocol::waitCalls( ), Connection::totalWakeupCalls( ),
+	                     messagesReceived > 0 ? (double) syscalls / messagesReceived : 0.0 );
+
+	SCS::Engine::onInfo( "Turnaround (message read to replies written): p50 %.1f us, p99 %.1f us over %ld messages",
+	                     Connection::turnaroundPercentile( 0.50 ) / 1000.0, Connection::turnaroundPercentile( 0.99 ) / 1000.0,
+	                     Connection::turnaroundSamples( ) );
 }
 
 
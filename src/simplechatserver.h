@@ -1,11 +1,16 @@
 #ifndef _SIMPLECHATSERVER_H_
 #define _SIMPLECHATSERVER_H_
 
-#include <map>
+#include <vector>
 #include "synchronize.h"
 #include "protocol.h"
 #include "chatroom.h"
+#include "chatroomregistry.h"
+#include "connection.h"
 #include "user.h"
+#include "usertable.h"
+#include "connectiontable.h"
+#include "task.h"
 
 namespace SCS {
 
@@ -14,67 +19,168 @@ class SimpleChatServer : private NetMessaging::Server
   public:
     static const unsigned int DEFAULT_PORT = 7575;
 
+    enum IOModel {
+		IO_THREAD_PER_CLIENT = 0, // one blocking thread per connection
+		IO_EPOLL,                 // edge-triggered epoll event loops, one per reactor thread
+		IO_WORKER_POOL,           // one epoll poller feeding a fixed pool of worker threads
+		IO_COROUTINES,            // one epoll event loop running a coroutine per connection
+		IO_URING                  // one io_uring event loop; falls back to IO_EPOLL without kernel support
+    };
+
+    typedef NetMessaging::Server::Peer Peer;
+
     typedef struct tagThreadArgs {
 		int clientSocket;
+		Connection *pConnection;
     } ThreadArgs;		
 
-    typedef std::map<std::string, Chatroom> TreeMapChatrooms;
-    typedef std::set<User> UserCollection;
+    typedef UserTable UserCollection;
 	
   public:
     static SimpleChatServer *getInstance( );
     ~SimpleChatServer( );
 	
-    bool initialize( unsigned int maxChatrooms, unsigned int maxUsersPerChatroom, unsigned short port, unsigned int maxConnectionsAllowed );
+    bool initialize( unsigned int maxChatrooms, unsigned int maxUsersPerChatroom, unsigned short port, unsigned int maxConnectionsAllowed,
+                     unsigned int reactors = 1, unsigned int backlog = NetMessaging::Server::DEFAULT_BACKLOG );
     bool deinitialize( );
-    int acceptConnection( );
   
-    void handleClient( int clientSocket );
+    void handleClient( const Peer &peer );
     static void *handleClient( void *thread_args );
+    bool runThreadPerClient( );
+    bool runEventLoop( );
+    bool runWorkerPool( unsigned int workers );
+    bool runCoroutines( );
+    bool runUring( );
+    void setThreadStackSize( size_t bytes );
 
     bool handleMessage( int clientSocket, const NetMessaging::Protocol::Message &msg );
+    Task<bool> handleMessageAsync( int clientSocket, const NetMessaging::Protocol::Message &msg );
+    bool sendMessage( int clientSocket, const NetMessaging::Protocol::Message &msg );
+    bool sendMessage( int clientSocket, NetMessaging::Frame *pFrame );
 
-    bool getUserFromSocket( int clientSocket, User &user );
-    bool updateUser( User &user );
-    bool getCopyOfChatroom( const std::string &chatroomName, Chatroom &chatroom );
-    bool updateChatroom( Chatroom &chatroom );
+    const User *getUserFromSocket( int clientSocket ) const;
+    template <typename UserOperation>
+    bool updateUser( int clientSocket, UserOperation &operation );
+    template <typename ChatroomOperation>
+    bool updateChatroom( const std::string &chatroomName, ChatroomOperation &operation );
 
 
 	void logStats( );
   
   private:
+    friend class Reactor;
+    friend class WorkerPool;
+    friend class CoroutineLoop;
+    friend class UringLoop;
     SimpleChatServer( );
 
+    static const int ACCEPT_BATCH = 64; // sockets taken from the backlog per accept4( ) loop
+
     /*
-     *  Message Handlers
+     *  Message Handlers; coroutines, except handleUserLeave( ) which
+     *  also runs when a client is torn down.
      */
-    bool handleUserEnter( int clientSocket, const NetMessaging::Protocol::Message &msg );
+    Task<bool> handleUserEnter( int clientSocket, const NetMessaging::Protocol::Message &msg );
     bool handleUserLeave( int clientSocket, const NetMessaging::Protocol::Message &msg );
-    bool handleChatroomList( int clientSocket, const NetMessaging::Protocol::Message &msg );
-    bool handleUserList( int clientSocket, const NetMessaging::Protocol::Message &msg );
-    bool handleEnterChatroom( int clientSocket, const NetMessaging::Protocol::Message &msg );
-    bool handleLeaveChatroom( int clientSocket, const NetMessaging::Protocol::Message &msg );
-    bool handleSendChatroomMessage( int clientSocket, const NetMessaging::Protocol::Message &msg );
-    bool handleSendUserMessage( int clientSocket, const NetMessaging::Protocol::Message &msg );
+    Task<bool> handleChatroomList( int clientSocket, const NetMessaging::Protocol::Message &msg );
+    Task<bool> handleUserList( int clientSocket, const NetMessaging::Protocol::Message &msg );
+    Task<bool> handleEnterChatroom( int clientSocket, const NetMessaging::Protocol::Message &msg );
+    Task<bool> handleLeaveChatroom( int clientSocket, const NetMessaging::Protocol::Message &msg );
+    Task<bool> handleSendChatroomMessage( int clientSocket, const NetMessaging::Protocol::Message &msg );
+    Task<bool> handleSendUserMessage( int clientSocket, const NetMessaging::Protocol::Message &msg );
+    Task<bool> handleBatch( int clientSocket, const NetMessaging::Protocol::Message &msg );
+
+    /*
+     *	co_await reply( ... ) posts a message to the handler's own client
+     *	and yields true if it was queued.
+     */
+    struct ReplyAwaiter
+    {
+		Connection *pConnection;
+		bool bSent;
+
+		bool await_ready( ) const { return pConnection == NULL; }
+		bool await_suspend( std::coroutine_handle<> handle ) { return pConnection->awaitDrain( handle ); }
+		bool await_resume( ) const { return bSent; }
+    };
+
+    ReplyAwaiter reply( int clientSocket, const NetMessaging::Protocol::Message &msg );
+    Connection *findConnection( int clientSocket );
     void handleDisconnect( int clientSocket );
+    void acceptConnections( int listeningSocket, std::vector<Peer> &admitted, int flags = SOCK_NONBLOCK | SOCK_CLOEXEC );
+    size_t admitConnections( Peer *pPeers, size_t count );
+    void registerConnection( Connection *pConnection );
+    NetMessaging::Protocol::Result receiveMessages( Connection *pConnection, int budget = 0 );
+    NetMessaging::Protocol::Result deliverMessages( Connection *pConnection, const char *pData, size_t bytes );
+    void leaveChatroom( int clientSocket, ChatroomId chatroomId, const std::string &userLabel );
 
   private:
     static SimpleChatServer *m_pInstance;
-    TreeMapChatrooms         m_Chatrooms;
+    ChatroomRegistry         m_Chatrooms;
     UserCollection           m_Users;
+    ConnectionTable          m_Connections;
   
     /*
-     * 	Be careful; the chatroom mutex should always be locked first, followed
-     * 	by the user's mutex. This should avoid most deadlock scenarios.
+     * 	Be careful; chatrooms are locked through m_Chatrooms (shard, then
+     * 	room) before usersLock, never after. A Connection's own queue
+     * 	lock is only ever taken last and never held while taking
+     * 	another lock. See chatroomregistry.h.
      */
-    Lock            chatroomsLock;
     Lock            usersLock;
     Lock            generalLock;
     unsigned int    m_nMaxChatrooms;
     unsigned int    m_nMaxUsersPerChatroom;
     unsigned int    m_nNumberOfConnections;
+    unsigned int    m_nReactors;
+    size_t          m_nStackSize; // bytes per client/worker thread stack, or 0 for the default
+    AtomicCounter   m_Logins;
+    AtomicCounter   m_LoginNanos; // time spent checking and indexing names
+    AtomicCounter   m_ConnectionsRefused;
+    AtomicCounter   m_Batches;
+    AtomicCounter   m_BatchedMessages; // entries across all batches
+    std::vector<int> m_Listeners; // SO_REUSEPORT listeners for reactors 1..N-1
     bool            m_bVerbose;
 };
 
+/*
+ *	Apply operation( User & ) to the user on clientSocket in place, under
+ *	usersLock. Returns false if there is no such user. The operation must
+ *	not change the username; use UserTable::update( ) for that.
+ */
+template <typename UserOperation>
+bool SimpleChatServer::updateUser( int clientSocket, UserOperation &operation )
+{
+    bool bRet = false;
+
+    usersLock.lock( ); // bof crtical section...
+    	User *pUser = m_Users.find( clientSocket );
+    	if( pUser != NULL ) // found user...
+		{
+			operation( *pUser );
+			bRet = true;
+		}
+    usersLock.unlock( ); // eof crtical section...
+
+    return bRet;
+}
+
+/*
+ *	Apply operation( Chatroom & ) to the named chatroom in place, under
+ *	the chatroom's own lock. Returns false if there is no such chatroom.
+ */
+template <typename ChatroomOperation>
+bool SimpleChatServer::updateChatroom( const std::string &chatroomName, ChatroomOperation &operation )
+{
+    Chatroom *pChatroom = m_Chatrooms.acquire( m_Chatrooms.find( chatroomName ) );
+    if( pChatroom == NULL ) return false;
+
+    pChatroom->lock( ); // bof crtical section...
+		operation( *pChatroom );
+    pChatroom->unlock( ); // eof crtical section...
+
+    pChatroom->release( );
+    return true;
+}
+
 } //end of namespace
 #endif
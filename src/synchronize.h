@@ -18,9 +18,133 @@ class Lock
 	Lock( ) { pthread_mutex_init( &theLock, NULL ); }
 	~Lock( ) { pthread_mutex_destroy( &theLock ); }
 	void lock( ) { pthread_mutex_lock( &theLock ); }
+	bool tryLock( ) { return pthread_mutex_trylock( &theLock ) == 0; }
 	void unlock( ) { pthread_mutex_unlock( &theLock ); }
 };
 
+/*
+ *	A counter that may be bumped from any thread without a lock.
+ */
+class AtomicCounter
+{
+  protected:
+	volatile long m_nValue;
+
+  public:
+	explicit AtomicCounter( long value = 0 ) : m_nValue(value) { }
+	long add( long n = 1 ) { return __sync_add_and_fetch( &m_nValue, n ); }
+	long subtract( long n = 1 ) { return __sync_sub_and_fetch( &m_nValue, n ); }
+	long value( ) const { return __atomic_load_n( &m_nValue, __ATOMIC_RELAXED ); }
+
+	// raise the counter to n if it is currently lower (for high-water marks)
+	void raiseTo( long n )
+	{
+		long current = value( );
+		while( current < n && !__sync_bool_compare_and_swap( &m_nValue, current, n ) )
+			current = value( );
+	}
+};
+
+/*
+ *	A counter for the hot paths: every thread bumps a slot of its own,
+ *	on a cache line of its own, so threads never fight over one line;
+ *	the slots are only summed when the value is read. Past STRIPES
+ *	threads (one per client, say) threads share slots, which is still
+ *	correct, just not free. Reading it costs STRIPES loads, so keep it
+ *	for statistics.
+ */
+class StripedCounter
+{
+  public:
+	static const int STRIPES = 64;
+
+	StripedCounter( ) { for( int i = 0; i < STRIPES; i++ ) m_Stripes[ i ].value = 0; }
+	void add( long n = 1 ) { __atomic_add_fetch( &m_Stripes[ stripe( ) ].value, n, __ATOMIC_RELAXED ); }
+	void subtract( long n = 1 ) { add( -n ); }
+
+	long value( ) const
+	{
+		long sum = 0;
+		for( int i = 0; i < STRIPES; i++ ) sum += __atomic_load_n( &m_Stripes[ i ].value, __ATOMIC_RELAXED );
+		return sum;
+	}
+
+  protected:
+	struct alignas(64) Stripe
+	{
+		long value;
+	};
+
+	// the calling thread's slot, handed out in turn the first time it counts anything
+	static int stripe( )
+	{
+		static int next = 0;
+		static thread_local int index = -1;
+		if( index < 0 ) index = __sync_fetch_and_add( &next, 1 ) % STRIPES;
+		return index;
+	}
+
+	Stripe m_Stripes[ STRIPES ];
+};
+
+/*
+ *	Durations in nanoseconds, counted from any thread without a lock.
+ *	Every power of two is split into SUB_BUCKETS buckets, so a reported
+ *	percentile is the lower bound of a bucket at most 12.5% wide.
+ */
+class LatencyHistogram
+{
+  public:
+	static const int SUB_BUCKETS = 8;
+	static const int BUCKETS     = 62 * SUB_BUCKETS;
+
+	void record( long nanos, long count = 1 )
+	{
+		m_Buckets[ bucket( nanos ) ].add( count );
+	}
+
+	// summed when asked, so recording touches just the one bucket
+	long samples( ) const
+	{
+		long sum = 0;
+		for( int i = 0; i < BUCKETS; i++ ) sum += m_Buckets[ i ].value( );
+		return sum;
+	}
+
+	// e.g. percentile( 0.99 ) for the p99; 0 when nothing was recorded
+	long percentile( double fraction ) const
+	{
+		long target = (long) (fraction * samples( ) + 0.5);
+		long seen   = 0;
+		if( target < 1 ) target = 1;
+
+		for( int i = 0; i < BUCKETS; i++ )
+		{
+			seen += m_Buckets[ i ].value( );
+			if( seen >= target ) return lowerBound( i );
+		}
+		return 0;
+	}
+
+  protected:
+	static int bucket( long nanos )
+	{
+		if( nanos < SUB_BUCKETS ) return nanos < 0 ? 0 : (int) nanos;
+
+		int msb   = 63 - __builtin_clzl( (unsigned long) nanos ); // at least 3
+		int index = (msb - 2) * SUB_BUCKETS + (int) ((nanos >> (msb - 3)) & (SUB_BUCKETS - 1));
+		return index < BUCKETS ? index : BUCKETS - 1;
+	}
+
+	static long lowerBound( int index )
+	{
+		if( index < SUB_BUCKETS ) return index;
+		return (long) (SUB_BUCKETS + index % SUB_BUCKETS) << (index / SUB_BUCKETS - 1);
+	}
+
+	AtomicCounter m_Buckets[ BUCKETS ];
+};
+
 template <typename GenericOperation>
 inline void synchronize( Lock &lock, GenericOperation &operation )
 {
@@ -0,0 +1,157 @@
+#ifndef _TASK_H_
+#define _TASK_H_
+/*
+ *	task.h
+ *
+ *	Task<T> is the return type of a C++20 coroutine producing a T. A
+ *	task does not run until it is awaited (co_await task) or, for the
+ *	outermost task of a client, started with start( ); when it finishes
+ *	it resumes whoever awaited it. run( ) drives a task that never
+ *	actually suspends, which is how the blocking IO models call the
+ *	coroutine message handlers. Coroutine frames come from the
+ *	BufferPool, so a message handled does not cost a malloc( ).
+ */
+
+#include <cassert>
+#include <coroutine>
+#include <exception>
+#include "bufferpool.h"
+
+namespace SCS {
+
+template <typename T> class Task;
+
+namespace Detail {
+
+/*
+ *	Everything promise_type needs except how the result is stored.
+ */
+class TaskPromiseBase
+{
+  public:
+	struct FinalAwaiter
+	{
+		bool await_ready( ) const noexcept { return false; }
+
+		template <typename Promise>
+		std::coroutine_handle<> await_suspend( std::coroutine_handle<Promise> handle ) noexcept
+		{
+			std::coroutine_handle<> continuation = handle.promise( ).m_Continuation;
+			return continuation ? continuation : std::noop_coroutine( );
+		}
+
+		void await_resume( ) const noexcept { }
+	};
+
+	std::suspend_always initial_suspend( ) const noexcept { return std::suspend_always( ); }
+	FinalAwaiter final_suspend( ) const noexcept { return FinalAwaiter( ); }
+	void unhandled_exception( ) { std::terminate( ); }
+
+	static void *operator new( size_t size )
+	{ return NetMessaging::BufferPool::allocate( size ); }
+
+	static void operator delete( void *pFrame )
+	{ NetMessaging::BufferPool::release( static_cast<char *>( pFrame ) ); }
+
+	std::coroutine_handle<> m_Continuation; // resumed when the task finishes
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase
+{
+  public:
+	TaskPromise( ) : m_Value( ) { }
+
+	Task<T> get_return_object( );
+	void return_value( const T &value ) { m_Value = value; }
+	T &result( ) { return m_Value; }
+
+  private:
+	T m_Value;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase
+{
+  public:
+	Task<void> get_return_object( );
+	void return_void( ) { }
+	void result( ) { }
+};
+
+} // end of namespace Detail
+
+template <typename T = void>
+class Task
+{
+  public:
+	typedef Detail::TaskPromise<T> promise_type;
+	typedef std::coroutine_handle<promise_type> Handle;
+
+	Task( ) : m_Handle( ) { }
+	explicit Task( Handle handle ) : m_Handle(handle) { }
+	Task( Task &&task ) noexcept : m_Handle(task.m_Handle) { task.m_Handle = Handle( ); }
+	~Task( ) { if( m_Handle ) m_Handle.destroy( ); }
+
+	Task &operator=( Task &&task ) noexcept
+	{
+		if( this != &task )
+		{
+			if( m_Handle ) m_Handle.destroy( );
+			m_Handle      = task.m_Handle;
+			task.m_Handle = Handle( );
+		}
+		return *this;
+	}
+
+	bool isValid( ) const { return (bool) m_Handle; }
+	bool isDone( ) const { return m_Handle && m_Handle.done( ); }
+
+	// run the task until it first suspends; nobody is resumed when it ends
+	void start( ) { m_Handle.resume( ); }
+
+	// run a task that completes without suspending and return its result
+	T run( )
+	{
+		m_Handle.resume( );
+		assert( m_Handle.done( ) );
+		return m_Handle.promise( ).result( );
+	}
+
+	struct Awaiter
+	{
+		Handle handle;
+
+		bool await_ready( ) const noexcept { return false; }
+
+		std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiting ) noexcept
+		{
+			handle.promise( ).m_Continuation = awaiting;
+			return handle; // symmetric transfer; no stack growth
+		}
+
+		T await_resume( ) { return handle.promise( ).result( ); }
+	};
+
+	Awaiter operator co_await( ) const & noexcept { return Awaiter{ m_Handle }; }
+
+  private:
+	Task( const Task &task );
+	Task &operator=( const Task &task );
+
+	Handle m_Handle;
+};
+
+namespace Detail {
+
+template <typename T>
+inline Task<T> TaskPromise<T>::get_return_object( )
+{ return Task<T>( std::coroutine_handle<TaskPromise<T> >::from_promise( *this ) ); }
+
+inline Task<void> TaskPromise<void>::get_return_object( )
+{ return Task<void>( std::coroutine_handle<TaskPromise<void> >::from_promise( *this ) ); }
+
+} // end of namespace Detail
+
+} // end of namespace
+#endif
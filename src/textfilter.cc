@@ -0,0 +1,346 @@
+///////////////////////////////////////////////////////////////////////////////////
+//// TextFilter.cc ////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#include <cstring>
+#include "textfilter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEXTFILTER_X86
+#endif
+
+namespace NetMessaging {
+
+namespace {
+
+inline bool isControl( unsigned char c )
+{ return (c < 0x20 && c != '\t') || c == 0x7F; }
+
+/*
+ *	The non-ASCII character at p; returns what follows it, or NULL if it
+ *	is malformed: a stray continuation byte, an overlong form, a UTF-16
+ *	surrogate, past U+10FFFF, or cut short.
+ */
+const unsigned char *decodeCharacter( const unsigned char *p, const unsigned char *pEnd )
+{
+	unsigned char lead = p[ 0 ];
+	unsigned char low  = 0x80; // the range of the second byte...
+	unsigned char high = 0xBF;
+	size_t length;
+
+	if( lead < 0xC2 ) return NULL;
+	else if( lead < 0xE0 ) length = 2;
+	else if( lead < 0xF0 )
+	{
+		length = 3;
+		if( lead == 0xE0 ) low = 0xA0;       // overlong
+		else if( lead == 0xED ) high = 0x9F; // surrogates
+	}
+	else if( lead < 0xF5 )
+	{
+		length = 4;
+		if( lead == 0xF0 ) low = 0x90;       // overlong
+		else if( lead == 0xF4 ) high = 0x8F; // past U+10FFFF
+	}
+	else return NULL;
+
+	if( (size_t) (pEnd - p) < length || p[ 1 ] < low || p[ 1 ] > high ) return NULL;
+
+	for( size_t i = 2; i < length; i++ )
+	{
+		if( (p[ i ] & 0xC0) != 0x80 ) return NULL;
+	}
+
+	return p + length;
+}
+
+/*
+ *	Decode from p until at least pStop, the last character possibly
+ *	running on up to pEnd. Returns where it stopped, or NULL.
+ */
+const unsigned char *validateRun( const unsigned char *p, const unsigned char *pStop, const unsigned char *pEnd )
+{
+	while( p != NULL && p < pStop )
+	{
+		p = *p < 0x80 ? p + 1 : decodeCharacter( p, pEnd );
+	}
+	return p;
+}
+
+bool validateScalar( const char *pData, size_t size )
+{
+	const unsigned char *p = reinterpret_cast<const unsigned char *>( pData );
+	return validateRun( p, p + size, p + size ) != NULL;
+}
+
+const char *findControlScalar( const char *pBegin, const char *pEnd )
+{
+	while( pBegin < pEnd && !isControl( *pBegin ) ) pBegin++;
+	return pBegin;
+}
+
+#ifdef TEXTFILTER_X86
+/*
+ *	Blocks without a high bit set are ASCII and need no more checking.
+ */
+__attribute__((target("sse2")))
+bool validateSse2( const char *pData, size_t size )
+{
+	const unsigned char *p = reinterpret_cast<const unsigned char *>( pData );
+	const unsigned char *pEnd = p + size;
+
+	while( pEnd - p >= 16 )
+	{
+		if( _mm_movemask_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i *>( p ) ) ) == 0 ) p += 16;
+		else if( (p = validateRun( p, p + 16, pEnd )) == NULL ) return false;
+	}
+
+	return validateRun( p, pEnd, pEnd ) != NULL;
+}
+
+__attribute__((target("sse2")))
+const char *findControlSse2( const char *pBegin, const char *pEnd )
+{
+	const __m128i below  = _mm_set1_epi8( 0x1F );
+	const __m128i del    = _mm_set1_epi8( 0x7F );
+	const __m128i tab    = _mm_set1_epi8( '\t' );
+
+	for( ; pEnd - pBegin >= 16; pBegin += 16 )
+	{
+		__m128i block = _mm_loadu_si128( reinterpret_cast<const __m128i *>( pBegin ) );
+		__m128i control = _mm_or_si128( _mm_cmpeq_epi8( _mm_min_epu8( block, below ), block ), _mm_cmpeq_epi8( block, del ) );
+		int mask = _mm_movemask_epi8( _mm_andnot_si128( _mm_cmpeq_epi8( block, tab ), control ) );
+		if( mask != 0 ) return pBegin + __builtin_ctz( mask );
+	}
+
+	return findControlScalar( pBegin, pEnd );
+}
+
+/*
+ *	Every error a pair of bytes can show, one bit each, looked up three
+ *	times -- by the high and low nibbles of the first byte and the high
+ *	nibble of the second -- and ANDed; a bit that survives is an error.
+ *	A continuation byte two or three places after a 3 or 4 byte lead is
+ *	expected to come out as TWO_CONTS, and anything else as 0.
+ */
+enum {
+	TOO_SHORT      = 1 << 0, // a lead not followed by a continuation
+	TOO_LONG       = 1 << 1, // ASCII followed by a continuation
+	OVERLONG_3     = 1 << 2,
+	TOO_LARGE      = 1 << 3,
+	SURROGATE      = 1 << 4,
+	OVERLONG_2     = 1 << 5,
+	TOO_LARGE_1000 = 1 << 6,
+	OVERLONG_4     = 1 << 6,
+	TWO_CONTS      = 1 << 7, // two continuations in a row
+	CARRY          = TOO_SHORT | TOO_LONG | TWO_CONTS
+};
+
+#define AVX2_INLINE __attribute__((target("avx2"), always_inline)) inline // even at -O0
+
+alignas(16) const unsigned char FIRST_HIGH[ 16 ] = {
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+	TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+	TOO_SHORT | OVERLONG_2,
+	TOO_SHORT,
+	TOO_SHORT | OVERLONG_3 | SURROGATE,
+	TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+};
+
+alignas(16) const unsigned char FIRST_LOW[ 16 ] = {
+	CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+	CARRY | OVERLONG_2,
+	CARRY,
+	CARRY,
+	CARRY | TOO_LARGE,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+alignas(16) const unsigned char SECOND_HIGH[ 16 ] = {
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+
+/*
+ *	Above these, the last three bytes of a block are leads of characters
+ *	longer than what is left of the block.
+ */
+alignas(32) const unsigned char INCOMPLETE_LIMITS[ 32 ] = {
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+};
+
+/*
+ *	Look every byte of indices (0 to 15 each) up in a 16 entry table.
+ */
+AVX2_INLINE __m256i lookup( const __m256i &indices, const unsigned char *pTable )
+{ return _mm256_shuffle_epi8( _mm256_broadcastsi128_si256( _mm_load_si128( reinterpret_cast<const __m128i *>( pTable ) ) ), indices ); }
+
+AVX2_INLINE __m256i highNibbles( const __m256i &bytes )
+{ return _mm256_and_si256( _mm256_srli_epi16( bytes, 4 ), _mm256_set1_epi8( 0x0F ) ); }
+
+/*
+ *	The block shifted N bytes later, the last N of previous moving in.
+ */
+template <int N>
+AVX2_INLINE __m256i precedingBytes( const __m256i &block, const __m256i &previous )
+{ return _mm256_alignr_epi8( block, _mm256_permute2x128_si256( previous, block, 0x21 ), 16 - N ); }
+
+AVX2_INLINE __m256i blockErrors( const __m256i &block, const __m256i &previous )
+{
+	__m256i previous1 = precedingBytes<1>( block, previous );
+	__m256i pairErrors = _mm256_and_si256( _mm256_and_si256( lookup( highNibbles( previous1 ), FIRST_HIGH ),
+	                                                         lookup( _mm256_and_si256( previous1, _mm256_set1_epi8( 0x0F ) ), FIRST_LOW ) ),
+	                                       lookup( highNibbles( block ), SECOND_HIGH ) );
+
+	// 0x80 where a 3 or 4 byte lead is two or three bytes back...
+	__m256i third  = _mm256_subs_epu8( precedingBytes<2>( block, previous ), _mm256_set1_epi8( (char) (0xE0 - 0x80) ) );
+	__m256i fourth = _mm256_subs_epu8( precedingBytes<3>( block, previous ), _mm256_set1_epi8( (char) (0xF0 - 0x80) ) );
+	__m256i expected = _mm256_and_si256( _mm256_or_si256( third, fourth ), _mm256_set1_epi8( (char) 0x80 ) );
+
+	return _mm256_xor_si256( pairErrors, expected );
+}
+
+/*
+ *	Non-zero if the block ends in the middle of a character.
+ */
+AVX2_INLINE __m256i blockIncomplete( const __m256i &block )
+{ return _mm256_subs_epu8( block, _mm256_load_si256( reinterpret_cast<const __m256i *>( INCOMPLETE_LIMITS ) ) ); }
+
+__attribute__((target("avx2")))
+bool validateAvx2( const char *pData, size_t size )
+{
+	__m256i errors     = _mm256_setzero_si256( );
+	__m256i previous   = _mm256_setzero_si256( );
+	__m256i incomplete = _mm256_setzero_si256( );
+	size_t offset = 0;
+
+	for( ; size - offset >= 32; offset += 32 )
+	{
+		__m256i block = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( pData + offset ) );
+
+		if( _mm256_movemask_epi8( block ) == 0 )
+		{
+			errors = _mm256_or_si256( errors, incomplete ); // ASCII can't finish what the last block started
+			incomplete = _mm256_setzero_si256( );
+		}
+		else
+		{
+			errors = _mm256_or_si256( errors, blockErrors( block, previous ) );
+			incomplete = blockIncomplete( block );
+		}
+		previous = block;
+	}
+
+	if( offset < size ) // the rest, padded with ASCII NULs that cut any character short
+	{
+		alignas(32) char tail[ 32 ] = { 0 };
+		memcpy( tail, pData + offset, size - offset );
+		__m256i block = _mm256_load_si256( reinterpret_cast<const __m256i *>( tail ) );
+
+		if( _mm256_movemask_epi8( block ) == 0 ) errors = _mm256_or_si256( errors, incomplete );
+		else errors = _mm256_or_si256( errors, blockErrors( block, previous ) );
+		incomplete = _mm256_setzero_si256( );
+	}
+
+	errors = _mm256_or_si256( errors, incomplete );
+	return _mm256_testz_si256( errors, errors ) != 0;
+}
+
+__attribute__((target("avx2")))
+const char *findControlAvx2( const char *pBegin, const char *pEnd )
+{
+	const __m256i below = _mm256_set1_epi8( 0x1F );
+	const __m256i del   = _mm256_set1_epi8( 0x7F );
+	const __m256i tab   = _mm256_set1_epi8( '\t' );
+
+	for( ; pEnd - pBegin >= 32; pBegin += 32 )
+	{
+		__m256i block = _mm256_loadu_si256( reinterpret_cast<const __m256i *>( pBegin ) );
+		__m256i control = _mm256_or_si256( _mm256_cmpeq_epi8( _mm256_min_epu8( block, below ), block ), _mm256_cmpeq_epi8( block, del ) );
+		unsigned int mask = (unsigned int) _mm256_movemask_epi8( _mm256_andnot_si256( _mm256_cmpeq_epi8( block, tab ), control ) );
+		if( mask != 0 ) return pBegin + __builtin_ctz( mask );
+	}
+
+	// the last 31 bytes or less; VEX encoded like the rest (see findAvx2( ) in fieldtokenizer.cc)
+	if( pEnd - pBegin >= 16 )
+	{
+		__m128i block = _mm_loadu_si128( reinterpret_cast<const __m128i *>( pBegin ) );
+		__m128i control = _mm_or_si128( _mm_cmpeq_epi8( _mm_min_epu8( block, _mm256_castsi256_si128( below ) ), block ),
+		                                _mm_cmpeq_epi8( block, _mm256_castsi256_si128( del ) ) );
+		int mask = _mm_movemask_epi8( _mm_andnot_si128( _mm_cmpeq_epi8( block, _mm256_castsi256_si128( tab ) ), control ) );
+		if( mask != 0 ) return pBegin + __builtin_ctz( mask );
+		pBegin += 16;
+	}
+
+	return findControlScalar( pBegin, pEnd );
+}
+#endif
+
+TextFilter::Implementation selectImplementation( )
+{
+	#ifdef TEXTFILTER_X86
+	__builtin_cpu_init( ); // we run before main( )
+	if( __builtin_cpu_supports( "avx2" ) ) return TextFilter::AVX2;
+	if( __builtin_cpu_supports( "sse2" ) ) return TextFilter::SSE2;
+	#endif
+	return TextFilter::SCALAR;
+}
+
+} // end of anonymous namespace
+
+#ifdef TEXTFILTER_X86
+const TextFilter::ValidateFunction TextFilter::m_Validate[ IMPLEMENTATIONS ] = { validateScalar, validateSse2, validateAvx2 };
+const TextFilter::FindControlFunction TextFilter::m_FindControl[ IMPLEMENTATIONS ] = { findControlScalar, findControlSse2, findControlAvx2 };
+#else
+const TextFilter::ValidateFunction TextFilter::m_Validate[ IMPLEMENTATIONS ] = { validateScalar, validateScalar, validateScalar };
+const TextFilter::FindControlFunction TextFilter::m_FindControl[ IMPLEMENTATIONS ] = { findControlScalar, findControlScalar, findControlScalar };
+#endif
+const TextFilter::Implementation TextFilter::m_Implementation = selectImplementation( );
+
+/*
+ * 	Squeeze the control characters out of the text in place, a run of
+ * 	ordinary characters at a time.
+ */
+size_t TextFilter::stripControls( char *pData, size_t size )
+{
+	const char *pEnd = pData + size;
+	char *pWrite = const_cast<char *>( findControl( pData, pEnd ) );
+	const char *pRead = pWrite;
+
+	while( pRead < pEnd )
+	{
+		pRead++; // past the control character
+		const char *pNext = findControl( pRead, pEnd );
+
+		memmove( pWrite, pRead, pNext - pRead );
+		pWrite += pNext - pRead;
+		pRead   = pNext;
+	}
+
+	return pWrite - pData;
+}
+
+bool TextFilter::isSupported( Implementation implementation )
+{
+	return implementation <= m_Implementation;
+}
+
+const char *TextFilter::name( Implementation implementation )
+{
+	static const char *names[ IMPLEMENTATIONS ] = { "scalar", "SSE2", "AVX2" };
+	return names[ implementation ];
+}
+
+}// end of namespace
@@ -0,0 +1,73 @@
+#ifndef _TEXTFILTER_H_
+#define _TEXTFILTER_H_
+///////////////////////////////////////////////////////////////////////////////////
+//// TextFilter.h /////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+
+namespace NetMessaging {
+
+/*
+ *	Checks of text that came in from a client before anybody else sees
+ *	it: is it well-formed UTF-8, and where are its control characters.
+ *
+ *	With AVX2, UTF-8 is validated 32 bytes at a time by table lookups on
+ *	each byte and the three before it (Keiser and Lemire's algorithm),
+ *	with no per-character branches; runs of plain ASCII are skipped with
+ *	a single test. With SSE2 only the ASCII runs are skipped, 16 bytes
+ *	at a time, and anything else is decoded a character at a time, as
+ *	everything is on other CPUs.
+ *
+ *	Control characters are the C0 ones except tab, and DEL.
+ */
+class TextFilter
+{
+  public:
+	enum Implementation {
+		SCALAR = 0,
+		SSE2,
+		AVX2,
+		IMPLEMENTATIONS
+	};
+
+	static bool isValidUtf8( const char *pData, size_t size );
+	static const char *findControl( const char *pBegin, const char *pEnd );
+	static size_t stripControls( char *pData, size_t size ); // returns the new size
+
+	static Implementation implementation( );
+	static bool isSupported( Implementation implementation );
+	static const char *name( Implementation implementation );
+
+	// the same with the given implementation, which must be supported
+	static bool isValidUtf8( Implementation implementation, const char *pData, size_t size );
+	static const char *findControl( Implementation implementation, const char *pBegin, const char *pEnd );
+
+  protected:
+	typedef bool (*ValidateFunction)( const char *pData, size_t size );
+	typedef const char *(*FindControlFunction)( const char *pBegin, const char *pEnd );
+
+	static const ValidateFunction m_Validate[ IMPLEMENTATIONS ];
+	static const FindControlFunction m_FindControl[ IMPLEMENTATIONS ];
+	static const Implementation m_Implementation; // the best the CPU has
+};
+
+inline bool TextFilter::isValidUtf8( const char *pData, size_t size )
+{ return m_Validate[ m_Implementation ]( pData, size ); }
+
+/*
+ * 	The first control character in [pBegin, pEnd), or pEnd.
+ */
+inline const char *TextFilter::findControl( const char *pBegin, const char *pEnd )
+{ return m_FindControl[ m_Implementation ]( pBegin, pEnd ); }
+
+inline bool TextFilter::isValidUtf8( Implementation implementation, const char *pData, size_t size )
+{ return m_Validate[ implementation ]( pData, size ); }
+
+inline const char *TextFilter::findControl( Implementation implementation, const char *pBegin, const char *pEnd )
+{ return m_FindControl[ implementation ]( pBegin, pEnd ); }
+
+inline TextFilter::Implementation TextFilter::implementation( )
+{ return m_Implementation; }
+
+}// end of namespace
+#endif
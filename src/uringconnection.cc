@@ -0,0 +1,160 @@
+#include "uringconnection.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+
+namespace SCS {
+
+UringConnection::UringConnection( int socket, const NetMessaging::PeerAddress &peerAddress )
+  : Connection(socket, peerAddress), m_nSendsInFlight(0), m_nInFlight(0),
+    m_bReceiving(false), m_bWaking(false), m_bSendFailed(false)
+{
+	memset( m_Headers, 0, sizeof(m_Headers) );
+}
+
+UringConnection::~UringConnection( )
+{
+	assert( m_nInFlight == 0 ); // the kernel may still write into us otherwise
+}
+
+/*
+ *	One multishot receive keeps delivering into the buffer group until
+ *	the peer closes, an error occurs or the group runs dry (ENOBUFS).
+ */
+bool UringConnection::prepareReceive( NetMessaging::Ring &ring, unsigned short bufferGroup )
+{
+	struct io_uring_sqe *pSqe = ring.prepare( IORING_OP_RECV, m_Socket, userData( OP_RECEIVE ) );
+	if( pSqe == NULL ) return false;
+
+	pSqe->ioprio    = IORING_RECV_MULTISHOT;
+	pSqe->flags     = IOSQE_BUFFER_SELECT;
+	pSqe->buf_group = bufferGroup;
+
+	m_bReceiving = true;
+	m_nInFlight++;
+	return true;
+}
+
+/*
+ *	A multishot poll reports every post to an empty mailbox.
+ */
+bool UringConnection::prepareWakeup( NetMessaging::Ring &ring )
+{
+	struct io_uring_sqe *pSqe = ring.prepare( IORING_OP_POLL_ADD, m_WakeupSocket, userData( OP_WAKEUP ) );
+	if( pSqe == NULL ) return false;
+
+	pSqe->len           = IORING_POLL_ADD_MULTI;
+	pSqe->poll32_events = POLLIN;
+
+	m_bWaking = true;
+	m_nInFlight++;
+	return true;
+}
+
+/*
+ *	Queue one chain of linked sendmsg requests covering up to
+ *	MAX_LINKED_SENDS * WRITE_BATCH_SIZE frames of the outbound queue.
+ *	The chain runs in order and MSG_WAITALL makes each request send all
+ *	of its bytes or fail, which cancels the rest. Returns the number of
+ *	requests queued (0 if already sending or nothing is queued) or -1 if
+ *	the ring is full.
+ */
+int UringConnection::prepareSends( NetMessaging::Ring &ring )
+{
+	if( isSending( ) ) return 0;
+
+	if( m_Outbound.empty( ) )
+	{
+		recordTurnaround( ); // whatever was handled needed no reply
+		return 0;
+	}
+
+	size_t frames = m_Outbound.size( ) < (size_t) (MAX_LINKED_SENDS * WRITE_BATCH_SIZE) ? m_Outbound.size( ) : MAX_LINKED_SENDS * WRITE_BATCH_SIZE;
+	int sends = (int) ((frames + WRITE_BATCH_SIZE - 1) / WRITE_BATCH_SIZE);
+
+	if( !ring.reserve( sends ) ) return -1;
+	compressQueued( frames );
+
+	for( int i = 0; i < sends; i++ )
+	{
+		int vectorCount = gatherQueued( (size_t) i * WRITE_BATCH_SIZE, WRITE_BATCH_SIZE, m_Vectors[ i ] );
+
+		memset( &m_Headers[ i ], 0, sizeof(m_Headers[ i ]) );
+		m_Headers[ i ].msg_iov    = m_Vectors[ i ];
+		m_Headers[ i ].msg_iovlen = vectorCount;
+
+		struct io_uring_sqe *pSqe = ring.prepare( IORING_OP_SENDMSG, m_Socket, userData( OP_SEND ) );
+		pSqe->addr      = (uint64_t) (uintptr_t) &m_Headers[ i ];
+		pSqe->len       = 1;
+		pSqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+		if( i + 1 < sends ) pSqe->flags = IOSQE_IO_LINK;
+	}
+
+	m_nPinned        = frames;
+	m_nSendsInFlight = sends;
+	m_nInFlight     += sends;
+	return sends;
+}
+
+/*
+ *	Cancel the multishot requests; their final completions still come.
+ */
+void UringConnection::prepareCancel( NetMessaging::Ring &ring )
+{
+	Operation operations[ 2 ] = { OP_RECEIVE, OP_WAKEUP };
+	bool armed[ 2 ] = { m_bReceiving, m_bWaking };
+
+	for( int i = 0; i < 2; i++ )
+	{
+		if( !armed[ i ] ) continue;
+
+		struct io_uring_sqe *pSqe = ring.prepare( IORING_OP_ASYNC_CANCEL, -1, OP_CANCEL );
+		if( pSqe != NULL ) pSqe->addr = userData( operations[ i ] );
+	}
+}
+
+/*
+ *	Account for one request of the send chain. Returns true once the
+ *	whole chain has completed; see hasFailed( ).
+ */
+bool UringConnection::completeSend( int result )
+{
+	assert( m_nSendsInFlight > 0 );
+	m_nSendsInFlight--;
+
+	if( result > 0 ) completeWrite( result );
+	else if( result < 0 ) m_bSendFailed = true; // or -ECANCELED after an earlier one failed
+
+	if( m_nSendsInFlight > 0 ) return false;
+
+	m_nPinned = 0;
+	if( !m_bSendFailed && m_Outbound.empty( ) ) recordTurnaround( );
+	return true;
+}
+
+void UringConnection::completed( bool bFinal )
+{
+	if( bFinal ) m_nInFlight--;
+}
+
+/*
+ *	Returns true if nothing was waiting before.
+ */
+bool UringConnection::pushReceived( const Received &received )
+{
+	m_Received.push_back( received );
+	return m_Received.size( ) == 1;
+}
+
+UringConnection::Received UringConnection::popReceived( )
+{
+	Received received = m_Received.front( );
+	m_Received.pop_front( );
+	return received;
+}
+
+} // end of namespace
+#endif
@@ -0,0 +1,119 @@
+#ifndef _URINGCONNECTION_H_
+#define _URINGCONNECTION_H_
+/*
+ *	uringconnection.h
+ *
+ *	A Connection served by io_uring (see uringloop.h). The socket is only
+ *	ever read by a multishot receive into the ring's provided buffers and
+ *	written by chains of linked sendmsg requests straight from the
+ *	outbound queue; the frames they send from are pinned so that the
+ *	overflow policy leaves them alone until the kernel is done.
+ */
+
+#include "ring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <deque>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "connection.h"
+
+namespace SCS {
+
+class UringConnection : public Connection
+{
+  public:
+	/*
+	 *	Which request a completion belongs to, in the low bits of its
+	 *	user_data; the rest is the connection, or NULL for the listener.
+	 */
+	enum Operation {
+		OP_ACCEPT = 0,
+		OP_RECEIVE,
+		OP_SEND,
+		OP_WAKEUP,
+		OP_CANCEL
+	};
+
+	/*
+	 *	A receive completion waiting for its turn to be handled.
+	 */
+	struct Received {
+		int result;   // bytes, 0 at the end of the stream, or -errno
+		int bufferId; // the provided buffer holding them, or -1
+	};
+
+	explicit UringConnection( int socket, const NetMessaging::PeerAddress &peerAddress = NetMessaging::PeerAddress( ) );
+	virtual ~UringConnection( );
+
+	uint64_t userData( Operation operation ) const;
+	static UringConnection *fromUserData( uint64_t userData, Operation *pOperation );
+
+	bool prepareReceive( NetMessaging::Ring &ring, unsigned short bufferGroup );
+	bool prepareWakeup( NetMessaging::Ring &ring );
+	int prepareSends( NetMessaging::Ring &ring );
+	void prepareCancel( NetMessaging::Ring &ring );
+
+	bool completeSend( int result );
+	void completed( bool bFinal );
+
+	bool pushReceived( const Received &received );
+	bool hasReceived( ) const;
+	Received popReceived( );
+
+	using Connection::collectPosted;
+	bool isReceiving( ) const;
+	bool isSending( ) const;
+	bool hasFailed( ) const;
+	bool isIdle( ) const;
+
+	void stopReceiving( );
+	void stopWaking( );
+
+  protected:
+	static const uint64_t OPERATION_MASK = 7; // Connections are at least 8 byte aligned
+	static const int MAX_LINKED_SENDS    = 4; // sendmsg requests in one chain
+
+	struct msghdr m_Headers[ MAX_LINKED_SENDS ];
+	struct iovec m_Vectors[ MAX_LINKED_SENDS ][ WRITE_BATCH_SIZE * NetMessaging::Frame::MAX_VECTORS ];
+	int m_nSendsInFlight;
+	int m_nInFlight;      // requests whose final completion has not arrived
+	bool m_bReceiving;    // a multishot receive is armed
+	bool m_bWaking;       // a multishot poll on the wakeup eventfd is armed
+	bool m_bSendFailed;
+	std::deque<Received> m_Received;
+};
+
+inline uint64_t UringConnection::userData( Operation operation ) const
+{ return (uint64_t) (uintptr_t) this | operation; }
+
+inline UringConnection *UringConnection::fromUserData( uint64_t userData, Operation *pOperation )
+{
+	*pOperation = (Operation) (userData & OPERATION_MASK);
+	return reinterpret_cast<UringConnection *>( (uintptr_t) (userData & ~OPERATION_MASK) );
+}
+
+inline bool UringConnection::hasReceived( ) const
+{ return !m_Received.empty( ); }
+
+inline bool UringConnection::isReceiving( ) const
+{ return m_bReceiving; }
+
+inline bool UringConnection::isSending( ) const
+{ return m_nSendsInFlight > 0; }
+
+inline bool UringConnection::hasFailed( ) const
+{ return m_bSendFailed; }
+
+inline bool UringConnection::isIdle( ) const
+{ return m_nInFlight == 0; }
+
+inline void UringConnection::stopReceiving( )
+{ m_bReceiving = false; }
+
+inline void UringConnection::stopWaking( )
+{ m_bWaking = false; }
+
+} // end of namespace
+#endif
+#endif
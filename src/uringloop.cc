@@ -0,0 +1,317 @@
+#include "uringloop.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <cassert>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "simplechatserver.h"
+#include "engine.h"
+
+namespace SCS {
+
+UringLoop::UringLoop( SimpleChatServer *pServer, int listeningSocket )
+  : m_pServer(pServer), m_ListeningSocket(listeningSocket), m_bAccepting(false)
+{
+	assert( m_pServer != NULL );
+}
+
+UringLoop::~UringLoop( )
+{
+}
+
+/*
+ *	Returns false if this kernel cannot run the loop. Multishot receive
+ *	(6.0) cannot be probed for, so the zero-copy send that came with it
+ *	stands in for it.
+ */
+bool UringLoop::setup( )
+{
+	if( !m_Ring.setup( RING_ENTRIES ) )
+	{
+		Engine::onInfo( "Could not set up io_uring; errno = %d", errno );
+		return false;
+	}
+
+	static const unsigned char required[ ] = {
+		IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_POLL_ADD,
+		IORING_OP_ASYNC_CANCEL, IORING_OP_SEND_ZC
+	};
+
+	for( size_t i = 0; i < sizeof(required) / sizeof(required[ 0 ]); i++ )
+	{
+		if( !m_Ring.supports( required[ i ] ) )
+		{
+			Engine::onInfo( "This kernel's io_uring does not support opcode %d.", required[ i ] );
+			return false;
+		}
+	}
+
+	if( !m_Ring.setupBuffers( BUFFER_GROUP, BUFFER_COUNT, BUFFER_SIZE ) )
+	{
+		Engine::onInfo( "Could not register io_uring provided buffers; errno = %d", errno );
+		return false;
+	}
+
+	return true;
+}
+
+bool UringLoop::run( )
+{
+	if( !armAccept( ) )
+	{
+		Engine::onError( "Could not queue the multishot accept." );
+		return false;
+	}
+
+	Engine::onInfo( "Serving clients from an io_uring event loop (listener = %d, %u receive buffers of %u bytes).",
+	                m_ListeningSocket, BUFFER_COUNT, BUFFER_SIZE );
+
+	while( true )
+	{
+		if( m_Ring.submitAndWait( m_Ready.empty( ) ? 1 : 0 ) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY )
+		{
+			Engine::onError( "io_uring_enter( ) failed; errno = %d", errno );
+			return false;
+		}
+
+		struct io_uring_cqe *pCqe;
+
+		while( (pCqe = m_Ring.peek( )) != NULL )
+		{
+			struct io_uring_cqe cqe = *pCqe;
+			m_Ring.advance( ); // handling it may need room for more
+			handleCompletion( cqe );
+		}
+
+		if( !m_Accepted.empty( ) ) acceptClients( );
+
+		// then a turn for every client with input...
+		std::vector<UringConnection *> ready;
+		ready.swap( m_Ready );
+
+		for( size_t i = 0; i < ready.size( ); i++ )
+		{
+			if( !ready[ i ]->isRetired( ) ) handleReceived( ready[ i ] );
+		}
+
+		std::vector<UringConnection *> starved;
+		starved.swap( m_Starved );
+
+		for( size_t i = 0; i < starved.size( ); i++ )
+		{
+			UringConnection *pConnection = starved[ i ];
+			if( pConnection->isRetired( ) || pConnection->isReceiving( ) ) continue;
+
+			if( pConnection->hasReceived( ) ) m_Starved.push_back( pConnection );
+			else if( !pConnection->prepareReceive( m_Ring, BUFFER_GROUP ) ) closeConnection( pConnection );
+		}
+
+		if( !m_bAccepting && !armAccept( ) ) Engine::onError( "Could not queue the multishot accept." );
+
+		reap( );
+	}
+
+	return true;
+}
+
+/*
+ *	Accepted sockets stay blocking: only the kernel, on our behalf,
+ *	ever reads or writes them.
+ */
+bool UringLoop::armAccept( )
+{
+	struct io_uring_sqe *pSqe = m_Ring.prepare( IORING_OP_ACCEPT, m_ListeningSocket, UringConnection::OP_ACCEPT );
+	if( pSqe == NULL ) return false;
+
+	pSqe->ioprio       = IORING_ACCEPT_MULTISHOT;
+	pSqe->accept_flags = SOCK_CLOEXEC;
+
+	m_bAccepting = true;
+	return true;
+}
+
+void UringLoop::handleCompletion( const struct io_uring_cqe &cqe )
+{
+	UringConnection::Operation operation;
+	UringConnection *pConnection = UringConnection::fromUserData( cqe.user_data, &operation );
+	bool bMore = (cqe.flags & IORING_CQE_F_MORE) != 0;
+
+	switch( operation )
+	{
+		case UringConnection::OP_ACCEPT:
+			if( !bMore ) m_bAccepting = false; // re-armed after this batch
+			if( cqe.res >= 0 )
+			{
+				NetMessaging::Server::Peer peer = { cqe.res, NetMessaging::PeerAddress( ) };
+				m_Accepted.push_back( peer );
+			}
+			else Engine::onError( "Multishot accept failed; errno = %d", -cqe.res );
+			break;
+
+		case UringConnection::OP_RECEIVE:
+		{
+			pConnection->completed( !bMore );
+			if( !bMore ) pConnection->stopReceiving( );
+
+			UringConnection::Received received;
+			received.result   = cqe.res;
+			received.bufferId = (cqe.flags & IORING_CQE_F_BUFFER) ? (int) (cqe.flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+
+			if( pConnection->isRetired( ) )
+			{
+				if( received.bufferId >= 0 ) m_Ring.recycle( received.bufferId );
+			}
+			else if( received.result == -ENOBUFS )
+			{
+				m_Starved.push_back( pConnection );
+			}
+			else if( pConnection->pushReceived( received ) )
+			{
+				m_Ready.push_back( pConnection );
+			}
+			break;
+		}
+
+		case UringConnection::OP_WAKEUP:
+			pConnection->completed( !bMore );
+			if( !bMore ) pConnection->stopWaking( );
+			if( pConnection->isRetired( ) ) break;
+
+			pConnection->clearWakeup( );
+			if( !bMore && !pConnection->prepareWakeup( m_Ring ) ) closeConnection( pConnection );
+			else sendQueued( pConnection );
+			break;
+
+		case UringConnection::OP_SEND:
+			pConnection->completed( true );
+			if( !pConnection->completeSend( cqe.res ) || pConnection->isRetired( ) ) break;
+
+			if( pConnection->hasFailed( ) ) closeConnection( pConnection );
+			else sendQueued( pConnection ); // whatever was queued meanwhile
+			break;
+
+		case UringConnection::OP_CANCEL:
+		default:
+			break;
+	}
+}
+
+/*
+ *	Everything the multishot accept produced during one batch of
+ *	completions is admitted under one lock. A multishot accept cannot
+ *	report addresses, so each admitted client's is asked for once here.
+ */
+void UringLoop::acceptClients( )
+{
+	NetMessaging::Server::countAcceptBatch( (int) m_Accepted.size( ) );
+	size_t admitted = m_pServer->admitConnections( &m_Accepted[ 0 ], m_Accepted.size( ) );
+
+	for( size_t i = 0; i < admitted; i++ )
+	{
+		int clientSocket = m_Accepted[ i ].socket;
+		UringConnection *pConnection = new UringConnection( clientSocket, NetMessaging::Server::peerAddress( clientSocket ) );
+		m_pServer->registerConnection( pConnection );
+
+		if( pConnection->wakeupSocket( ) < 0 ||
+		    !pConnection->prepareReceive( m_Ring, BUFFER_GROUP ) ||
+		    !pConnection->prepareWakeup( m_Ring ) )
+		{
+			Engine::onError( "Client socket = %d, could not queue its receive.", clientSocket );
+			closeConnection( pConnection );
+		}
+	}
+
+	m_Accepted.clear( );
+}
+
+/*
+ *	Handle up to READ_BUDGET of the client's receive completions: the
+ *	bytes are copied into its parser and the buffers go straight back to
+ *	the kernel. Replies to what was handled are sent right after,
+ *	without a wakeup.
+ */
+void UringLoop::handleReceived( UringConnection *pConnection )
+{
+	pConnection->beginBatch( );
+
+	for( int reads = 0; reads < READ_BUDGET && pConnection->hasReceived( ); reads++ )
+	{
+		UringConnection::Received received = pConnection->popReceived( );
+		NetMessaging::Protocol::Result result = NetMessaging::Protocol::FAILED; // closed by the peer, or an error
+
+		if( received.result > 0 )
+		{
+			result = m_pServer->deliverMessages( pConnection, m_Ring.buffer( received.bufferId ), received.result );
+		}
+
+		if( received.bufferId >= 0 ) m_Ring.recycle( received.bufferId );
+
+		if( result == NetMessaging::Protocol::FAILED )
+		{
+			closeConnection( pConnection );
+			return;
+		}
+	}
+
+	// the multishot receive ends if, e.g., the completion queue overflowed...
+	if( !pConnection->isReceiving( ) && !pConnection->hasReceived( ) && !pConnection->prepareReceive( m_Ring, BUFFER_GROUP ) )
+	{
+		closeConnection( pConnection );
+		return;
+	}
+
+	if( pConnection->hasReceived( ) ) m_Ready.push_back( pConnection );
+
+	sendQueued( pConnection );
+}
+
+/*
+ *	Collect the mailbox and, unless a send chain is still running (its
+ *	completion comes back here), start one for the outbound queue.
+ */
+void UringLoop::sendQueued( UringConnection *pConnection )
+{
+	if( !pConnection->collectPosted( ) || (!pConnection->isSending( ) && pConnection->prepareSends( m_Ring ) < 0) )
+	{
+		closeConnection( pConnection );
+	}
+}
+
+void UringLoop::closeConnection( UringConnection *pConnection )
+{
+	int clientSocket = pConnection->socket( );
+	pConnection->retire( );
+	pConnection->prepareCancel( m_Ring );
+
+	while( pConnection->hasReceived( ) )
+	{
+		UringConnection::Received received = pConnection->popReceived( );
+		if( received.bufferId >= 0 ) m_Ring.recycle( received.bufferId );
+	}
+
+	// remove user from all chatrooms...
+	NetMessaging::Protocol::Message message;
+	NetMessaging::Protocol::initializeMessage( message );
+	m_pServer->handleUserLeave( clientSocket, message );
+	m_pServer->handleDisconnect( clientSocket );
+
+	// the kernel still holds requests for it...
+	m_Closed.push_back( pConnection );
+}
+
+void UringLoop::reap( )
+{
+	size_t kept = 0;
+
+	for( size_t i = 0; i < m_Closed.size( ); i++ )
+	{
+		if( m_Closed[ i ]->isIdle( ) ) delete m_Closed[ i ];
+		else m_Closed[ kept++ ] = m_Closed[ i ];
+	}
+
+	m_Closed.resize( kept );
+}
+
+} // end of namespace
+#endif
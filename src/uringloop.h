@@ -0,0 +1,74 @@
+#ifndef _URINGLOOP_H_
+#define _URINGLOOP_H_
+/*
+ *	uringloop.h
+ *
+ *	Event loop on io_uring instead of epoll. One multishot accept feeds
+ *	it clients; each client's socket is read by one multishot receive
+ *	into provided buffers shared by every client, and its outbound queue
+ *	is written by chains of linked sendmsg requests. Mailbox wakeups
+ *	arrive as multishot poll completions on the wakeup eventfd. All of it
+ *	is submitted, and completions waited for, with one io_uring_enter( )
+ *	per turn of the loop.
+ *
+ *	The kernel receives as fast as data arrives, so a client gets through
+ *	at most READ_BUDGET of its receive completions per turn and the rest
+ *	wait, holding on to their buffers, until the others (and the sends
+ *	to them) had a turn; a client that keeps it up eventually runs the
+ *	buffers dry and is no longer read from until it has been caught up.
+ *
+ *	setup( ) fails on kernels that cannot run the loop (before 6.0);
+ *	SimpleChatServer::runUring( ) then falls back to epoll.
+ */
+
+#include "ring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <vector>
+#include "uringconnection.h"
+
+namespace SCS {
+
+class SimpleChatServer;
+
+class UringLoop
+{
+  public:
+	UringLoop( SimpleChatServer *pServer, int listeningSocket );
+	virtual ~UringLoop( );
+
+	bool setup( );
+	bool run( );
+
+  protected:
+	static const unsigned int RING_ENTRIES   = 1024;
+	static const unsigned int BUFFER_COUNT   = 512;   // power of two
+	static const unsigned int BUFFER_SIZE    = 16384;
+	static const unsigned short BUFFER_GROUP = 0;
+	static const int READ_BUDGET             = 4; // receive completions per client and turn
+
+	bool armAccept( );
+	void handleCompletion( const struct io_uring_cqe &cqe );
+	void acceptClients( );
+	void handleReceived( UringConnection *pConnection );
+	void sendQueued( UringConnection *pConnection );
+	void closeConnection( UringConnection *pConnection );
+	void reap( );
+
+	SimpleChatServer *m_pServer;
+	int m_ListeningSocket;
+	NetMessaging::Ring m_Ring;
+	bool m_bAccepting;
+	std::vector<NetMessaging::Server::Peer> m_Accepted; // by the multishot accept; admitted after the batch
+	std::vector<UringConnection *> m_Ready;   // have receive completions waiting
+	std::vector<UringConnection *> m_Starved; // the buffers ran out; receive again once caught up
+	std::vector<UringConnection *> m_Closed;  // deleted once their last completion has arrived
+
+  private:
+	UringLoop( const UringLoop &loop );
+	UringLoop &operator=( const UringLoop &loop );
+};
+
+} // end of namespace
+#endif
+#endif
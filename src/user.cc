@@ -1,24 +1,161 @@
+#include <algorithm>
+#include <cstring>
 #include "user.h"
 
 namespace SCS {
 
+AtomicCounter User::m_HeapBytes;
+
 User::User( int userSocket )
-  : m_UserSocket(userSocket), m_UserName(""), m_IPAddress("")
+  : m_UserSocket(userSocket), m_nChatrooms(0), m_nCapacity(INLINE_CHATROOMS), m_pChatrooms(m_InlineChatrooms),
+    m_pUserName(m_InlineUserName)
 {
+	m_InlineUserName[ 0 ] = '\0';
 }
-User::User( int userSocket, const std::string &username, const std::string &ip )
-  : m_UserSocket(userSocket), m_UserName(username), m_IPAddress(ip)
+
+User::User( int userSocket, std::string_view username, const NetMessaging::PeerAddress &address )
+  : m_UserSocket(userSocket), m_nChatrooms(0), m_nCapacity(INLINE_CHATROOMS), m_pChatrooms(m_InlineChatrooms),
+    m_Address(address), m_pUserName(m_InlineUserName)
+{
+	assignName( username.data( ), username.length( ) );
+}
+
+User::User( const User &user )
+  : m_UserSocket(user.m_UserSocket), m_nChatrooms(0), m_nCapacity(INLINE_CHATROOMS), m_pChatrooms(m_InlineChatrooms),
+    m_Address(user.m_Address), m_pUserName(m_InlineUserName)
 {
+	assignName( user.m_pUserName, user.usernameLength( ) );
+	assign( user.m_pChatrooms, user.m_nChatrooms );
 }
 
 User::~User( )
 {
+	freeChatrooms( );
+	freeName( );
+}
+
+User &User::operator=( const User &user )
+{
+	if( this != &user )
+	{
+		m_UserSocket = user.m_UserSocket;
+		m_Address    = user.m_Address;
+
+		// the UserTable's name index points at the name; keep it if it is the same...
+		if( strcmp( m_pUserName, user.m_pUserName ) != 0 ) assignName( user.m_pUserName, user.usernameLength( ) );
+		assign( user.m_pChatrooms, user.m_nChatrooms );
+	}
+	return *this;
+}
+
+/*
+ *	Room IDs are kept in a sorted array: a user is in a handful of rooms,
+ *	lookups are a binary search, and joining and leaving shift a few
+ *	32-bit IDs around instead of allocating a node or a string.
+ */
+void User::addChatroom( ChatroomId chatroomId )
+{
+	ChatroomId *pEnd = m_pChatrooms + m_nChatrooms;
+	ChatroomId *pPosition = std::lower_bound( m_pChatrooms, pEnd, chatroomId );
+	if( pPosition != pEnd && *pPosition == chatroomId ) return;
+
+	size_t index = pPosition - m_pChatrooms;
+
+	if( m_nChatrooms == m_nCapacity ) // outgrown; move to (a bigger piece of) the heap
+	{
+		unsigned short capacity = m_nCapacity * 2;
+		ChatroomId *pChatrooms = new ChatroomId[ capacity ];
+		std::copy( m_pChatrooms, m_pChatrooms + m_nChatrooms, pChatrooms );
+
+		freeChatrooms( );
+		m_pChatrooms = pChatrooms;
+		m_nCapacity  = capacity;
+		m_HeapBytes.add( capacity * sizeof(ChatroomId) );
+	}
+
+	std::copy_backward( m_pChatrooms + index, m_pChatrooms + m_nChatrooms, m_pChatrooms + m_nChatrooms + 1 );
+	m_pChatrooms[ index ] = chatroomId;
+	m_nChatrooms++;
+}
+
+void User::removeChatroom( ChatroomId chatroomId )
+{
+	ChatroomId *pEnd = m_pChatrooms + m_nChatrooms;
+	ChatroomId *pPosition = std::lower_bound( m_pChatrooms, pEnd, chatroomId );
+
+	if( pPosition != pEnd && *pPosition == chatroomId )
+	{
+		std::copy( pPosition + 1, pEnd, pPosition );
+		m_nChatrooms--;
+	}
 }
 
-void User::addChatroom( const std::string &chatroomName )
-{ m_Chatrooms.insert( chatroomName ); }
+bool User::isInChatroom( ChatroomId chatroomId ) const
+{ return std::binary_search( m_pChatrooms, m_pChatrooms + m_nChatrooms, chatroomId ); }
 
-void User::removeChatroom( const std::string &chatroomName )
-{ m_Chatrooms.erase( chatroomName ); }
+/*
+ *	Bytes this user takes up, its record and any name or room array on
+ *	the heap.
+ */
+size_t User::footprint( ) const
+{
+	return sizeof(User) + (m_pChatrooms != m_InlineChatrooms ? m_nCapacity * sizeof(ChatroomId) : 0)
+	                    + (m_pUserName != m_InlineUserName ? usernameLength( ) + 1 : 0);
+}
+
+void User::assign( const ChatroomId *pChatrooms, unsigned short count )
+{
+	if( count > m_nCapacity )
+	{
+		freeChatrooms( );
+		m_pChatrooms = new ChatroomId[ count ];
+		m_nCapacity  = count;
+		m_HeapBytes.add( count * sizeof(ChatroomId) );
+	}
+
+	std::copy( pChatrooms, pChatrooms + count, m_pChatrooms );
+	m_nChatrooms = count;
+}
+
+/*
+ *	A name that fits goes in the record; a longer one gets its own
+ *	piece of the heap.
+ */
+void User::assignName( const char *pName, size_t length )
+{
+	freeName( );
+
+	if( length > INLINE_USERNAME_LENGTH )
+	{
+		m_pUserName = new char[ length + 1 ];
+		m_HeapBytes.add( length + 1 );
+	}
+
+	memcpy( m_pUserName, pName, length );
+	m_pUserName[ length ] = '\0';
+}
+
+void User::freeChatrooms( )
+{
+	if( m_pChatrooms != m_InlineChatrooms )
+	{
+		m_HeapBytes.subtract( m_nCapacity * sizeof(ChatroomId) );
+		delete [] m_pChatrooms;
+	}
+
+	m_pChatrooms = m_InlineChatrooms;
+	m_nCapacity  = INLINE_CHATROOMS;
+}
+
+void User::freeName( )
+{
+	if( m_pUserName != m_InlineUserName )
+	{
+		m_HeapBytes.subtract( strlen( m_pUserName ) + 1 );
+		delete [] m_pUserName;
+	}
+
+	m_pUserName = m_InlineUserName;
+}
 
 } // end of namespace SCS
@@ -1,58 +1,91 @@
 #ifndef _USER_H_
 #define _USER_H_
+/*
+ *	user.h
+ *
+ *	A logged in user, kept compact: there can be a great many of them.
+ *	A username of up to INLINE_USERNAME_LENGTH characters lives inline
+ *	and the rooms the user is in are a sorted array of interned room IDs
+ *	(see chatroomnames.h), the first INLINE_CHATROOMS of them inline too.
+ *	Only a longer name, or a user in more rooms than that, costs a heap
+ *	allocation.
+ */
 
 #include <string>
-#include <list>
-#include <set>
+#include <string_view>
+#include <cstring>
+#include <stdint.h>
+#include "protocol.h"
+#include "chatroomnames.h"
+#include "synchronize.h"
 
 namespace SCS {
 
-class User 
+class User
 {
   public:
-	typedef std::set<std::string> ChatroomCollection;
+	static const size_t INLINE_USERNAME_LENGTH   = 23;
+	static const unsigned short INLINE_CHATROOMS = 4;
 
 	explicit User( int userSocket );
-	explicit User( int userSocket, const std::string &username, const std::string &ip );
-	virtual ~User( );
-  
+	User( int userSocket, std::string_view username, const NetMessaging::PeerAddress &address );
+	User( const User &user );
+	~User( );
+
+	User &operator=( const User &user );
+
   	int socket( ) const;
-	std::string &username( );
-	const std::string &username( ) const;
-	std::string &ipAddress( );
-	const std::string &ipAddress( ) const;
-	void addChatroom( const std::string &chatroomName );
-	void removeChatroom( const std::string &chatroomName );
-  	ChatroomCollection &chatrooms( );
-  	const ChatroomCollection &chatrooms( ) const;
-  
+	const char *username( ) const;
+	size_t usernameLength( ) const;
+	const char *ipAddress( ) const;
+
+	void addChatroom( ChatroomId chatroomId );
+	void removeChatroom( ChatroomId chatroomId );
+	bool isInChatroom( ChatroomId chatroomId ) const;
+	const ChatroomId *chatrooms( ) const; // sorted
+	unsigned int numberOfChatrooms( ) const;
+
+	size_t footprint( ) const;
+	static long heapBytes( );
+
   protected:
   	int m_UserSocket; // the client socket
-	std::string m_UserName;
-	std::string m_IPAddress;
-	ChatroomCollection m_Chatrooms;
+	unsigned short m_nChatrooms;
+	unsigned short m_nCapacity;   // of m_pChatrooms
+	ChatroomId *m_pChatrooms;     // m_InlineChatrooms, or on the heap once they outgrow it
+	ChatroomId m_InlineChatrooms[ INLINE_CHATROOMS ];
+	NetMessaging::PeerAddress m_Address; // formatted on first use, under usersLock
+	char *m_pUserName;            // m_InlineUserName, or on the heap for a longer name
+	char m_InlineUserName[ INLINE_USERNAME_LENGTH + 1 ];
+
+	static AtomicCounter m_HeapBytes; // names and room arrays that outgrew their inline space, across all users
+
+	void assign( const ChatroomId *pChatrooms, unsigned short count );
+	void assignName( const char *pName, size_t length );
+	void freeChatrooms( );
+	void freeName( );
 };
 
 inline int User::socket( ) const
 { return m_UserSocket; }
 
-inline std::string &User::username( )
-{ return m_UserName; }
+inline const char *User::username( ) const
+{ return m_pUserName; }
 
-inline const std::string &User::username( ) const
-{ return m_UserName; }
+inline size_t User::usernameLength( ) const
+{ return strlen( m_pUserName ); }
 
-inline std::string &User::ipAddress( )
-{ return m_IPAddress; }
+inline const char *User::ipAddress( ) const
+{ return m_Address.text( ); }
 
-inline const std::string &User::ipAddress( ) const
-{ return m_IPAddress; }
+inline const ChatroomId *User::chatrooms( ) const
+{ return m_pChatrooms; }
 
-inline User::ChatroomCollection &User::chatrooms( )
-{ return m_Chatrooms; }
+inline unsigned int User::numberOfChatrooms( ) const
+{ return m_nChatrooms; }
 
-inline const User::ChatroomCollection &User::chatrooms( ) const
-{ return m_Chatrooms; }
+inline long User::heapBytes( )
+{ return m_HeapBytes.value( ); }
 
 /*
  *	How to compare two User objects...
@@ -0,0 +1,115 @@
+#include <cassert>
+#include "usertable.h"
+
+namespace SCS {
+
+UserTable::UserTable( )
+  : m_nUsers(0)
+{
+}
+
+UserTable::~UserTable( )
+{
+	for( std::vector<Slot>::iterator itr = m_Slots.begin( ); itr != m_Slots.end( ); ++itr )
+	{
+		delete itr->pUser;
+	}
+}
+
+/*
+ *	Add a user under its socket. Returns the stored user, or NULL if the
+ *	socket already has one or the name is taken. The User objects never
+ *	move, so the pointer stays good until the user is erased.
+ */
+User *UserTable::insert( const User &user, UserHandle *pHandle )
+{
+	int socket = user.socket( );
+	assert( socket >= 0 );
+
+	if( m_Names.find( nameOf( user ) ) != m_Names.end( ) ) return NULL; // name taken
+
+	if( (size_t) socket >= m_Slots.size( ) )
+	{
+		Slot empty = { NULL, 0 };
+		m_Slots.resize( socket + 1, empty );
+	}
+
+	Slot &slot = m_Slots[ socket ];
+	if( slot.pUser != NULL ) return NULL; // logged in twice
+
+	slot.pUser = new User( user );
+	m_Names[ nameOf( *slot.pUser ) ] = socket;
+	m_nUsers++;
+
+	if( pHandle != NULL )
+	{
+		pHandle->socket     = socket;
+		pHandle->generation = slot.generation;
+	}
+
+	return slot.pUser;
+}
+
+/*
+ *	Replace the stored copy of user (matched by socket) and re-index it if
+ *	the name changed. Fails if there is no such user or the new name
+ *	belongs to someone else.
+ */
+bool UserTable::update( const User &user )
+{
+	User *pUser = find( user.socket( ) );
+	if( pUser == NULL ) return false;
+
+	if( nameOf( *pUser ) != nameOf( user ) )
+	{
+		if( m_Names.find( nameOf( user ) ) != m_Names.end( ) ) return false; // name taken
+
+		m_Names.erase( nameOf( *pUser ) );
+		*pUser = user;
+		m_Names[ nameOf( *pUser ) ] = user.socket( ); // the key points into *pUser
+		return true;
+	}
+
+	*pUser = user;
+	return true;
+}
+
+bool UserTable::erase( int socket )
+{
+	User *pUser = find( socket );
+	if( pUser == NULL ) return false;
+
+	m_Names.erase( nameOf( *pUser ) );
+
+	Slot &slot = m_Slots[ socket ];
+	slot.pUser = NULL;
+	slot.generation++; // outstanding handles no longer resolve
+	m_nUsers--;
+
+	delete pUser;
+	return true;
+}
+
+/*
+ *	Roughly what the indexes cost beyond the Users: the slots, and the
+ *	name index's nodes and buckets.
+ */
+size_t UserTable::indexBytes( ) const
+{
+	return m_Slots.capacity( ) * sizeof(Slot) +
+	       m_Names.size( ) * (sizeof(NameIndex::value_type) + 2 * sizeof(void *)) + // node, next and cached hash
+	       m_Names.bucket_count( ) * sizeof(void *);
+}
+
+UserHandle UserTable::handle( int socket ) const
+{
+	UserHandle h = { -1, 0 }; // resolves to nothing
+	if( find( socket ) != NULL )
+	{
+		h.socket     = socket;
+		h.generation = m_Slots[ socket ].generation;
+	}
+	return h;
+}
+
+} // end of namespace SCS
@@ -0,0 +1,125 @@
+#ifndef _USERTABLE_H_
+#define _USERTABLE_H_
+/*
+ *	usertable.h
+ *
+ *	Logged in users indexed directly by their socket. A socket is a
+ *	small dense integer so the table is a vector with one slot per file
+ *	descriptor: lookups are a bounds check and an index, and they hand
+ *	back the User in place rather than a copy.
+ *
+ *	The kernel reuses descriptors as soon as they are closed, so every
+ *	slot also carries a generation that is bumped whenever its user is
+ *	removed. A UserHandle remembers the generation it was issued with and
+ *	stops resolving once that user is gone, even if a new user has since
+ *	logged in on the same descriptor.
+ *
+ *	A second, hashed index maps usernames to sockets so that checking
+ *	whether a name is taken, or finding a user by name, costs the same
+ *	no matter how many users are logged in. Its keys point at the names
+ *	inside the stored Users rather than copying them. Both indexes are
+ *	only ever changed together, through insert( ), update( ) and erase( ).
+ *
+ *	Not synchronized; the owner's locks apply (see SimpleChatServer).
+ */
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include "user.h"
+
+namespace SCS {
+
+struct UserHandle
+{
+	int socket;
+	unsigned int generation;
+};
+
+class UserTable
+{
+  public:
+	UserTable( );
+	~UserTable( );
+
+	User *insert( const User &user, UserHandle *pHandle = NULL );
+	bool update( const User &user );
+	bool erase( int socket );
+
+	User *find( int socket );
+	const User *find( int socket ) const;
+	User *find( const UserHandle &handle );
+	User *findByName( std::string_view username );
+	const User *findByName( std::string_view username ) const;
+	UserHandle handle( int socket ) const;
+
+	size_t size( ) const;
+	size_t indexBytes( ) const;
+
+	template <typename Visitor>
+	void forEach( Visitor &visit ) const;
+
+  protected:
+	static std::string_view nameOf( const User &user );
+
+	typedef struct tagSlot {
+		User *pUser; // NULL while the slot is free
+		unsigned int generation;
+	} Slot;
+
+	typedef std::unordered_map<std::string_view, int> NameIndex; // username (in the User) -> socket
+
+	std::vector<Slot> m_Slots;
+	NameIndex m_Names;
+	size_t m_nUsers;
+
+  private:
+	UserTable( const UserTable &table );
+	UserTable &operator=( const UserTable &table );
+};
+
+inline User *UserTable::find( int socket )
+{ return socket >= 0 && (size_t) socket < m_Slots.size( ) ? m_Slots[ socket ].pUser : NULL; }
+
+inline const User *UserTable::find( int socket ) const
+{ return socket >= 0 && (size_t) socket < m_Slots.size( ) ? m_Slots[ socket ].pUser : NULL; }
+
+inline User *UserTable::find( const UserHandle &handle )
+{
+	User *pUser = find( handle.socket );
+	return pUser != NULL && m_Slots[ handle.socket ].generation == handle.generation ? pUser : NULL;
+}
+
+inline User *UserTable::findByName( std::string_view username )
+{
+	NameIndex::const_iterator itr = m_Names.find( username );
+	return itr != m_Names.end( ) ? m_Slots[ itr->second ].pUser : NULL;
+}
+
+inline const User *UserTable::findByName( std::string_view username ) const
+{
+	NameIndex::const_iterator itr = m_Names.find( username );
+	return itr != m_Names.end( ) ? m_Slots[ itr->second ].pUser : NULL;
+}
+
+inline size_t UserTable::size( ) const
+{ return m_nUsers; }
+
+inline std::string_view UserTable::nameOf( const User &user )
+{ return std::string_view( user.username( ), user.usernameLength( ) ); }
+
+/*
+ *	Call visit( const User & ) for every user, in socket order.
+ */
+template <typename Visitor>
+void UserTable::forEach( Visitor &visit ) const
+{
+	for( std::vector<Slot>::const_iterator itr = m_Slots.begin( ); itr != m_Slots.end( ); ++itr )
+	{
+		if( itr->pUser != NULL ) visit( *itr->pUser );
+	}
+}
+
+} // end of namespace SCS
+#endif
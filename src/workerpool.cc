@@ -0,0 +1,298 @@
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "workerpool.h"
+#include "simplechatserver.h"
+#include "engine.h"
+
+namespace SCS {
+
+StripedCounter WorkerPool::m_TasksRun;
+AtomicCounter WorkerPool::m_TasksStolen;
+
+WorkerPool::WorkerPool( SimpleChatServer *pServer, int listeningSocket, unsigned int workers, size_t stackSize )
+  : m_pServer(pServer), m_ListeningSocket(listeningSocket), m_EpollSocket(-1),
+    m_nWorkers(workers > 0 ? workers : 1), m_nStarted(0), m_nStackSize(stackSize),
+    m_pWorkers(NULL), m_bStopping(false)
+{
+	assert( m_pServer != NULL );
+	sem_init( &m_Ready, 0, 0 );
+
+	m_pWorkers = new Worker[ m_nWorkers ];
+	for( unsigned int i = 0; i < m_nWorkers; i++ )
+	{
+		m_pWorkers[ i ].pPool = this;
+		m_pWorkers[ i ].index = i;
+	}
+}
+
+WorkerPool::~WorkerPool( )
+{
+	m_bStopping = true;
+	for( unsigned int i = 0; i < m_nStarted; i++ ) sem_post( &m_Ready );
+	for( unsigned int i = 0; i < m_nStarted; i++ ) pthread_join( m_pWorkers[ i ].threadID, NULL );
+
+	reap( );
+	delete [] m_pWorkers;
+	sem_destroy( &m_Ready );
+	if( m_EpollSocket >= 0 ) close( m_EpollSocket );
+}
+
+/*
+ *	Spawn every worker before the first client is accepted.
+ */
+bool WorkerPool::start( )
+{
+	pthread_attr_t attributes;
+	pthread_attr_init( &attributes );
+
+	if( m_nStackSize > 0 )
+	{
+		size_t stackSize = m_nStackSize < (size_t) PTHREAD_STACK_MIN ? (size_t) PTHREAD_STACK_MIN : m_nStackSize;
+		if( pthread_attr_setstacksize( &attributes, stackSize ) != 0 )
+		{
+			Engine::onError( "Could not set the worker stack size to %lu bytes.", (unsigned long) stackSize );
+		}
+	}
+
+	for( ; m_nStarted < m_nWorkers; m_nStarted++ )
+	{
+		if( pthread_create( &m_pWorkers[ m_nStarted ].threadID, &attributes, WorkerPool::work, &m_pWorkers[ m_nStarted ] ) != 0 )
+		{
+			Engine::onError( "Failed to create worker thread %u.", m_nStarted );
+			pthread_attr_destroy( &attributes );
+			return false;
+		}
+	}
+
+	pthread_attr_destroy( &attributes );
+	return true;
+}
+
+/*
+ *	The calling thread becomes the poller. Only returns if the pool
+ *	could not be set up or epoll fails.
+ */
+bool WorkerPool::run( )
+{
+	if( (m_EpollSocket = epoll_create1( EPOLL_CLOEXEC )) < 0 )
+	{
+		Engine::onError( "Could not create epoll instance; errno = %d", errno );
+		return false;
+	}
+
+	if( !NetMessaging::Server::setNonBlocking( m_ListeningSocket ) )
+	{
+		Engine::onError( "Could not make the listening socket non-blocking." );
+		return false;
+	}
+
+	struct epoll_event event;
+	memset( &event, 0, sizeof(event) );
+	event.events   = EPOLLIN;
+	event.data.ptr = NULL;
+
+	if( epoll_ctl( m_EpollSocket, EPOLL_CTL_ADD, m_ListeningSocket, &event ) < 0 )
+	{
+		Engine::onError( "Could not register the listening socket with epoll; errno = %d", errno );
+		return false;
+	}
+
+	if( !start( ) ) return false;
+
+	Engine::onInfo( "Serving clients from a pool of %u worker threads (stack = %lu bytes).", m_nWorkers, (unsigned long) m_nStackSize );
+
+	struct epoll_event events[ MAX_EVENTS ];
+
+	while( true )
+	{
+		// everything in the graveyard was unregistered before it got
+		// there, and the last batch of events has been dealt with...
+		reap( );
+
+		int count = epoll_wait( m_EpollSocket, events, MAX_EVENTS, -1 );
+		NetMessaging::Protocol::countWaitCall( );
+
+		if( count < 0 )
+		{
+			if( errno == EINTR ) continue;
+			Engine::onError( "epoll_wait( ) failed; errno = %d", errno );
+			return false;
+		}
+
+		for( int i = 0; i < count; i++ )
+		{
+			if( events[ i ].data.ptr == NULL )
+			{
+				acceptClients( );
+			}
+			else
+			{
+				bool bWakeup;
+				Connection *pConnection = Connection::fromEvent( events[ i ].data, &bWakeup );
+				if( pConnection->isRetired( ) ) continue;
+
+				if( bWakeup ) pConnection->clearWakeup( );
+				if( pConnection->schedule( ) ) push( pConnection );
+			}
+		}
+	}
+
+	return true;
+}
+
+void WorkerPool::acceptClients( )
+{
+	m_pServer->acceptConnections( m_ListeningSocket, m_Admitted );
+
+	for( size_t i = 0; i < m_Admitted.size( ); i++ )
+	{
+		int clientSocket = m_Admitted[ i ].socket;
+
+		Connection *pConnection = new Connection( clientSocket, m_Admitted[ i ].address );
+		m_pServer->registerConnection( pConnection );
+
+		if( !pConnection->watch( m_EpollSocket ) )
+		{
+			Engine::onError( "Client socket = %d, could not register with epoll; errno = %d", clientSocket, errno );
+			m_pServer->handleDisconnect( clientSocket );
+			delete pConnection;
+		}
+	}
+	m_Admitted.clear( );
+}
+
+void WorkerPool::push( Connection *pConnection )
+{
+	Worker &worker = m_pWorkers[ pConnection->socket( ) % m_nWorkers ];
+
+	worker.lock.lock( ); // crtical section...
+		worker.ready.push_back( pConnection );
+	worker.lock.unlock( );
+
+	sem_post( &m_Ready );
+}
+
+/*
+ *	Our own queue is served oldest first; when it is empty the newest
+ *	entry of another worker's queue is stolen, which is the one its
+ *	owner would have got to last.
+ */
+Connection *WorkerPool::take( Worker &worker )
+{
+	Connection *pConnection = NULL;
+
+	worker.lock.lock( ); // crtical section...
+		if( !worker.ready.empty( ) )
+		{
+			pConnection = worker.ready.front( );
+			worker.ready.pop_front( );
+		}
+	worker.lock.unlock( );
+
+	for( unsigned int i = 1; pConnection == NULL && i < m_nWorkers; i++ )
+	{
+		Worker &victim = m_pWorkers[ (worker.index + i) % m_nWorkers ];
+
+		victim.lock.lock( ); // crtical section...
+			if( !victim.ready.empty( ) )
+			{
+				pConnection = victim.ready.back( );
+				victim.ready.pop_back( );
+			}
+		victim.lock.unlock( );
+
+		if( pConnection != NULL ) m_TasksStolen.add( );
+	}
+
+	return pConnection;
+}
+
+void *WorkerPool::work( void *pWorker )
+{
+	Worker *pSelf = static_cast<Worker *>( pWorker );
+	assert( pSelf != NULL );
+
+	pSelf->pPool->work( *pSelf );
+	return NULL;
+}
+
+void WorkerPool::work( Worker &worker )
+{
+	while( true )
+	{
+		if( sem_wait( &m_Ready ) != 0 ) continue; // EINTR
+
+		Connection *pConnection = NULL;
+
+		// Every post is matched by a queued connection, but a thief
+		// holding another post may have taken ours; keep looking...
+		while( !m_bStopping && (pConnection = take( worker )) == NULL )
+		{
+			sched_yield( );
+		}
+
+		if( m_bStopping ) return;
+
+		serve( pConnection );
+	}
+}
+
+/*
+ *	Read and handle everything pending, then flush the replies along
+ *	with whatever other threads posted for the client. Events that
+ *	arrive meanwhile make finish( ) fail and we go around again.
+ */
+void WorkerPool::serve( Connection *pConnection )
+{
+	do
+	{
+		m_TasksRun.add( );
+		pConnection->beginBatch( );
+
+		if( m_pServer->receiveMessages( pConnection ) == NetMessaging::Protocol::FAILED ||
+		    pConnection->flush( ) == NetMessaging::Protocol::FAILED )
+		{
+			closeConnection( pConnection );
+			return;
+		}
+	} while( pConnection->finish( ) );
+}
+
+void WorkerPool::closeConnection( Connection *pConnection )
+{
+	int clientSocket = pConnection->socket( );
+
+	pConnection->retire( );
+	pConnection->unwatch( m_EpollSocket );
+
+	// remove user from all chatrooms...
+	NetMessaging::Protocol::Message message;
+	NetMessaging::Protocol::initializeMessage( message );
+	m_pServer->handleUserLeave( clientSocket, message );
+	m_pServer->handleDisconnect( clientSocket );
+
+	// the poller may still hold an event for it...
+	m_GraveyardLock.lock( ); // crtical section...
+		m_Graveyard.push_back( pConnection );
+	m_GraveyardLock.unlock( );
+}
+
+void WorkerPool::reap( )
+{
+	std::vector<Connection *> graveyard;
+
+	m_GraveyardLock.lock( ); // crtical section...
+		graveyard.swap( m_Graveyard );
+	m_GraveyardLock.unlock( );
+
+	for( size_t i = 0; i < graveyard.size( ); i++ )
+	{
+		delete graveyard[ i ];
+	}
+}
+
+} // end of namespace
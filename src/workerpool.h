@@ -0,0 +1,89 @@
+#ifndef _WORKERPOOL_H_
+#define _WORKERPOOL_H_
+/*
+ *	workerpool.h
+ *
+ *	A fixed set of worker threads, spawned up front, serving every client.
+ *	The thread calling run( ) polls the listener and the client sockets
+ *	(edge-triggered epoll) and hands connections with pending events to a
+ *	worker's ready queue; the socket picks the queue. A worker takes from
+ *	the front of its own queue and, when that is empty, steals from the
+ *	back of the others', so a burst on a few sockets (e.g. one busy room)
+ *	is spread over every worker. Connection::schedule( ) keeps a
+ *	connection on at most one worker at a time.
+ */
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include <semaphore.h>
+#include "synchronize.h"
+#include "connection.h"
+
+namespace SCS {
+
+class SimpleChatServer;
+
+class WorkerPool
+{
+  public:
+	WorkerPool( SimpleChatServer *pServer, int listeningSocket, unsigned int workers, size_t stackSize = 0 );
+	virtual ~WorkerPool( );
+
+	bool run( );
+
+	static long tasksRun( );
+	static long tasksStolen( );
+
+  protected:
+	static const int MAX_EVENTS = 256;
+
+	typedef std::deque<Connection *> ReadyQueue;
+
+	struct Worker {
+		WorkerPool *pPool;
+		unsigned int index;
+		pthread_t threadID;
+		Lock lock;
+		ReadyQueue ready;
+	};
+
+	bool start( );
+	static void *work( void *pWorker );
+	void work( Worker &worker );
+	Connection *take( Worker &worker );
+	void push( Connection *pConnection );
+	void serve( Connection *pConnection );
+	void acceptClients( );
+	void closeConnection( Connection *pConnection );
+	void reap( );
+
+	SimpleChatServer *m_pServer;
+	int m_ListeningSocket;
+	int m_EpollSocket;
+	unsigned int m_nWorkers;
+	unsigned int m_nStarted;
+	size_t m_nStackSize;         // bytes per worker stack, or 0 for the default
+	Worker *m_pWorkers;
+	sem_t m_Ready;               // one post per queued connection
+	volatile bool m_bStopping;
+	Lock m_GraveyardLock;
+	std::vector<Connection *> m_Graveyard; // closed by a worker; deleted by the poller
+	std::vector<NetMessaging::Server::Peer> m_Admitted; // accepted in the current round
+
+	static StripedCounter m_TasksRun;
+	static AtomicCounter m_TasksStolen;
+
+  private:
+	WorkerPool( const WorkerPool &pool );
+	WorkerPool &operator=( const WorkerPool &pool );
+};
+
+inline long WorkerPool::tasksRun( )
+{ return m_TasksRun.value( ); }
+
+inline long WorkerPool::tasksStolen( )
+{ return m_TasksStolen.value( ); }
+
+} // end of namespace
+#endif